@@ -1,27 +1,127 @@
+#ifdef _WIN32
 #include <windows.h>
+#include <mmsystem.h>
+#else
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+#endif
 #include <GL/glut.h>
+#include <GL/glext.h>
 #include <cmath>
 #include <vector>
 #include <ctime>
 #include <string>
 #include <iostream>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cctype>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <map>
+#include <new>
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define RETRO_AVX2_KERNELS 1
+#define RETRO_TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#include <intrin.h>
+#include <malloc.h>
+#define RETRO_AVX2_KERNELS 1
+#define RETRO_TARGET_AVX2
+#endif
+#if defined(__GNUC__)
+#define RETRO_NOINLINE __attribute__((noinline))
+#elif defined(_MSC_VER)
+#define RETRO_NOINLINE __declspec(noinline)
+#else
+#define RETRO_NOINLINE
+#endif
 
 // Window dimensions
 const int SCR_WIDTH = 1200;
 const int SCR_HEIGHT = 800;
 
+// Far clip plane; the shaded grid reaches all the way to it
+const float VIEW_DISTANCE = 500.0f;
+
 // Camera variables
 float cameraX = 0.0f, cameraY = 10.0f, cameraZ = 60.0f;
 float lookX = 0.0f, lookY = 0.0f, lookZ = -1.0f;
+bool chaseCamera = true; // Follow the player's car; off for the free camera and the bench
+
+// Held keys for the driving controls (GLUT only reports presses and releases)
+bool keysDown[256];
+bool specialKeysDown[256];
+bool shiftDown = false;
+bool showRaceStats = false;
 
 // Animation variables
-float gridOffset = 0.0f;
-float vortexAngle = 0.0f;
-float tunnelDepth = 0.0f;
-float lastTime = 0.0f;
-float buildingPulse = 0.0f;
-bool showMusicVisualization = true;
+bool showMusicVisualization = true; // Music drives the pulses when a WAV track is analyzed
+
+// Seeded random numbers. Every consumer draws from its own stream, so the
+// scene and the car respawn sequence only depend on the seed (--seed).
+enum RandomStream {
+    RNG_BUILDINGS,
+    RNG_STARS,
+    RNG_SPINNERS,
+    RNG_TRAFFIC,  // Cars placed with a city chunk
+    RNG_RESPAWN   // Cars re-rolled after leaving their stretch of avenue
+};
+
+unsigned long long worldSeed = 0;
+bool seedGiven = false;
+
+// PCG32 (XSH RR), one generator per stream
+struct Random {
+    unsigned long long state;
+    unsigned long long increment;
+
+    Random() : state(0), increment(1) {}
+
+    // key separates independent generators of the same stream (chunk, car)
+    Random(RandomStream stream, unsigned long long key) {
+        state = 0;
+        increment = ((mix(worldSeed ^ (static_cast<unsigned long long>(stream) << 56)) ^ mix(key)) << 1) | 1;
+        nextU32();
+        state += mix(worldSeed + key);
+        nextU32();
+    }
+
+    static unsigned long long mix(unsigned long long z) {
+        z += 0x9E3779B97F4A7C15ULL;
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    unsigned int nextU32() {
+        unsigned long long old = state;
+        state = old * 6364136223846793005ULL + increment;
+        unsigned int xorshifted = static_cast<unsigned int>(((old >> 18) ^ old) >> 27);
+        unsigned int rot = static_cast<unsigned int>(old >> 59);
+        return (xorshifted >> rot) | (xorshifted << ((32 - rot) & 31));
+    }
+
+    // Uniform in [0, 1)
+    float nextFloat() {
+        return (nextU32() >> 8) / 16777216.0f;
+    }
+
+    float range(float lo, float hi) {
+        return lo + nextFloat() * (hi - lo);
+    }
+
+    // Uniform in [0, n)
+    int below(int n) {
+        return static_cast<int>((static_cast<unsigned long long>(nextU32()) * static_cast<unsigned int>(n)) >> 32);
+    }
+};
 
 // Object structures
 struct Building {
@@ -41,89 +141,577 @@ struct Spinner {
     bool isPink; // true=pink, false=blue
 };
 
-struct Car {
-    float x, z;
-    bool isBlue;
-    float speed;
+// Heap allocation counting. The global operator new is replaced so the
+// profiler can show allocations per frame and the bench can insist that
+// steady-state frames make none. Threads that work outside the frame (chunk
+// generation, audio decoding, music analysis) set heapUntracked and are not
+// counted. Tracked threads also keep their own count, so a thread that runs
+// beside the frame (the audio output) can check its own work.
+// The replacements stay out of line so GCC never pairs an inlined free()
+// with a call to operator new.
+std::atomic<long long> heapAllocations(0);
+std::atomic<long long> heapBytes(0);
+thread_local bool heapUntracked = false;
+thread_local long long threadHeapAllocations = 0;
+
+static inline void countHeapAllocation(size_t size) {
+    if (heapUntracked) return;
+    threadHeapAllocations++;
+    heapAllocations.fetch_add(1, std::memory_order_relaxed);
+    heapBytes.fetch_add(static_cast<long long>(size), std::memory_order_relaxed);
+}
+
+RETRO_NOINLINE void* operator new(size_t size) {
+    countHeapAllocation(size);
+    void* p = malloc(size > 0 ? size : 1);
+    if (p == NULL) throw std::bad_alloc();
+    return p;
+}
+
+RETRO_NOINLINE void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+RETRO_NOINLINE void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    countHeapAllocation(size);
+    return malloc(size > 0 ? size : 1);
+}
+
+RETRO_NOINLINE void* operator new[](size_t size, const std::nothrow_t& tag) noexcept {
+    return operator new(size, tag);
+}
+
+RETRO_NOINLINE void operator delete(void* p) noexcept {
+    free(p);
+}
+
+RETRO_NOINLINE void operator delete[](void* p) noexcept {
+    free(p);
+}
+
+RETRO_NOINLINE void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+RETRO_NOINLINE void operator delete[](void* p, size_t) noexcept {
+    free(p);
+}
+
+// std::vector storage aligned for 256-bit loads
+template <typename T, size_t Alignment = 32>
+struct AlignedAllocator {
+    typedef T value_type;
+    template <typename U> struct rebind { typedef AlignedAllocator<U, Alignment> other; };
+
+    AlignedAllocator() {}
+    template <typename U> AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+
+    T* allocate(size_t n) {
+        countHeapAllocation(n * sizeof(T));
+#ifdef _WIN32
+        void* p = _aligned_malloc(n * sizeof(T), Alignment);
+#else
+        void* p = NULL;
+        if (posix_memalign(&p, Alignment, n * sizeof(T)) != 0) p = NULL;
+#endif
+        if (p == NULL) throw std::bad_alloc();
+        return static_cast<T*>(p);
+    }
+
+    void deallocate(T* p, size_t) {
+#ifdef _WIN32
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+    }
+};
+
+template <typename T, typename U, size_t A>
+bool operator==(const AlignedAllocator<T, A>&, const AlignedAllocator<U, A>&) { return true; }
+template <typename T, typename U, size_t A>
+bool operator!=(const AlignedAllocator<T, A>&, const AlignedAllocator<U, A>&) { return false; }
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T> >;
+
+const int TRAFFIC_LANES = 4;      // Across the avenue, x from -8 to 8
+const float LANE_WIDTH = 4.0f;
+
+// Cars as parallel arrays, so the update kernels handle 8 at a time. Each car
+// respawns from its own generator, so respawns don't depend on chunk arrival
+// order.
+struct Traffic {
+    AlignedVector<float> x, z, speed;
+    AlignedVector<float> desired;       // Speed on an open road
+    AlignedVector<float> startZ, endZ;  // Respawn at startZ after passing endZ
+    AlignedVector<unsigned int> rng;    // Respawn generator state, see trafficRandom()
+    AlignedVector<unsigned char> lane;  // Lane the car drives in or is moving to
+    AlignedVector<unsigned char> isBlue;
+    std::vector<long long> chunk;       // City chunk that owns the car
+    unsigned int generation;            // Bumped when cars are added or removed
+    unsigned int step;                  // Steps taken, staggers lane change decisions
+
+    Traffic() : generation(0), step(0) {}
+
+    size_t size() const { return z.size(); }
+
+    void add(float carX, float carZ, bool blue, float carSpeed, float start, float end, long long owner, unsigned int seed) {
+        x.push_back(carX);
+        z.push_back(carZ);
+        speed.push_back(carSpeed);
+        desired.push_back(carSpeed);
+        startZ.push_back(start);
+        endZ.push_back(end);
+        rng.push_back(seed);
+        lane.push_back(static_cast<unsigned char>(std::min(TRAFFIC_LANES - 1, std::max(0, static_cast<int>((carX + 8.0f) / LANE_WIDTH)))));
+        isBlue.push_back(blue ? 1 : 0);
+        chunk.push_back(owner);
+        generation++;
+    }
+
+    void append(const Traffic& other) {
+        x.insert(x.end(), other.x.begin(), other.x.end());
+        z.insert(z.end(), other.z.begin(), other.z.end());
+        speed.insert(speed.end(), other.speed.begin(), other.speed.end());
+        desired.insert(desired.end(), other.desired.begin(), other.desired.end());
+        startZ.insert(startZ.end(), other.startZ.begin(), other.startZ.end());
+        endZ.insert(endZ.end(), other.endZ.begin(), other.endZ.end());
+        rng.insert(rng.end(), other.rng.begin(), other.rng.end());
+        lane.insert(lane.end(), other.lane.begin(), other.lane.end());
+        isBlue.insert(isBlue.end(), other.isBlue.begin(), other.isBlue.end());
+        chunk.insert(chunk.end(), other.chunk.begin(), other.chunk.end());
+        generation++;
+    }
+
+    // Drops one chunk's cars, keeping the others in order
+    void removeChunk(long long key) {
+        size_t kept = 0;
+        for (size_t i = 0; i < size(); i++) {
+            if (chunk[i] == key) continue;
+            x[kept] = x[i];
+            z[kept] = z[i];
+            speed[kept] = speed[i];
+            desired[kept] = desired[i];
+            startZ[kept] = startZ[i];
+            endZ[kept] = endZ[i];
+            rng[kept] = rng[i];
+            lane[kept] = lane[i];
+            isBlue[kept] = isBlue[i];
+            chunk[kept] = chunk[i];
+            kept++;
+        }
+        resize(kept);
+        generation++;
+    }
+
+    void reserve(size_t count) {
+        x.reserve(count);
+        z.reserve(count);
+        speed.reserve(count);
+        desired.reserve(count);
+        startZ.reserve(count);
+        endZ.reserve(count);
+        rng.reserve(count);
+        lane.reserve(count);
+        isBlue.reserve(count);
+        chunk.reserve(count);
+    }
+
+    void resize(size_t count) {
+        x.resize(count);
+        z.resize(count);
+        speed.resize(count);
+        desired.resize(count);
+        startZ.resize(count);
+        endZ.resize(count);
+        rng.resize(count);
+        lane.resize(count);
+        isBlue.resize(count);
+        chunk.resize(count);
+    }
+};
+
+// Cars of each chunk's stretch of avenue, grouped by lane and sorted by z, so
+// the car ahead is the next entry. Rebuilt when chunks come or go; otherwise
+// re-sorted in place from the last step's order, which is close to linear
+// since cars rarely pass each other.
+struct TrafficIndex {
+    struct Stretch {
+        size_t first, last;                    // Cars [first, last) share the stretch
+        unsigned int lanes[TRAFFIC_LANES + 1]; // Lane l is order[lanes[l]] to order[lanes[l + 1]]
+    };
+    std::vector<Stretch> stretches;
+    std::vector<unsigned int> order, scratch;
+    AlignedVector<float> gap;     // Per car: bumper to bumper distance to the car ahead
+    AlignedVector<float> closing; // Per car: how fast that distance shrinks
+    unsigned int generation;      // Traffic::generation the stretches were built for
+    size_t builtFor;
+    int laneChanges;              // Decided in the last step
+
+    TrafficIndex() : generation(0), builtFor(~static_cast<size_t>(0)), laneChanges(0) {}
+};
+
+const float TWO_PI = 6.28318531f;
+
+// Driving controls, sent to the simulation every frame
+struct PlayerInput {
+    float throttle;  // 0 to 1
+    float brake;     // 0 to 1, reverses once stopped
+    float steer;     // -1 (left) to 1 (right)
+    bool handbrake;  // Drops grip so the car slides
+    bool boost;
+};
+
+// The player's car, integrated at the fixed simulation step. Heading 0
+// faces -z like the default camera; positive headings turn right.
+struct PlayerCar {
+    float x, z, heading;
+    float velocityX, velocityZ;
+    float yawRate;
+    float boost;        // Boost left, 0 to 1, refilled while not boosting
+    bool drifting;
+    PlayerInput input;  // Applied to every step until the next one arrives
+
+    // Collision counters since the start, for the stats view and the bench
+    long long ticks;
+    long long swept;    // Broadphase entries visited
+    long long tested;   // Pairs that reached the box test
+    long long contacts;
+    long long physicsNanoseconds;
+};
+
+// Footprint on the ground for collision tests
+struct CollisionBox {
+    float minX, minZ, maxX, maxZ;
+};
+
+// A chunk's building footprints sorted by minZ, so the sweep along z can
+// binary search to the ones near the player
+struct ChunkColliders {
+    std::vector<CollisionBox> boxes;
+    float maxDepth; // Longest box along z: how far before the query a box may start
+};
+
+// Smoothed levels of the playing track, 0..1; beat jumps to 1 on an onset
+// and decays. Inactive without a track (or with the visualization off), and
+// the animations fall back to their sine waves.
+struct MusicLevels {
+    bool active;
+    float bass, mid, high;
+    float beat;
+};
+
+// Everything the simulation advances. Two copies are kept so rendering can
+// interpolate between the last two fixed steps.
+struct SimState {
+    double time;
+    float gridOffset;
+    float vortexAngle;
+    float tunnelDepth;
+    float buildingPulse;
+    std::vector<Spinner> spinners;
+    Traffic traffic;
+    PlayerCar player;
+    MusicLevels music;
 };
 
 // Collections
-std::vector<Building> buildings;
 std::vector<Star> stars;
-std::vector<Spinner> spinners;
-std::vector<Car> cars;
 
-// Music player (Windows-native)
-class SimpleAudioPlayer {
+// Lock-free single-producer/single-consumer ring
+template <typename T, unsigned Capacity>
+class SpscQueue {
 private:
-    bool isPlaying;
-    float volume;
-    std::string currentFile;
+    T items[Capacity];
+    std::atomic<unsigned> head; // Next slot to read (consumer)
+    std::atomic<unsigned> tail; // Next slot to write (producer)
 
 public:
-    SimpleAudioPlayer() : isPlaying(false), volume(0.5f) {}
+    SpscQueue() : head(0), tail(0) {}
 
-    bool playMusic(const std::string& filename) {
-        stopMusic();
-        std::string openCommand = "open \"" + filename + "\" type mpegvideo alias retroMusic";
-        if (mciSendStringA(openCommand.c_str(), NULL, 0, NULL) != 0) {
-            std::cerr << "Failed to open MP3 file: " << filename << std::endl;
-            return false;
-        }
+    bool push(const T& item) {
+        unsigned t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity) return false;
+        items[t % Capacity] = item;
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
 
-        setVolume(volume);
-        std::string playCommand = "play retroMusic repeat";
-        if (mciSendStringA(playCommand.c_str(), NULL, 0, NULL) != 0) {
-            std::cerr << "Failed to play MP3 file" << std::endl;
-            mciSendStringA("close retroMusic", NULL, 0, NULL);
-            return false;
-        }
+    bool pop(T& item) {
+        unsigned h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        item = items[h % Capacity];
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+// Lock-free triple buffer: the writer fills its back slot and swaps it into
+// the middle; the reader swaps the middle into its front slot when it holds
+// something newer. Neither side ever waits for the other.
+template <typename T>
+class TripleBuffer {
+private:
+    static const unsigned FRESH = 4; // Middle slot not yet seen by the reader
+    T slots[3];
+    std::atomic<unsigned> middle;
+    unsigned back;  // Writer only
+    unsigned front; // Reader only
+
+public:
+    TripleBuffer() : middle(1), back(0), front(2) {}
+
+    T& writeSlot() { return slots[back]; }
 
-        currentFile = filename;
-        isPlaying = true;
+    void publish() {
+        back = middle.exchange(back | FRESH, std::memory_order_acq_rel) & ~FRESH;
+    }
+
+    // True if a newer slot was picked up
+    bool update() {
+        if ((middle.load(std::memory_order_relaxed) & FRESH) == 0) return false;
+        front = middle.exchange(front, std::memory_order_acq_rel) & ~FRESH;
         return true;
     }
 
-    void toggleMusic() {
-        if (isPlaying) {
-            mciSendStringA("pause retroMusic", NULL, 0, NULL);
-            isPlaying = false;
-        } else {
-            mciSendStringA("resume retroMusic", NULL, 0, NULL);
-            isPlaying = true;
-        }
+    const T& readSlot() const { return slots[front]; }
+
+    // Any of the three, for setup while neither side runs
+    T& slotAt(int i) { return slots[i]; }
+};
+
+// Map from chunk keys with a capacity fixed up front, so chunks can come and
+// go without touching the heap. Linear probing at under half load; erasing
+// shifts the rest of the run back instead of leaving tombstones.
+template <typename T>
+class ChunkKeyMap {
+private:
+    struct Entry {
+        long long key;
+        T value;
+        bool used;
+    };
+    std::vector<Entry> entries;
+    size_t mask;
+    size_t count;
+
+    size_t home(long long key) const {
+        return static_cast<size_t>((static_cast<unsigned long long>(key) * 0x9E3779B97F4A7C15ULL) >> 32) & mask;
     }
 
-    void stopMusic() {
-        if (isPlaying) {
-            mciSendStringA("stop retroMusic", NULL, 0, NULL);
-            mciSendStringA("close retroMusic", NULL, 0, NULL);
-            isPlaying = false;
-        }
+    // Slot holding key, or the free slot ending its run
+    size_t probe(long long key) const {
+        size_t i = home(key);
+        while (entries[i].used && entries[i].key != key) i = (i + 1) & mask;
+        return i;
+    }
+
+public:
+    ChunkKeyMap() : mask(0), count(0) {}
+
+    // Room for capacity keys; drops what was there
+    void reset(size_t capacity) {
+        size_t size = 16;
+        while (size < capacity * 2) size *= 2;
+        entries.assign(size, Entry());
+        mask = size - 1;
+        count = 0;
+    }
+
+    size_t size() const { return count; }
+
+    void clear() {
+        for (size_t i = 0; i < entries.size(); i++) entries[i].used = false;
+        count = 0;
+    }
+
+    T* find(long long key) {
+        if (entries.empty()) return NULL;
+        Entry& entry = entries[probe(key)];
+        return entry.used ? &entry.value : NULL;
     }
 
-    void setVolume(float vol) {
-        volume = (vol < 0.0f) ? 0.0f : (vol > 1.0f) ? 1.0f : vol;
-        int winVolume = static_cast<int>(volume * 1000);
-        char buffer[50];
-        sprintf(buffer, "%d", winVolume);
-        std::string volCommand = "setaudio retroMusic volume to ";
-        volCommand += buffer;
-        mciSendStringA(volCommand.c_str(), NULL, 0, NULL);
+    const T* find(long long key) const {
+        if (entries.empty()) return NULL;
+        const Entry& entry = entries[probe(key)];
+        return entry.used ? &entry.value : NULL;
     }
 
-    void adjustVolume(float change) {
-        setVolume(volume + change);
-        std::cout << "Volume: " << (volume * 100) << "%" << std::endl;
+    // The value under key, value-initialized if it was not there. The caller
+    // stays within the capacity given to reset().
+    T& insert(long long key) {
+        Entry& entry = entries[probe(key)];
+        if (!entry.used) {
+            entry.key = key;
+            entry.value = T();
+            entry.used = true;
+            count++;
+        }
+        return entry.value;
     }
 
-    ~SimpleAudioPlayer() {
-        stopMusic();
+    void erase(long long key) {
+        if (entries.empty()) return;
+        size_t hole = probe(key);
+        if (!entries[hole].used) return;
+        entries[hole].used = false;
+        count--;
+
+        // Later entries of the run move up unless the hole is before their home
+        for (size_t i = (hole + 1) & mask; entries[i].used; i = (i + 1) & mask) {
+            size_t wanted = home(entries[i].key);
+            bool reachable = hole <= i ? (wanted <= hole || wanted > i) : (wanted <= hole && wanted > i);
+            if (!reachable) continue;
+            entries[hole] = entries[i];
+            entries[i].used = false;
+            hole = i;
+        }
     }
 };
 
-// Global audio player
-SimpleAudioPlayer audioPlayer;
+// Fixed-step simulation
+const float SIM_STEP = 1.0f / 120.0f;
+const float MAX_FRAME_DELTA = 0.25f; // Longer hitches are dropped instead of simulated
+SimState simPrevious = SimState();
+SimState simCurrent = SimState();
+SimState simRender = SimState();    // Interpolated state read by the draw functions
+TrafficIndex trafficIndex;          // Lanes of simCurrent.traffic
+ChunkKeyMap<ChunkColliders*> buildingColliders; // By chunk key, sized with the chunk streamer
+float simAccumulator = 0.0f;
+
+// What the simulation thread publishes: the last two fixed steps and the
+// time run past the newer one, as of a clock value sent by the render thread
+struct SimSnapshot {
+    SimState previous, current;
+    float accumulator;
+    float clock;
+};
+
+enum SimCommandType {
+    SIM_ADVANCE,        // Run the steps up to clock
+    SIM_ADD_CHUNK,      // A streamed chunk's cars and building footprints arrived
+    SIM_REMOVE_CHUNK,   // They left with the chunk
+    SIM_PLAYER_INPUT,   // This frame's driving controls
+    SIM_MUSIC           // This frame's music levels
+};
+
+struct SimCommand {
+    SimCommandType type;
+    float clock;
+    long long chunk;
+    Traffic* cars;              // SIM_ADD_CHUNK, may be NULL; deleted once applied
+    ChunkColliders* buildings;  // SIM_ADD_CHUNK, may be NULL; owned by the simulation
+    PlayerInput input;          // SIM_PLAYER_INPUT
+    MusicLevels music;          // SIM_MUSIC
+};
+
+// Everything zeroed; callers fill in the fields their type uses
+SimCommand makeSimCommand(SimCommandType type) {
+    SimCommand command = SimCommand();
+    command.type = type;
+    return command;
+}
+
+// While the thread runs it owns simPrevious, simCurrent, simAccumulator,
+// trafficIndex and buildingColliders;
+// the render thread only sends commands and reads snapshots. Commands keep
+// their order, so traffic changes land between the same steps every run.
+struct SimThread {
+    SpscQueue<SimCommand, 1024> commands;  // Render thread -> simulation
+    TripleBuffer<SimSnapshot> snapshots;   // Simulation -> render thread
+    std::atomic<bool> running;
+    std::atomic<long long> busyNanoseconds; // Spent applying commands
+    std::thread thread;
+    float clock;      // Simulation side: last clock simulated up to
+    float requested;  // Render side: last clock sent
+};
+
+SimThread simThread;
+
+const float CHUNK_SIZE = 48.0f; // Edge of a streamed city chunk
+
+static long long chunkKey(int cx, int cz) {
+    return (static_cast<long long>(cx) << 32) | static_cast<unsigned int>(cz);
+}
+
+// Chunk containing a point; chunk (0, 0) is centered on the origin
+static int chunkCoord(float position) {
+    return static_cast<int>(floorf(position / CHUNK_SIZE + 0.5f));
+}
+
+// Scene size and tessellation knobs. Applied in order: preset (--preset),
+// config file (--config) and then one command-line flag per setting.
+struct SceneConfig {
+    int stars;
+    int spinners;          // Floating spinners besides the main vortex
+    float lotSize;         // Smaller lots pack more buildings into a chunk
+    float buildingDensity; // Fraction of lots with a building
+    int carsPerChunk;      // Cars on each chunk of the avenue
+    int chunkRadius;       // Chunks streamed around the camera in each direction
+    int chunkBudget;       // Resident chunks before LRU eviction
+    int spinnerSegments;
+    int tunnelSegments;
+    int tunnelRings;
+    float gridSize;
+    int gridDivisions;
+    int torusSides;
+    int torusRings;
+};
+
+struct ScenePreset {
+    const char* name;
+    SceneConfig config;
+};
+
+static const ScenePreset scenePresets[] = {
+    { "tiny",    { 50,      1,  12.0f, 0.30f, 1,     1, 16,  12, 12, 6,  100.0f, 10,  8,  16  } },
+    { "default", { 200,     3,  8.0f,  0.45f, 3,     3, 96,  24, 36, 15, 100.0f, 40,  16, 48  } },
+    { "city",    { 5000,    8,  6.0f,  0.70f, 40,    4, 128, 32, 48, 20, 200.0f, 80,  24, 64  } },
+    // About 10k buildings, 100k cars and 1M stars
+    { "stress",  { 1000000, 64, 4.0f,  0.90f, 11112, 4, 128, 64, 96, 40, 400.0f, 200, 48, 128 } }
+};
+
+SceneConfig scene = scenePresets[1].config;
+const char* scenePresetName = "default";
+
+struct SceneSetting {
+    const char* name;
+    int* intValue;
+    float* floatValue;
+};
+
+static const SceneSetting sceneSettings[] = {
+    { "stars",            &scene.stars,           NULL },
+    { "spinners",         &scene.spinners,        NULL },
+    { "lot-size",         NULL,                   &scene.lotSize },
+    { "building-density", NULL,                   &scene.buildingDensity },
+    { "cars-per-chunk",   &scene.carsPerChunk,    NULL },
+    { "chunk-radius",     &scene.chunkRadius,     NULL },
+    { "chunk-budget",     &scene.chunkBudget,     NULL },
+    { "spinner-segments", &scene.spinnerSegments, NULL },
+    { "tunnel-segments",  &scene.tunnelSegments,  NULL },
+    { "tunnel-rings",     &scene.tunnelRings,     NULL },
+    { "grid-size",        NULL,                   &scene.gridSize },
+    { "grid-divisions",   &scene.gridDivisions,   NULL },
+    { "torus-sides",      &scene.torusSides,      NULL },
+    { "torus-rings",      &scene.torusRings,      NULL }
+};
+const int SCENE_SETTING_COUNT = sizeof(sceneSettings) / sizeof(sceneSettings[0]);
+
+// One-shot sound effects, synthesized when the audio engine starts
+enum SoundEffect {
+    SOUND_BOOST,
+    SOUND_CRASH,
+    SOUND_COUNT
+};
+
+// Where the audio engine's mixed output goes (--audio-sink)
+enum AudioSinkType {
+    AUDIO_SINK_DEVICE,  // The sound card through WinMM; the null sink elsewhere
+    AUDIO_SINK_NULL,    // Discards blocks at the pace of a sound card
+    AUDIO_SINK_FILE     // 16-bit WAV, also paced
+};
 
 // FPS calculation
 int frameCount = 0;
@@ -131,67 +719,289 @@ float fps = 0.0f;
 float currentTime = 0.0f;
 float previousTime = 0.0f;
 
+// Headless benchmark (--bench): fixed clock, no window, stats printed as JSON
+bool benchMode = false;
+int benchFrames = 600;
+int benchWarmupFrames = 30;
+int benchWidth = SCR_WIDTH;
+int benchHeight = SCR_HEIGHT;
+const char* benchCapturePath = NULL; // Last frame written here as a PPM image
+bool benchCompareBloom = false;      // --bloom compare: glow passes, then bloom
+bool benchThreadSweep = false;       // --threads sweep: same frames on 1, 2, 4... threads
+bool benchDrive = false;             // --bench-drive: the chase camera follows the scripted lap, streaming chunks
+const char* trafficKernelName = "auto"; // --traffic-kernel auto|avx2|scalar
+int trafficBenchCars = 0;            // --traffic-bench N: time the traffic kernels on N cars, no GL
+const char* musicAnalysisPath = NULL; // --analyze file.wav: run the music analysis offline, no GL
+const char* musicPath = "retrowave_music.wav"; // --music file.wav
+AudioSinkType audioSinkType = AUDIO_SINK_DEVICE; // --audio-sink device|null|file.wav
+const char* audioSinkPath = NULL;
+bool audioSinkGiven = false;
+float audioBenchSeconds = 0.0f;      // --audio-bench [seconds]: run the audio engine headless, no GL
+bool qualityGiven = false;           // --quality; the bench otherwise holds the top level
+float benchClock = 0.0f;
+const float BENCH_FRAME_STEP = 1.0f / 60.0f;
+const unsigned long long BENCH_DEFAULT_SEED = 1;
+
+// Window size, kept for screen-space overlays
+int windowWidth = SCR_WIDTH;
+int windowHeight = SCR_HEIGHT;
+
+// View frustum planes (a, b, c, d) facing inwards, rebuilt after gluLookAt
+struct Frustum {
+    float planes[6][4];
+};
+
+Frustum viewFrustum;
+const float MAX_DRAW_DISTANCE = 400.0f; // Objects farther than this are skipped
+
+enum CullCategory {
+    CULL_CHUNKS,
+    CULL_BUILDINGS,
+    CULL_CARS,
+    CULL_SPINNERS,
+    CULL_CATEGORY_COUNT
+};
+
+const char* cullCategoryNames[CULL_CATEGORY_COUNT] = { "chunks", "buildings", "cars", "spinners" };
+
+// Per-frame counts of drawn and skipped objects
+struct CullStats {
+    int drawn[CULL_CATEGORY_COUNT];
+    int culled[CULL_CATEGORY_COUNT];
+};
+
+CullStats cullStats;
+
+// Hot-path profiler: scoped timers recorded per frame into a ring buffer
+enum ProfileZone {
+    ZONE_STREAMING,
+    ZONE_SIMULATION,
+    ZONE_GEOMETRY,
+    ZONE_SKY,
+    ZONE_PYRAMID,
+    ZONE_TORUS,
+    ZONE_SPINNERS,
+    ZONE_TUNNEL,
+    ZONE_GRID,
+    ZONE_BUILDINGS,
+    ZONE_CARS,
+    ZONE_BLOOM,
+    ZONE_SWAP,
+    ZONE_COUNT
+};
+
+const char* profileZoneNames[ZONE_COUNT] = {
+    "streaming", "simulation", "geometry", "sky", "pyramid", "torus", "spinners", "tunnel", "grid", "buildings", "cars", "bloom", "swap"
+};
+
+const float profileZoneColors[ZONE_COUNT][3] = {
+    {0.8f, 0.5f, 0.3f}, {0.6f, 0.6f, 0.6f}, {0.5f, 1.0f, 0.5f}, {0.3f, 0.3f, 1.0f}, {1.0f, 0.1f, 0.8f}, {1.0f, 0.8f, 0.0f},
+    {0.0f, 0.8f, 1.0f}, {0.6f, 0.0f, 1.0f}, {0.0f, 1.0f, 0.4f}, {1.0f, 0.4f, 0.2f}, {1.0f, 1.0f, 1.0f}, {1.0f, 0.6f, 0.8f},
+    {0.3f, 0.3f, 0.3f}
+};
+
+const int PROFILER_HISTORY = 240;   // Frames kept for the overlay and trace
+const int PROFILER_MAX_EVENTS = 256; // Scopes recorded per frame
+
+struct ProfileEvent {
+    int zone;
+    long long start;    // Nanoseconds since profiler start
+    long long duration;
+};
+
+struct ProfileFrame {
+    long long start;
+    long long duration;
+    float zoneMs[ZONE_COUNT];
+    ProfileEvent events[PROFILER_MAX_EVENTS];
+    int eventCount;
+    long long allocations;    // Heap allocations made while the frame ran
+    long long allocatedBytes;
+};
+
+struct Profiler {
+    ProfileFrame frames[PROFILER_HISTORY];
+    int current;          // Slot being recorded
+    long long frameCount; // Completed frames
+    bool syncGPU;         // glFinish at the end of every scope (benchmark mode)
+    bool showOverlay;
+    std::chrono::steady_clock::time_point epoch;
+    long long frameAllocations;    // heapAllocations when the frame began
+    long long frameBytes;
+};
+
+Profiler profiler;
+const char* traceOutputPath = NULL; // Chrome trace written when the benchmark ends
+
+static long long profilerNow() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - profiler.epoch).count();
+}
+
+// Adds a timed span to a zone of the current frame
+static void profilerRecord(int zone, long long start, long long duration) {
+    ProfileFrame& frame = profiler.frames[profiler.current];
+    frame.zoneMs[zone] += duration / 1.0e6f;
+    if (frame.eventCount < PROFILER_MAX_EVENTS) {
+        ProfileEvent& event = frame.events[frame.eventCount++];
+        event.zone = zone;
+        event.start = start;
+        event.duration = duration;
+    }
+}
+
+// Times the enclosing block and records it under a zone of the current frame
+class ProfileScope {
+private:
+    int zone;
+    long long start;
+
+public:
+    explicit ProfileScope(ProfileZone z) : zone(z), start(profilerNow()) {}
+
+    ~ProfileScope() {
+        if (profiler.syncGPU) glFinish();
+        profilerRecord(zone, start, profilerNow() - start);
+    }
+};
+
+// Per-frame clock snapshot, taken once and passed to every draw and update
+struct FrameContext {
+    float time;       // Seconds since startup
+    float deltaTime;  // Seconds since the previous snapshot
+    float colorPulse; // 0.7 + 0.3 * sin(2t), shared by all RetroColor calls
+};
+
+FrameContext makeFrameContext(float time, float previousTime) {
+    FrameContext frame;
+    frame.time = time;
+    frame.deltaTime = time - previousTime;
+    frame.colorPulse = 0.7f + 0.3f * sinf(time * 2.0f);
+    return frame;
+}
+
 // Function prototypes
 void init();
+void parseOptions(int argc, char** argv);
+bool applyScenePreset(const char* name);
+bool applySceneSetting(const char* name, const char* value);
+bool loadSceneConfig(const char* path);
+void clampSceneConfig();
+float getElapsedTime();
 void display();
+void renderFrame(const FrameContext& frame);
+void profilerBeginFrame();
+void profilerEndFrame();
+const ProfileFrame& profilerLastFrame();
+void drawProfilerOverlay();
+void drawOverdrawView();
+void updateViewFrustum();
+bool boxVisible(float cx, float cy, float cz, float ex, float ey, float ez, CullCategory category,
+                CullStats& stats = cullStats);
+bool sphereVisible(float cx, float cy, float cz, float radius, CullCategory category, CullStats& stats = cullStats);
+bool writeChromeTrace(const char* path);
+int runBenchmark();
 void reshape(int width, int height);
-void timer(int value);
+void idle();
+void advanceSimulation(const FrameContext& frame);
+void updateSimulation(SimState& state, const FrameContext& tick);
+void updateTraffic(Traffic& traffic, TrafficIndex& index, float deltaTime);
+void selectTrafficKernel(const char* name);
+int runTrafficBenchmark();
+bool startMusicAnalysis(const char* path);
+void stopMusicAnalysis();
+bool startAudio(const char* path, bool testTrack = false);
+void stopAudio();
+void toggleMusicPause();
+void adjustMusicVolume(float change);
+void playSound(SoundEffect sound, float gain);
+void updateSoundEffects(const PlayerCar& car, float time);
+double audioMusicSeconds();
+int runAudioBenchmark();
+void updateMusicLevels(const FrameContext& frame);
+int runMusicAnalysis(const char* path);
+void startSimulationThread(float clock);
+void stopSimulationThread();
 void keyboard(unsigned char key, int x, int y);
+void keyboardUp(unsigned char key, int x, int y);
 void specialKeys(int key, int x, int y);
-void drawBuilding(const Building& building);
-void drawGrid(float size, int divisions);
-void drawSpinners();
-void drawSpinner(const Spinner& spinner, float time);
-void drawTunnel(float radius, int segments, int rings);
-void drawCar(const Car& car);
-void drawSky();
-void calculateFPS();
+void specialKeysUp(int key, int x, int y);
+PlayerInput readPlayerInput(const FrameContext& frame);
+void updateChaseCamera(const FrameContext& frame);
+void drawPlayerCar(const FrameContext& frame);
+void drawRaceStats();
+void updateQualityGovernor();
+void drawQualityLabel();
+bool parseQualityMode(const char* mode);
+void toggleQualityGovernor();
+void logQualityLevel(const char* reason);
+void startChunkStreaming();
+void stopChunkStreaming();
+void startJobSystem(int threads);
+void stopJobSystem();
+void preloadChunks();
+float buildingLineX();
+void updateChunkStreaming();
+void drawBuildings(const FrameContext& frame);
+void drawGrid(float size, int divisions, const FrameContext& frame);
+void drawSpinners(const FrameContext& frame);
+void drawSpinner(const Spinner& spinner, const FrameContext& frame);
+void drawTunnel(float radius, int segments, int rings, const FrameContext& frame);
+void drawCars(const FrameContext& frame);
+void drawSky(const FrameContext& frame);
+bool loadGLExtensions();
+void initStarField();
+void initWindowRenderer();
+void initGridRenderer();
+void calculateFPS(const FrameContext& frame);
 void initAudio();
 void cleanup();
 // Added new function prototypes for the shapes
-void drawPyramid(float time);
-void drawTorus(float time);
+void drawPyramid(const FrameContext& frame);
+void drawTorus(const FrameContext& frame);
+void wireTorus(float innerRadius, float outerRadius, int sides, int rings);
+void solidTorus(float innerRadius, float outerRadius, int sides, int rings);
 
 // Retro wave color palette (use consistently throughout)
 struct RetroColor {
-    static void Pink(float time, float alpha = 1.0f) {
-        float pulse = 0.7f + 0.3f * sinf(time * 2.0f);
+    static void Pink(const FrameContext& frame, float alpha = 1.0f) {
+        float pulse = frame.colorPulse;
         glColor4f(1.0f * pulse, 0.1f * pulse, 0.8f * pulse, alpha);
     }
 
-    static void Cyan(float time, float alpha = 1.0f) {
-        float pulse = 0.7f + 0.3f * sinf(time * 2.0f);
+    static void Cyan(const FrameContext& frame, float alpha = 1.0f) {
+        float pulse = frame.colorPulse;
         glColor4f(0.0f, 0.8f * pulse, 1.0f * pulse, alpha);
     }
 
-    static void Gold(float time, float alpha = 1.0f) {
-        float pulse = 0.7f + 0.3f * sinf(time * 2.0f);
+    static void Gold(const FrameContext& frame, float alpha = 1.0f) {
+        float pulse = frame.colorPulse;
         glColor4f(1.0f * pulse, 0.8f * pulse, 0.0f, alpha);
     }
 
-    static void Purple(float time, float alpha = 1.0f) {
-        float pulse = 0.7f + 0.3f * sinf(time * 2.0f);
+    static void Purple(const FrameContext& frame, float alpha = 1.0f) {
+        float pulse = frame.colorPulse;
         glColor4f(0.6f * pulse, 0.0f, 1.0f * pulse, alpha);
     }
 
-    static void getPinkMaterial(float time, float alpha, GLfloat* color) {
-        float pulse = 0.7f + 0.3f * sinf(time * 2.0f);
+    static void getPinkMaterial(const FrameContext& frame, float alpha, GLfloat* color) {
+        float pulse = frame.colorPulse;
         color[0] = 1.0f * pulse;
         color[1] = 0.1f * pulse;
         color[2] = 0.8f * pulse;
         color[3] = alpha;
     }
 
-    static void getCyanMaterial(float time, float alpha, GLfloat* color) {
-        float pulse = 0.7f + 0.3f * sinf(time * 2.0f);
+    static void getCyanMaterial(const FrameContext& frame, float alpha, GLfloat* color) {
+        float pulse = frame.colorPulse;
         color[0] = 0.0f;
         color[1] = 0.8f * pulse;
         color[2] = 1.0f * pulse;
         color[3] = alpha;
     }
 
-    static void getGoldMaterial(float time, float alpha, GLfloat* color) {
-        float pulse = 0.7f + 0.3f * sinf(time * 2.0f);
+    static void getGoldMaterial(const FrameContext& frame, float alpha, GLfloat* color) {
+        float pulse = frame.colorPulse;
         color[0] = 1.0f * pulse;
         color[1] = 0.8f * pulse;
         color[2] = 0.0f;
@@ -199,1243 +1009,6591 @@ struct RetroColor {
     }
 };
 
-int main(int argc, char** argv) {
-    // Initialize GLUT
-    glutInit(&argc, argv);
-    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH);
-    glutInitWindowSize(SCR_WIDTH, SCR_HEIGHT);
-    glutCreateWindow("Retrowave City");
-
-    // Register callbacks
-    glutDisplayFunc(display);
-    glutReshapeFunc(reshape);
-    glutKeyboardFunc(keyboard);
-    glutSpecialFunc(specialKeys);
-    glutTimerFunc(16, timer, 0); // ~60 FPS
-
-    // Initialize OpenGL
-    init();
+// OpenGL 2.0 entry points (opengl32 only exports 1.1, the rest is loaded at runtime)
+#define RETRO_GL_FUNCTIONS(X) \
+    X(PFNGLGENBUFFERSPROC, glGenBuffers) \
+    X(PFNGLBINDBUFFERPROC, glBindBuffer) \
+    X(PFNGLBUFFERDATAPROC, glBufferData) \
+    X(PFNGLDELETEBUFFERSPROC, glDeleteBuffers) \
+    X(PFNGLCREATESHADERPROC, glCreateShader) \
+    X(PFNGLDELETESHADERPROC, glDeleteShader) \
+    X(PFNGLSHADERSOURCEPROC, glShaderSource) \
+    X(PFNGLCOMPILESHADERPROC, glCompileShader) \
+    X(PFNGLGETSHADERIVPROC, glGetShaderiv) \
+    X(PFNGLGETSHADERINFOLOGPROC, glGetShaderInfoLog) \
+    X(PFNGLCREATEPROGRAMPROC, glCreateProgram) \
+    X(PFNGLATTACHSHADERPROC, glAttachShader) \
+    X(PFNGLLINKPROGRAMPROC, glLinkProgram) \
+    X(PFNGLGETPROGRAMIVPROC, glGetProgramiv) \
+    X(PFNGLGETPROGRAMINFOLOGPROC, glGetProgramInfoLog) \
+    X(PFNGLUSEPROGRAMPROC, glUseProgram) \
+    X(PFNGLGETUNIFORMLOCATIONPROC, glGetUniformLocation) \
+    X(PFNGLUNIFORM1FPROC, glUniform1f) \
+    X(PFNGLGETATTRIBLOCATIONPROC, glGetAttribLocation) \
+    X(PFNGLVERTEXATTRIBPOINTERPROC, glVertexAttribPointer) \
+    X(PFNGLENABLEVERTEXATTRIBARRAYPROC, glEnableVertexAttribArray) \
+    X(PFNGLDISABLEVERTEXATTRIBARRAYPROC, glDisableVertexAttribArray) \
+    X(PFNGLUNIFORM1IPROC, glUniform1i) \
+    X(PFNGLUNIFORM2FPROC, glUniform2f) \
+    X(PFNGLACTIVETEXTUREPROC, glActiveTexture)
+
+// Framebuffer objects (GL 3.0 / ARB_framebuffer_object), only needed for bloom
+#define RETRO_GL_FRAMEBUFFER_FUNCTIONS(X) \
+    X(PFNGLGENFRAMEBUFFERSPROC, glGenFramebuffers) \
+    X(PFNGLDELETEFRAMEBUFFERSPROC, glDeleteFramebuffers) \
+    X(PFNGLBINDFRAMEBUFFERPROC, glBindFramebuffer) \
+    X(PFNGLFRAMEBUFFERTEXTURE2DPROC, glFramebufferTexture2D) \
+    X(PFNGLCHECKFRAMEBUFFERSTATUSPROC, glCheckFramebufferStatus) \
+    X(PFNGLGENRENDERBUFFERSPROC, glGenRenderbuffers) \
+    X(PFNGLDELETERENDERBUFFERSPROC, glDeleteRenderbuffers) \
+    X(PFNGLBINDRENDERBUFFERPROC, glBindRenderbuffer) \
+    X(PFNGLRENDERBUFFERSTORAGEPROC, glRenderbufferStorage) \
+    X(PFNGLFRAMEBUFFERRENDERBUFFERPROC, glFramebufferRenderbuffer)
+
+#define RETRO_DECLARE_GL_FUNCTION(type, name) type p##name = NULL;
+RETRO_GL_FUNCTIONS(RETRO_DECLARE_GL_FUNCTION)
+RETRO_GL_FRAMEBUFFER_FUNCTIONS(RETRO_DECLARE_GL_FUNCTION)
+#undef RETRO_DECLARE_GL_FUNCTION
+
+bool hasShaders = false;
+bool hasFramebuffers = false;
+
+static void (*getGLProcAddress(const char* name))() {
+#ifdef _WIN32
+    return reinterpret_cast<void (*)()>(wglGetProcAddress(name));
+#else
+    return eglGetProcAddress(name);
+#endif
+}
 
-    // Initialize audio (play the background music)
-    initAudio();
+bool loadGLExtensions() {
+    bool ok = true;
+#define RETRO_LOAD_GL_FUNCTION(type, name) \
+    p##name = reinterpret_cast<type>(getGLProcAddress(#name)); \
+    if (p##name == NULL) ok = false;
+    RETRO_GL_FUNCTIONS(RETRO_LOAD_GL_FUNCTION)
+    hasShaders = ok;
+    if (!ok) {
+        std::cerr << "Warning: OpenGL 2.0 not available, using fixed-function fallbacks." << std::endl;
+    }
 
-    // Register cleanup function
-    atexit(cleanup);
+    bool shadersOk = ok;
+    ok = true;
+    RETRO_GL_FRAMEBUFFER_FUNCTIONS(RETRO_LOAD_GL_FUNCTION)
+#undef RETRO_LOAD_GL_FUNCTION
+    hasFramebuffers = ok && shadersOk;
+    return shadersOk;
+}
 
-    // Start main loop
-    glutMainLoop();
+static GLuint compileShader(GLenum type, const char* source) {
+    GLuint shader = pglCreateShader(type);
+    pglShaderSource(shader, 1, &source, NULL);
+    pglCompileShader(shader);
+
+    GLint status = GL_FALSE;
+    pglGetShaderiv(shader, GL_COMPILE_STATUS, &status);
+    if (status != GL_TRUE) {
+        char log[1024];
+        pglGetShaderInfoLog(shader, sizeof(log), NULL, log);
+        std::cerr << "Shader compile error: " << log << std::endl;
+        pglDeleteShader(shader);
+        return 0;
+    }
+    return shader;
+}
 
-    return 0;
+// Returns 0 on failure so callers can fall back to the fixed-function path
+GLuint createShaderProgram(const char* vertexSource, const char* fragmentSource) {
+    if (!hasShaders) return 0;
+
+    GLuint vs = compileShader(GL_VERTEX_SHADER, vertexSource);
+    GLuint fs = compileShader(GL_FRAGMENT_SHADER, fragmentSource);
+    if (vs == 0 || fs == 0) return 0;
+
+    GLuint program = pglCreateProgram();
+    pglAttachShader(program, vs);
+    pglAttachShader(program, fs);
+    pglLinkProgram(program);
+    pglDeleteShader(vs);
+    pglDeleteShader(fs);
+
+    GLint status = GL_FALSE;
+    pglGetProgramiv(program, GL_LINK_STATUS, &status);
+    if (status != GL_TRUE) {
+        char log[1024];
+        pglGetProgramInfoLog(program, sizeof(log), NULL, log);
+        std::cerr << "Shader link error: " << log << std::endl;
+        return 0;
+    }
+    return program;
 }
 
-void init() {
-    // Set background color (deep purple)
-    glClearColor(0.05f, 0.0f, 0.1f, 1.0f);
+// Overdraw debug view (O key, --overdraw): every rasterized fragment
+// increments the stencil, including those that fail the depth test. The
+// stencil is read back at each profiler zone boundary of the render queue
+// to charge fragments to zones, and the final counts become a heatmap.
+struct OverdrawStats {
+    long long fragments[ZONE_COUNT];
+    long long total;
+    int coveredPixels;  // Pixels touched at least once
+    int maxDepth;       // Most fragments on one pixel (saturates at 255)
+};
 
-    // Enable depth testing and lighting
-    glEnable(GL_DEPTH_TEST);
-    glEnable(GL_LIGHTING);
-    glEnable(GL_LIGHT0);
+struct OverdrawView {
+    bool enabled;
+    std::vector<unsigned char> stencil;
+    std::vector<unsigned char> heatmap; // RGB, bottom row first
+    long long lastSum;
+    OverdrawStats stats;
+};
 
-    // Setup light
-    GLfloat ambientLight[] = { 0.1f, 0.1f, 0.2f, 1.0f };
-    GLfloat diffuseLight[] = { 0.8f, 0.8f, 1.0f, 1.0f };
-    GLfloat position[] = { -10.0f, 20.0f, 10.0f, 1.0f };
+OverdrawView overdraw;
 
-    glLightfv(GL_LIGHT0, GL_AMBIENT, ambientLight);
-    glLightfv(GL_LIGHT0, GL_DIFFUSE, diffuseLight);
-    glLightfv(GL_LIGHT0, GL_POSITION, position);
+void beginOverdrawFrame() {
+    if (!overdraw.enabled) return;
+    memset(&overdraw.stats, 0, sizeof(overdraw.stats));
+    overdraw.lastSum = 0;
 
-    // Enable color material
-    glEnable(GL_COLOR_MATERIAL);
-    glColorMaterial(GL_FRONT, GL_AMBIENT_AND_DIFFUSE);
+    glClearStencil(0);
+    glClear(GL_STENCIL_BUFFER_BIT);
+    glEnable(GL_STENCIL_TEST);
+    glStencilFunc(GL_ALWAYS, 0, 0xFF);
+    glStencilOp(GL_INCR, GL_INCR, GL_INCR);
+}
 
-    // Create buildings
-    srand(static_cast<unsigned int>(time(NULL)));
-    for (int i = 0; i < 10; i++) {
-        Building b;
-        b.x = -20.0f + i * 4.0f;
-        b.z = -10.0f - i * 3.0f;
-        b.width = 3.0f + static_cast<float>(rand()) / RAND_MAX * 5.0f;
-        b.height = 10.0f + static_cast<float>(rand()) / RAND_MAX * 20.0f;
-        b.depth = 3.0f + static_cast<float>(rand()) / RAND_MAX * 5.0f;
-        buildings.push_back(b);
-
-        // Mirror buildings on the right side
-        Building b2;
-        b2.x = 20.0f - i * 4.0f;
-        b2.z = -10.0f - i * 3.0f;
-        b2.width = 3.0f + static_cast<float>(rand()) / RAND_MAX * 5.0f;
-        b2.height = 10.0f + static_cast<float>(rand()) / RAND_MAX * 20.0f;
-        b2.depth = 3.0f + static_cast<float>(rand()) / RAND_MAX * 5.0f;
-        buildings.push_back(b2);
-    }
+// Charges the fragments drawn since the last boundary to a zone
+void overdrawZoneEnd(int zone) {
+    if (!overdraw.enabled) return;
+    overdraw.stencil.resize(static_cast<size_t>(windowWidth) * windowHeight);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, windowWidth, windowHeight, GL_STENCIL_INDEX, GL_UNSIGNED_BYTE, &overdraw.stencil[0]);
+
+    long long sum = 0;
+    for (size_t i = 0; i < overdraw.stencil.size(); i++) sum += overdraw.stencil[i];
+    overdraw.stats.fragments[zone] += sum - overdraw.lastSum;
+    overdraw.lastSum = sum;
+}
 
-    // Initialize stars
-    for (int i = 0; i < 200; i++) {
-        Star s;
-        s.x = -150.0f + static_cast<float>(rand()) / RAND_MAX * 300.0f;
-        s.y = 20.0f + static_cast<float>(rand()) / RAND_MAX * 80.0f;
-        s.z = -150.0f + static_cast<float>(rand()) / RAND_MAX * 100.0f;
-        s.brightness = 0.5f + static_cast<float>(rand()) / RAND_MAX * 0.5f;
-        s.size = 1.0f + static_cast<float>(rand()) / RAND_MAX * 2.0f;
-        s.colorType = rand() % 10; // Different star colors
-        stars.push_back(s);
+// Dark blue (1) through green and yellow to red (16) and white (32+)
+static void heatmapColor(int count, unsigned char* rgb) {
+    static const float stops[][4] = {
+        { 0.0f, 0.0f, 0.0f, 0.0f }, { 1.0f, 0.0f, 0.0f, 0.6f }, { 2.0f, 0.0f, 0.6f, 1.0f },
+        { 4.0f, 0.0f, 1.0f, 0.2f }, { 8.0f, 1.0f, 0.9f, 0.0f }, { 16.0f, 1.0f, 0.1f, 0.0f },
+        { 32.0f, 1.0f, 1.0f, 1.0f }
+    };
+    const int stopCount = sizeof(stops) / sizeof(stops[0]);
+    float c = static_cast<float>(count);
+    int s = 0;
+    while (s + 2 < stopCount && c > stops[s + 1][0]) s++;
+    float t = std::min(1.0f, std::max(0.0f, (c - stops[s][0]) / (stops[s + 1][0] - stops[s][0])));
+    for (int k = 0; k < 3; k++) {
+        rgb[k] = static_cast<unsigned char>(255.0f * (stops[s][k + 1] + (stops[s + 1][k + 1] - stops[s][k + 1]) * t));
     }
+}
 
-    // Initialize spinners
-    // Main spinner (vortex tunnel in the sky)
-    Spinner mainVortex;
-    mainVortex.x = 0.0f;
-    mainVortex.y = 30.0f;
-    mainVortex.z = -80.0f;
-    mainVortex.radius = 25.0f;
-    mainVortex.rotation = 0.0f;
-    mainVortex.rotationSpeed = 30.0f;
-    mainVortex.type = 1; // spiral
-    mainVortex.isPink = true;
-    spinners.push_back(mainVortex);
-
-    // Additional floating spinners
-    for (int i = 0; i < 3; i++) {
-        Spinner s;
-        s.x = -40.0f + static_cast<float>(rand()) / RAND_MAX * 80.0f;
-        s.y = 15.0f + static_cast<float>(rand()) / RAND_MAX * 20.0f;
-        s.z = -100.0f + static_cast<float>(rand()) / RAND_MAX * 40.0f;
-        s.radius = 3.0f + static_cast<float>(rand()) / RAND_MAX * 5.0f;
-        s.rotation = 0.0f;
-        s.rotationSpeed = 10.0f + static_cast<float>(rand()) / RAND_MAX * 30.0f;
-        s.type = rand() % 2;
-        s.isPink = (rand() % 2 == 0);
-        spinners.push_back(s);
+// Stops counting and turns the last readback into coverage stats and the heatmap
+void endOverdrawFrame() {
+    if (!overdraw.enabled) return;
+    glDisable(GL_STENCIL_TEST);
+
+    OverdrawStats& stats = overdraw.stats;
+    stats.total = overdraw.lastSum;
+    overdraw.heatmap.resize(overdraw.stencil.size() * 3);
+    for (size_t i = 0; i < overdraw.stencil.size(); i++) {
+        int count = overdraw.stencil[i];
+        if (count > 0) stats.coveredPixels++;
+        stats.maxDepth = std::max(stats.maxDepth, count);
+        heatmapColor(count, &overdraw.heatmap[i * 3]);
     }
+}
 
-    // Create cars
-    for (int i = 0; i < 5; i++) {
-        Car car;
-        car.x = -8.0f + static_cast<float>(rand()) / RAND_MAX * 16.0f;
-        car.z = -50.0f + static_cast<float>(rand()) / RAND_MAX * 60.0f;
-        car.isBlue = (rand() % 2 == 0);
-        car.speed = 15.0f + static_cast<float>(rand()) / RAND_MAX * 10.0f;
-        cars.push_back(car);
+void printOverdrawStats(FILE* out) {
+    const OverdrawStats& stats = overdraw.stats;
+    int pixels = windowWidth * windowHeight;
+    fprintf(out, "Overdraw: %lld fragments, %.2f per pixel, %.2f per covered pixel, max %d\n",
+            stats.total, static_cast<double>(stats.total) / pixels,
+            stats.coveredPixels > 0 ? static_cast<double>(stats.total) / stats.coveredPixels : 0.0, stats.maxDepth);
+    for (int z = 0; z < ZONE_COUNT; z++) {
+        if (stats.fragments[z] == 0) continue;
+        fprintf(out, "  %-10s %10lld fragments %5.1f%%  %.2f per pixel\n", profileZoneNames[z], stats.fragments[z],
+                stats.total > 0 ? 100.0 * stats.fragments[z] / stats.total : 0.0,
+                static_cast<double>(stats.fragments[z]) / pixels);
     }
+}
 
-    // Initialize time
-    previousTime = glutGet(GLUT_ELAPSED_TIME) / 1000.0f;
+// Per-frame bump allocator for transient data: render commands, the job
+// list and the vertex arrays the jobs build. Everything is released at once
+// when the next frame begins. Jobs allocate from it concurrently with an
+// atomic bump. What does not fit comes from the heap for that frame, and the
+// block grows to the frame's total before the next, so a steady scene stops
+// allocating after its first frames.
+struct FrameArena {
+    char* block;
+    size_t capacity;
+    std::atomic<size_t> used;   // May run past capacity; the excess is on the heap
+    std::mutex overflowMutex;
+    std::vector<void*> overflow;
+    unsigned generation;        // Bumped by every reset
+    size_t peak;                // Most bytes one frame used
+};
 
-    // Better graphics quality
-    glEnable(GL_POINT_SMOOTH);
-    glEnable(GL_LINE_SMOOTH);
-    glShadeModel(GL_SMOOTH);
-}
+FrameArena frameArena;
+const size_t FRAME_ARENA_INITIAL = 1 << 20;
 
-void initAudio() {
-    // PLACE YOUR MP3 FILE IN THE SAME FOLDER AS YOUR EXE FILE
-    std::string musicFile = "retrowave_music.mp3";
+static void* frameAllocate(size_t bytes) {
+    bytes = (bytes + 15) & ~static_cast<size_t>(15);
+    size_t offset = frameArena.used.fetch_add(bytes, std::memory_order_relaxed);
+    if (offset + bytes <= frameArena.capacity) return frameArena.block + offset;
+
+    void* p = operator new(bytes);
+    std::lock_guard<std::mutex> lock(frameArena.overflowMutex);
+    frameArena.overflow.push_back(p);
+    return p;
+}
 
-    if (!audioPlayer.playMusic(musicFile)) {
-        std::cerr << "Warning: Failed to play background music." << std::endl;
+// Start of a frame; nothing from the last one may be used after this
+void resetFrameArena() {
+    FrameArena& arena = frameArena;
+    size_t used = arena.used.load();
+    for (size_t i = 0; i < arena.overflow.size(); i++) operator delete(arena.overflow[i]);
+    arena.overflow.clear();
+    if (used > arena.capacity || arena.block == NULL) {
+        delete[] arena.block;
+        arena.capacity = std::max(FRAME_ARENA_INITIAL, used + used / 2);
+        arena.block = new char[arena.capacity];
     }
+    arena.peak = std::max(arena.peak, used);
+    arena.used = 0;
+    arena.generation++;
+}
+
+// Growable array in the frame arena for trivially copyable items. Its
+// contents last until the next frame begins and read as empty after that,
+// so a vector refilled every frame simply starts with clear().
+template <typename T>
+class FrameVector {
+private:
+    T* items;
+    size_t count;
+    size_t capacity;
+    unsigned generation; // Frame the items were allocated in
+
+public:
+    FrameVector() : items(NULL), count(0), capacity(0), generation(0) {}
+
+    void clear() {
+        items = NULL;
+        count = 0;
+        capacity = 0;
+        generation = frameArena.generation;
+    }
+
+    void reserve(size_t n) {
+        if (generation != frameArena.generation) clear();
+        if (n <= capacity) return;
+        T* grown = static_cast<T*>(frameAllocate(n * sizeof(T)));
+        if (count > 0) memcpy(static_cast<void*>(grown), items, count * sizeof(T));
+        items = grown;
+        capacity = n;
+    }
+
+    void push_back(const T& item) {
+        if (count == capacity || generation != frameArena.generation) {
+            reserve(std::max<size_t>(16, capacity * 2));
+        }
+        items[count++] = item;
+    }
+
+    // New items are value-initialized
+    void resize(size_t n) {
+        reserve(n);
+        for (size_t i = count; i < n; i++) new (&items[i]) T();
+        count = n;
+    }
+
+    size_t size() const { return generation == frameArena.generation ? count : 0; }
+    bool empty() const { return size() == 0; }
+    T& operator[](size_t i) { return items[i]; }
+    const T& operator[](size_t i) const { return items[i]; }
+    T* begin() { return items; }
+    T* end() { return items + size(); }
+};
+
+// Work-stealing job system for the per-frame CPU work. Draw functions queue
+// jobs that build vertex data and cull; all of them run just before the
+// render queue is submitted. Every thread owns a slice of the frame's job
+// list, works from its back and steals from the front of the others'; the
+// render thread works too.
+// A job writes only to its own object, so the output is the same for any
+// thread count, and the render thread draws the objects in queue order.
+struct JobThread;
+typedef void (*JobFunction)(const FrameContext& frame, void* object, JobThread& thread);
+
+struct Job {
+    JobFunction run;
+    void* object;
+};
+
+struct JobThread {
+    std::mutex mutex;
+    size_t front, back;   // Its slice of JobSystem::queued still to run
+    CullStats cull;   // Merged into cullStats after each batch
+    int executed;     // Jobs run this batch
+    int stolen;       // ... of which taken from another thread
+};
+
+struct JobSystem {
+    int threadCount;                  // Including the render thread, which is threads[0]
+    std::vector<JobThread*> threads;
+    std::vector<std::thread> workers;
+    FrameVector<Job> queued;          // This frame's jobs, in queue order
+    const FrameContext* frame;
+    std::atomic<int> unfinished;
+    std::atomic<bool> running;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    unsigned batch;                   // Bumped for every batch, guarded by wakeMutex
+};
+
+JobSystem jobSystem;
+int jobThreadCount = 0; // --threads, 0 for one per hardware thread
+
+static bool takeJob(int self, Job& job) {
+    // Own jobs newest first, then the oldest of the next thread that has any
+    for (int i = 0; i < jobSystem.threadCount; i++) {
+        JobThread& thread = *jobSystem.threads[(self + i) % jobSystem.threadCount];
+        std::lock_guard<std::mutex> lock(thread.mutex);
+        if (thread.front == thread.back) continue;
+        if (i == 0) {
+            job = jobSystem.queued[--thread.back];
+        } else {
+            job = jobSystem.queued[thread.front++];
+            jobSystem.threads[self]->stolen++;
+        }
+        return true;
+    }
+    return false;
+}
+
+static bool runOneJob(int self) {
+    Job job;
+    if (!takeJob(self, job)) return false;
+    JobThread& thread = *jobSystem.threads[self];
+    job.run(*jobSystem.frame, job.object, thread);
+    thread.executed++;
+    jobSystem.unfinished.fetch_sub(1, std::memory_order_acq_rel);
+    return true;
+}
+
+static void jobWorkerMain(int self) {
+    unsigned seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(jobSystem.wakeMutex);
+            while (jobSystem.running.load() && jobSystem.batch == seen) {
+                jobSystem.wake.wait(lock);
+            }
+            if (!jobSystem.running.load()) return;
+            seen = jobSystem.batch;
+        }
+        while (runOneJob(self)) {}
+    }
+}
+
+void startJobSystem(int threads) {
+    if (threads <= 0) threads = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    jobSystem.threadCount = threads;
+    jobSystem.batch = 0;
+    jobSystem.running = true;
+    for (int t = 0; t < threads; t++) {
+        JobThread* thread = new JobThread();
+        thread->front = thread->back = 0;
+        memset(&thread->cull, 0, sizeof(thread->cull));
+        thread->executed = 0;
+        thread->stolen = 0;
+        jobSystem.threads.push_back(thread);
+    }
+    for (int t = 1; t < threads; t++) {
+        jobSystem.workers.push_back(std::thread(jobWorkerMain, t));
+    }
+}
+
+void stopJobSystem() {
+    if (!jobSystem.running.load()) return;
+    {
+        std::lock_guard<std::mutex> lock(jobSystem.wakeMutex);
+        jobSystem.running = false;
+    }
+    jobSystem.wake.notify_all();
+    for (size_t i = 0; i < jobSystem.workers.size(); i++) {
+        jobSystem.workers[i].join();
+    }
+    jobSystem.workers.clear();
+    for (size_t i = 0; i < jobSystem.threads.size(); i++) {
+        delete jobSystem.threads[i];
+    }
+    jobSystem.threads.clear();
+    jobSystem.queued.clear();
+}
+
+void queueJob(JobFunction run, void* object) {
+    Job job = { run, object };
+    jobSystem.queued.push_back(job);
+}
+
+// Runs the jobs queued this frame and waits for them. Each thread starts with
+// a contiguous slice, so neighbouring objects tend to stay on one core.
+void runQueuedJobs(const FrameContext& frame) {
+    ProfileScope profile(ZONE_GEOMETRY);
+    FrameVector<Job>& queued = jobSystem.queued;
+    int threads = jobSystem.threadCount;
+    jobSystem.frame = &frame;
+    for (int t = 0; t < threads; t++) {
+        JobThread& thread = *jobSystem.threads[t];
+        memset(&thread.cull, 0, sizeof(thread.cull));
+        thread.executed = 0;
+        thread.stolen = 0;
+    }
+
+    if (threads == 1) {
+        for (size_t i = 0; i < queued.size(); i++) {
+            queued[i].run(frame, queued[i].object, *jobSystem.threads[0]);
+        }
+        jobSystem.threads[0]->executed = static_cast<int>(queued.size());
+    } else if (!queued.empty()) {
+        jobSystem.unfinished.store(static_cast<int>(queued.size()));
+        for (int t = 0; t < threads; t++) {
+            JobThread& thread = *jobSystem.threads[t];
+            std::lock_guard<std::mutex> lock(thread.mutex);
+            thread.front = queued.size() * t / threads;
+            thread.back = queued.size() * (t + 1) / threads;
+        }
+        {
+            std::lock_guard<std::mutex> lock(jobSystem.wakeMutex);
+            jobSystem.batch++;
+        }
+        jobSystem.wake.notify_all();
+
+        while (jobSystem.unfinished.load(std::memory_order_acquire) > 0) {
+            if (!runOneJob(0)) std::this_thread::yield();
+        }
+    }
+    queued.clear();
+
+    for (int t = 0; t < threads; t++) {
+        const CullStats& cull = jobSystem.threads[t]->cull;
+        for (int c = 0; c < CULL_CATEGORY_COUNT; c++) {
+            cullStats.drawn[c] += cull.drawn[c];
+            cullStats.culled[c] += cull.culled[c];
+        }
+    }
+}
+
+// Interleaved position and color for the vertex arrays built by jobs
+struct ColorVertex {
+    GLfloat x, y, z;
+    GLubyte r, g, b, a;
+};
+
+static void toColorBytes(const GLfloat* color, GLubyte* out) {
+    for (int k = 0; k < 4; k++) {
+        out[k] = static_cast<GLubyte>(std::min(1.0f, std::max(0.0f, color[k])) * 255.0f + 0.5f);
+    }
+}
+
+static void pushColorVertex(FrameVector<ColorVertex>& v, const GLubyte* color, float x, float y, float z) {
+    ColorVertex vertex = { x, y, z, color[0], color[1], color[2], color[3] };
+    v.push_back(vertex);
+}
+
+static void drawColorVertices(const FrameVector<ColorVertex>& v, GLenum mode) {
+    if (v.empty()) return;
+    glVertexPointer(3, GL_FLOAT, sizeof(ColorVertex), &v[0].x);
+    glColorPointer(4, GL_UNSIGNED_BYTE, sizeof(ColorVertex), &v[0].r);
+    glDrawArrays(mode, 0, static_cast<GLsizei>(v.size()));
+}
+
+// Per-frame render queue. Draw functions emit commands whose sort key packs
+// the GL state they need; the queue sorts them once and only touches state
+// that differs from the previous command. Callbacks issue geometry, colors
+// and uniforms but never blend, lighting, line width, point size or program.
+enum RenderPass {
+    PASS_SKY,
+    PASS_NEON,  // Unlit additive lines, points and quads
+    PASS_LIT    // Translucent lit solids, after the neon they show through
+};
+
+enum RenderBlend {
+    BLEND_NONE,
+    BLEND_ADDITIVE  // GL_SRC_ALPHA, GL_ONE
+};
+
+enum RenderPrimitive {
+    PRIM_POINTS,
+    PRIM_LINES,
+    PRIM_FACES
+};
+
+enum RenderMaterial {
+    MATERIAL_FIXED,
+    MATERIAL_STAR_SHADER,
+    MATERIAL_WINDOW_SHADER,
+    MATERIAL_GRID_SHADER,
+    MATERIAL_COUNT
+};
+
+struct RenderState {
+    RenderPass pass;
+    RenderBlend blend;
+    bool lighting;
+    RenderPrimitive primitive;
+    float lineWidth;  // Lines only
+    float pointSize;  // Points only; 0 when the callback sets sizes itself
+    RenderMaterial material;
+};
+
+typedef void (*RenderCallback)(const FrameContext& frame, const void* object, int part);
+
+struct RenderCommand {
+    unsigned long long key;  // pass | blend | lighting | primitive | line width | point size | material | sequence
+    RenderCallback draw;
+    const void* object;
+    int part;
+    int zone;                // Profiler zone the GL time is charged to
+};
+
+struct RenderQueueStats {
+    int commands;
+    int stateChanges;       // GL state calls issued
+    int stateChangesSaved;  // Requested by commands but already in place
+};
+
+struct RenderQueue {
+    FrameVector<RenderCommand> commands;
+    unsigned int sequence;
+    RenderQueueStats stats;
+    GLuint programs[MATERIAL_COUNT]; // Filled in as the shaders are built
+};
+
+RenderQueue renderQueue = { FrameVector<RenderCommand>(), 0, { 0, 0, 0 }, { 0, 0, 0 } };
+
+static RenderState neonState(RenderPrimitive primitive, float lineWidth = 0.0f, float pointSize = 0.0f) {
+    RenderState state = { PASS_NEON, BLEND_ADDITIVE, false, primitive, lineWidth, pointSize, MATERIAL_FIXED };
+    return state;
+}
+
+static unsigned long long packRenderKey(const RenderState& state, unsigned int sequence) {
+    unsigned long long lineWidth = static_cast<unsigned long long>(std::min(63.0f, state.lineWidth * 4.0f));
+    unsigned long long pointSize = static_cast<unsigned long long>(std::min(255.0f, state.pointSize * 4.0f));
+    return (static_cast<unsigned long long>(state.pass) << 60) |
+           (static_cast<unsigned long long>(state.blend) << 58) |
+           (static_cast<unsigned long long>(state.lighting ? 1 : 0) << 57) |
+           (static_cast<unsigned long long>(state.primitive) << 54) |
+           (lineWidth << 48) |
+           (pointSize << 40) |
+           (static_cast<unsigned long long>(state.material) << 32) |
+           sequence;
+}
+
+void queueDraw(const RenderState& state, ProfileZone zone, RenderCallback draw, const void* object = NULL, int part = 0) {
+    RenderCommand command = { packRenderKey(state, renderQueue.sequence++), draw, object, part, zone };
+    renderQueue.commands.push_back(command);
+}
+
+static bool commandKeyLess(const RenderCommand& a, const RenderCommand& b) {
+    return a.key < b.key;
+}
+
+// GL state as last applied; -1 forces the next command to set it
+struct AppliedRenderState {
+    int blend;
+    int lighting;
+    float lineWidth;
+    float pointSize;
+    int material;
+};
+
+static void applyRenderState(unsigned long long key, AppliedRenderState& applied, RenderQueueStats& stats) {
+    int blend = static_cast<int>((key >> 58) & 0x3);
+    int lighting = static_cast<int>((key >> 57) & 0x1);
+    float lineWidth = ((key >> 48) & 0x3F) / 4.0f;
+    float pointSize = ((key >> 40) & 0xFF) / 4.0f;
+    int material = static_cast<int>((key >> 32) & 0xFF);
+
+    int requested = 2;
+    if (blend != applied.blend) {
+        if (blend == BLEND_ADDITIVE) {
+            glEnable(GL_BLEND);
+            glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+        } else {
+            glDisable(GL_BLEND);
+        }
+        applied.blend = blend;
+        stats.stateChanges++;
+    }
+    if (lighting != applied.lighting) {
+        if (lighting) glEnable(GL_LIGHTING);
+        else glDisable(GL_LIGHTING);
+        applied.lighting = lighting;
+        stats.stateChanges++;
+    }
+    if (lineWidth > 0.0f) {
+        requested++;
+        if (lineWidth != applied.lineWidth) {
+            glLineWidth(lineWidth);
+            applied.lineWidth = lineWidth;
+            stats.stateChanges++;
+        }
+    }
+    if (pointSize > 0.0f) {
+        requested++;
+        if (pointSize != applied.pointSize) {
+            glPointSize(pointSize);
+            applied.pointSize = pointSize;
+            stats.stateChanges++;
+        }
+    }
+    if (hasShaders) {
+        requested++;
+        if (material != applied.material) {
+            pglUseProgram(renderQueue.programs[material]);
+            applied.material = material;
+            stats.stateChanges++;
+        }
+    }
+    stats.stateChangesSaved += requested;
+}
+
+void beginRenderQueue() {
+    renderQueue.commands.clear();
+    renderQueue.sequence = 0;
+}
+
+// Sorts and draws everything queued this frame, then restores the default
+// state (blend off, lighting on, unit line width and point size, no program)
+void submitRenderQueue(const FrameContext& frame) {
+    FrameVector<RenderCommand>& commands = renderQueue.commands;
+    std::sort(commands.begin(), commands.end(), commandKeyLess);
+
+    RenderQueueStats stats = { static_cast<int>(commands.size()), 0, 0 };
+    AppliedRenderState applied = { -1, -1, -1.0f, -1.0f, -1 };
+
+    // GL time goes to the emitting zone, one profiler span per run of commands
+    int zone = -1;
+    long long zoneStart = 0;
+    for (size_t i = 0; i < commands.size(); i++) {
+        const RenderCommand& command = commands[i];
+        if (command.zone != zone) {
+            if (zone >= 0) overdrawZoneEnd(zone);
+            long long now = profilerNow();
+            if (zone >= 0) {
+                if (profiler.syncGPU) {
+                    glFinish();
+                    now = profilerNow();
+                }
+                profilerRecord(zone, zoneStart, now - zoneStart);
+            }
+            zone = command.zone;
+            zoneStart = now;
+        }
+
+        applyRenderState(command.key, applied, stats);
+        command.draw(frame, command.object, command.part);
+
+        // Callbacks that size their own points leave the size unknown
+        if (((command.key >> 54) & 0x7) == PRIM_POINTS && ((command.key >> 40) & 0xFF) == 0) {
+            applied.pointSize = -1.0f;
+        }
+    }
+    if (zone >= 0) {
+        overdrawZoneEnd(zone);
+        if (profiler.syncGPU) glFinish();
+        profilerRecord(zone, zoneStart, profilerNow() - zoneStart);
+    }
+
+    stats.stateChangesSaved -= stats.stateChanges;
+    renderQueue.stats = stats;
+
+    glDisable(GL_BLEND);
+    glEnable(GL_LIGHTING);
+    glLineWidth(1.0f);
+    glPointSize(1.0f);
+    if (hasShaders) pglUseProgram(0);
+}
+
+// Optional bloom post-process. The scene is drawn into an offscreen target,
+// bright pixels are extracted at quarter resolution, blurred down a chain of
+// smaller targets, summed back up the chain and added on top of the scene. While it is on, draw functions skip
+// their second "glow" pass (thick lines, big points, oversized quads).
+const int BLOOM_LEVELS = 4;  // Quarter, 1/8, 1/16 and 1/32 resolution
+
+struct RenderTarget {
+    GLuint framebuffer;
+    GLuint texture;
+    int width, height;
+};
+
+struct Bloom {
+    bool enabled;     // --bloom on, or the B key
+    bool available;   // Shaders and framebuffer objects work
+    GLuint extractProgram, blurProgram, upsampleProgram, compositeProgram;
+    GLint thresholdLocation, texelLocation, directionLocation, weightLocation, intensityLocation;
+    RenderTarget scene;                // Window size, with depth and stencil
+    GLuint depthBuffer;
+    RenderTarget levels[BLOOM_LEVELS]; // Blurred bright pixels
+    RenderTarget scratch[BLOOM_LEVELS]; // Horizontal blur of each level
+    int width, height;                 // Scene size the targets were built for
+    bool offscreen;                    // This frame is being drawn into the scene target
+    float threshold;
+    float intensity;
+};
+
+Bloom bloom = { false, false, 0, 0, 0, 0, -1, -1, -1, -1, -1, { 0, 0, 0, 0 }, 0, {}, {}, 0, 0, false, 0.6f, 0.35f };
+
+bool bloomActive() {
+    return bloom.enabled && bloom.available;
+}
+
+// Quality levels, lowest first. Each step down gives up some image quality
+// for frame time: tessellation first, then resolution and stars, then the
+// glow passes.
+struct QualityLevel {
+    const char* name;
+    float resolutionScale;  // Of the window; below 1 the scene is drawn offscreen and scaled up
+    float tessellation;     // Of the tunnel, torus and spinner segment counts
+    bool glow;              // Glow passes (bloom replaces them at any level)
+    float starFraction;     // Of the star field drawn
+};
+
+const QualityLevel qualityLevels[] = {
+    { "minimal", 0.5f,  0.25f, false, 0.25f },
+    { "low",     0.7f,  0.5f,  false, 0.5f },
+    { "medium",  0.85f, 0.5f,  true,  0.5f },
+    { "high",    1.0f,  0.75f, true,  1.0f },
+    { "ultra",   1.0f,  1.0f,  true,  1.0f }
+};
+const int QUALITY_LEVEL_COUNT = sizeof(qualityLevels) / sizeof(qualityLevels[0]);
+
+// Frame-time governor; see updateQualityGovernor
+struct QualityGovernor {
+    bool automatic;     // --quality auto (the game's default) or the V key
+    int level;          // Index into qualityLevels
+    float budgetMs;     // --frame-budget
+    float averageMs;    // Smoothed frame time, 0 until the first frame at this level
+    float averageWorkMs;// The same without the swap (or vsync) wait
+    int slowFrames;     // Consecutive frames over budget
+    int fastFrames;     // Consecutive frames with headroom
+    int raiseAfter;     // Frames of headroom needed to step up
+    int settleFrames;   // Frames left before a new level (or the first) is judged
+    int sinceRaise;     // Frames since the last step up
+    int changes;
+    bool changed;       // The level changed after the last frame
+};
+
+const int QUALITY_RAISE_FRAMES = 120;  // Frames of headroom before the first step up
+const int QUALITY_SETTLE_FRAMES = 30;  // Frames a new level runs before it is judged
+
+QualityGovernor quality = { true, QUALITY_LEVEL_COUNT - 1, 16.6f, 0.0f, 0.0f, 0, 0, QUALITY_RAISE_FRAMES,
+                            QUALITY_SETTLE_FRAMES, 0, 0, false };
+
+const QualityLevel& currentQuality() {
+    return qualityLevels[quality.level];
+}
+
+bool glowPassesActive() {
+    return !bloomActive() && currentQuality().glow;
+}
+
+// Segment count at the current tessellation level
+int qualitySegments(int count, int minimum) {
+    return std::max(minimum, static_cast<int>(count * currentQuality().tessellation + 0.5f));
+}
+
+// The overdraw view reads the stencil back at window size
+float sceneResolutionScale() {
+    return overdraw.enabled ? 1.0f : currentQuality().resolutionScale;
+}
+
+// Full-screen triangle pair in clip space, texture coordinates derived from it
+const char* postVertexShader =
+    "#version 120\n"
+    "varying vec2 uv;\n"
+    "void main() {\n"
+    "    uv = gl_Vertex.xy * 0.5 + 0.5;\n"
+    "    gl_Position = vec4(gl_Vertex.xy, 0.0, 1.0);\n"
+    "}\n";
+
+// Averages the 4x4 scene pixels under each quarter-resolution pixel
+const char* bloomExtractShader =
+    "#version 120\n"
+    "uniform sampler2D source;\n"
+    "uniform float threshold;\n"
+    "uniform vec2 texel;\n"         // One scene pixel
+    "varying vec2 uv;\n"
+    "void main() {\n"
+    "    vec3 color = (texture2D(source, uv + vec2(-texel.x, -texel.y)).rgb +\n"
+    "                  texture2D(source, uv + vec2(texel.x, -texel.y)).rgb +\n"
+    "                  texture2D(source, uv + vec2(-texel.x, texel.y)).rgb +\n"
+    "                  texture2D(source, uv + vec2(texel.x, texel.y)).rgb) * 0.25;\n"
+    "    float brightness = max(color.r, max(color.g, color.b));\n"
+    "    gl_FragColor = vec4(color * smoothstep(threshold, 1.0, brightness), 1.0);\n"
+    "}\n";
+
+// 9-tap Gaussian folded into 5 bilinear fetches
+const char* bloomBlurShader =
+    "#version 120\n"
+    "uniform sampler2D source;\n"
+    "uniform vec2 direction;\n"      // One target texel along the blur axis
+    "varying vec2 uv;\n"
+    "void main() {\n"
+    "    vec2 near = direction * 1.3846153846;\n"
+    "    vec2 far = direction * 3.2307692308;\n"
+    "    vec3 sum = texture2D(source, uv).rgb * 0.2270270270;\n"
+    "    sum += (texture2D(source, uv + near).rgb + texture2D(source, uv - near).rgb) * 0.3162162162;\n"
+    "    sum += (texture2D(source, uv + far).rgb + texture2D(source, uv - far).rgb) * 0.0702702703;\n"
+    "    gl_FragColor = vec4(sum, 1.0);\n"
+    "}\n";
+
+const char* bloomUpsampleShader =
+    "#version 120\n"
+    "uniform sampler2D source;\n"
+    "uniform float weight;\n"
+    "varying vec2 uv;\n"
+    "void main() {\n"
+    "    gl_FragColor = vec4(texture2D(source, uv).rgb * weight, 1.0);\n"
+    "}\n";
+
+const char* bloomCompositeShader =
+    "#version 120\n"
+    "uniform sampler2D scene;\n"
+    "uniform sampler2D glow;\n"
+    "uniform float intensity;\n"
+    "varying vec2 uv;\n"
+    "void main() {\n"
+    "    gl_FragColor = vec4(texture2D(scene, uv).rgb + texture2D(glow, uv).rgb * intensity, 1.0);\n"
+    "}\n";
+
+void initBloom() {
+    if (!hasFramebuffers) return;
+    bloom.extractProgram = createShaderProgram(postVertexShader, bloomExtractShader);
+    bloom.blurProgram = createShaderProgram(postVertexShader, bloomBlurShader);
+    bloom.upsampleProgram = createShaderProgram(postVertexShader, bloomUpsampleShader);
+    bloom.compositeProgram = createShaderProgram(postVertexShader, bloomCompositeShader);
+    if (bloom.extractProgram == 0 || bloom.blurProgram == 0 ||
+        bloom.upsampleProgram == 0 || bloom.compositeProgram == 0) {
+        return;
+    }
+
+    bloom.thresholdLocation = pglGetUniformLocation(bloom.extractProgram, "threshold");
+    bloom.texelLocation = pglGetUniformLocation(bloom.extractProgram, "texel");
+    bloom.directionLocation = pglGetUniformLocation(bloom.blurProgram, "direction");
+    bloom.weightLocation = pglGetUniformLocation(bloom.upsampleProgram, "weight");
+    bloom.intensityLocation = pglGetUniformLocation(bloom.compositeProgram, "intensity");
+
+    // The composite reads the scene from unit 0 and the glow from unit 1
+    pglUseProgram(bloom.compositeProgram);
+    pglUniform1i(pglGetUniformLocation(bloom.compositeProgram, "scene"), 0);
+    pglUniform1i(pglGetUniformLocation(bloom.compositeProgram, "glow"), 1);
+    pglUseProgram(0);
+    bloom.available = true;
+}
+
+static void destroyRenderTarget(RenderTarget& target) {
+    if (target.framebuffer != 0) pglDeleteFramebuffers(1, &target.framebuffer);
+    if (target.texture != 0) glDeleteTextures(1, &target.texture);
+    target.framebuffer = 0;
+    target.texture = 0;
+}
+
+static bool createRenderTarget(RenderTarget& target, int width, int height, GLuint depthBuffer) {
+    target.width = std::max(1, width);
+    target.height = std::max(1, height);
+
+    glGenTextures(1, &target.texture);
+    glBindTexture(GL_TEXTURE_2D, target.texture);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, target.width, target.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glBindTexture(GL_TEXTURE_2D, 0);
+
+    pglGenFramebuffers(1, &target.framebuffer);
+    pglBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+    pglFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, target.texture, 0);
+    if (depthBuffer != 0) {
+        pglFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+    }
+    bool complete = pglCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+    pglBindFramebuffer(GL_FRAMEBUFFER, 0);
+    return complete;
+}
+
+// (Re)builds the targets for the window size at the current resolution scale
+static bool prepareBloomTargets() {
+    float scale = sceneResolutionScale();
+    int sceneWidth = std::max(1, static_cast<int>(windowWidth * scale + 0.5f));
+    int sceneHeight = std::max(1, static_cast<int>(windowHeight * scale + 0.5f));
+    if (bloom.width == sceneWidth && bloom.height == sceneHeight) return true;
+
+    destroyRenderTarget(bloom.scene);
+    for (int i = 0; i < BLOOM_LEVELS; i++) {
+        destroyRenderTarget(bloom.levels[i]);
+        destroyRenderTarget(bloom.scratch[i]);
+    }
+    if (bloom.depthBuffer != 0) pglDeleteRenderbuffers(1, &bloom.depthBuffer);
+
+    pglGenRenderbuffers(1, &bloom.depthBuffer);
+    pglBindRenderbuffer(GL_RENDERBUFFER, bloom.depthBuffer);
+    pglRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, sceneWidth, sceneHeight);
+    pglBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    bool complete = createRenderTarget(bloom.scene, sceneWidth, sceneHeight, bloom.depthBuffer);
+    for (int i = 0; i < BLOOM_LEVELS; i++) {
+        int width = sceneWidth >> (i + 2);
+        int height = sceneHeight >> (i + 2);
+        complete = createRenderTarget(bloom.levels[i], width, height, 0) && complete;
+        complete = createRenderTarget(bloom.scratch[i], width, height, 0) && complete;
+    }
+    if (!complete) {
+        std::cerr << "Warning: bloom framebuffers incomplete, using glow passes." << std::endl;
+        bloom.available = false;
+        return false;
+    }
+    bloom.width = sceneWidth;
+    bloom.height = sceneHeight;
+    return true;
+}
+
+// Redirects the frame into the offscreen scene target when bloom is on or
+// the quality level renders below window resolution
+void beginBloomFrame() {
+    bool scaled = sceneResolutionScale() < 1.0f;
+    if (!bloom.available || (!bloom.enabled && !scaled) || !prepareBloomTargets()) return;
+    pglBindFramebuffer(GL_FRAMEBUFFER, bloom.scene.framebuffer);
+    glViewport(0, 0, bloom.width, bloom.height);
+    bloom.offscreen = true;
+}
+
+static void drawPostPass(const RenderTarget& target, GLuint source) {
+    pglBindFramebuffer(GL_FRAMEBUFFER, target.framebuffer);
+    glViewport(0, 0, target.width, target.height);
+    glBindTexture(GL_TEXTURE_2D, source);
+    glRecti(-1, -1, 1, 1);
+}
+
+// Extract, blur down the chain, sum back up and add onto the window. A
+// scaled-down scene without bloom only goes through the composite.
+void applyBloom() {
+    if (!bloom.offscreen) return;
+    bloom.offscreen = false;
+    ProfileScope profile(ZONE_BLOOM);
+
+    glPushAttrib(GL_ENABLE_BIT | GL_VIEWPORT_BIT | GL_COLOR_BUFFER_BIT);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_BLEND);
+
+    if (bloom.enabled) {
+        pglUseProgram(bloom.extractProgram);
+        pglUniform1f(bloom.thresholdLocation, bloom.threshold);
+        pglUniform2f(bloom.texelLocation, 1.0f / bloom.width, 1.0f / bloom.height);
+        drawPostPass(bloom.levels[0], bloom.scene.texture);
+
+        // Each level: downsample the previous one while blurring across, then down
+        pglUseProgram(bloom.blurProgram);
+        for (int i = 0; i < BLOOM_LEVELS; i++) {
+            const RenderTarget& level = bloom.levels[i];
+            GLuint source = i == 0 ? level.texture : bloom.levels[i - 1].texture;
+            pglUniform2f(bloom.directionLocation, 1.0f / level.width, 0.0f);
+            drawPostPass(bloom.scratch[i], source);
+            pglUniform2f(bloom.directionLocation, 0.0f, 1.0f / level.height);
+            drawPostPass(level, bloom.scratch[i].texture);
+        }
+
+        // Smallest to largest, each level adds the (wider) one below it
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+        pglUseProgram(bloom.upsampleProgram);
+        pglUniform1f(bloom.weightLocation, 1.0f);
+        for (int i = BLOOM_LEVELS - 2; i >= 0; i--) {
+            drawPostPass(bloom.levels[i], bloom.levels[i + 1].texture);
+        }
+        glDisable(GL_BLEND);
+    }
+
+    // Scene plus glow in one full-resolution pass, scaling the scene up
+    pglUseProgram(bloom.compositeProgram);
+    pglUniform1f(bloom.intensityLocation, bloom.enabled ? bloom.intensity : 0.0f);
+    pglActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, bloom.levels[0].texture);
+    pglActiveTexture(GL_TEXTURE0);
+    pglBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, windowWidth, windowHeight);
+    glBindTexture(GL_TEXTURE_2D, bloom.scene.texture);
+    glRecti(-1, -1, 1, 1);
+
+    pglActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    pglActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    pglUseProgram(0);
+    glPopAttrib();
+    glViewport(0, 0, windowWidth, windowHeight);
+}
+
+int main(int argc, char** argv) {
+    // Our options are read first; GLUT ignores what it does not know
+    parseOptions(argc, argv);
+    if (trafficBenchCars > 0) {
+        return runTrafficBenchmark();
+    }
+    if (musicAnalysisPath) {
+        return runMusicAnalysis(musicAnalysisPath);
+    }
+    if (audioBenchSeconds > 0.0f) {
+        return runAudioBenchmark();
+    }
+    if (benchMode) {
+        return runBenchmark();
+    }
+
+    // Initialize GLUT
+    glutInit(&argc, argv);
+    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH | GLUT_STENCIL);
+    glutInitWindowSize(SCR_WIDTH, SCR_HEIGHT);
+    glutCreateWindow("Retrowave City");
+
+    // Register callbacks
+    glutDisplayFunc(display);
+    glutReshapeFunc(reshape);
+    glutKeyboardFunc(keyboard);
+    glutKeyboardUpFunc(keyboardUp);
+    glutSpecialFunc(specialKeys);
+    glutSpecialUpFunc(specialKeysUp);
+    glutIgnoreKeyRepeat(1);
+    glutIdleFunc(idle); // Render as fast as the display allows
+
+    // Initialize OpenGL
+    init();
+
+    // Initialize audio (play the background music)
+    initAudio();
+
+    // Register cleanup function
+    atexit(cleanup);
+
+    // Start main loop
+    glutMainLoop();
+
+    return 0;
+}
+
+void parseOptions(int argc, char** argv) {
+    // Preset and config file first, so individual flags override them
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--preset") == 0 && !applyScenePreset(argv[i + 1])) {
+            std::cerr << "Unknown preset: " << argv[i + 1] << std::endl;
+        }
+    }
+    for (int i = 1; i + 1 < argc; i++) {
+        if (strcmp(argv[i], "--config") == 0) {
+            loadSceneConfig(argv[i + 1]);
+        }
+    }
+
+    for (int i = 1; i < argc; i++) {
+        if ((strcmp(argv[i], "--preset") == 0 || strcmp(argv[i], "--config") == 0) && i + 1 < argc) {
+            i++;
+        } else if (strncmp(argv[i], "--", 2) == 0 && i + 1 < argc && applySceneSetting(argv[i] + 2, argv[i + 1])) {
+            i++;
+        } else if (strcmp(argv[i], "--bench") == 0) {
+            benchMode = true;
+        } else if (strcmp(argv[i], "--bench-frames") == 0 && i + 1 < argc) {
+            benchFrames = std::max(1, atoi(argv[++i]));
+        } else if (strcmp(argv[i], "--bench-size") == 0 && i + 1 < argc) {
+            int w = 0, h = 0;
+            if (sscanf(argv[++i], "%dx%d", &w, &h) == 2 && w > 0 && h > 0) {
+                benchWidth = w;
+                benchHeight = h;
+            }
+        } else if (strcmp(argv[i], "--bench-drive") == 0) {
+            benchDrive = true;
+        } else if (strcmp(argv[i], "--bench-capture") == 0 && i + 1 < argc) {
+            benchCapturePath = argv[++i];
+        } else if (strcmp(argv[i], "--camera-yaw") == 0 && i + 1 < argc) {
+            // Degrees to the right of the default view down -z
+            float yaw = static_cast<float>(atof(argv[++i])) * static_cast<float>(M_PI) / 180.0f;
+            lookX = sinf(yaw);
+            lookZ = -cosf(yaw);
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            traceOutputPath = argv[++i];
+        } else if (strcmp(argv[i], "--overdraw") == 0) {
+            overdraw.enabled = true;
+        } else if (strcmp(argv[i], "--bloom") == 0 && i + 1 < argc) {
+            const char* mode = argv[++i];
+            bloom.enabled = strcmp(mode, "on") == 0;
+            benchCompareBloom = strcmp(mode, "compare") == 0;
+        } else if (strcmp(argv[i], "--quality") == 0 && i + 1 < argc) {
+            qualityGiven = parseQualityMode(argv[++i]);
+        } else if (strcmp(argv[i], "--frame-budget") == 0 && i + 1 < argc) {
+            quality.budgetMs = std::max(1.0f, static_cast<float>(atof(argv[++i])));
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            const char* count = argv[++i];
+            benchThreadSweep = strcmp(count, "sweep") == 0;
+            if (!benchThreadSweep) jobThreadCount = std::max(1, atoi(count));
+        } else if (strcmp(argv[i], "--traffic-kernel") == 0 && i + 1 < argc) {
+            trafficKernelName = argv[++i];
+        } else if (strcmp(argv[i], "--traffic-bench") == 0) {
+            trafficBenchCars = i + 1 < argc && argv[i + 1][0] != '-' ? std::max(8, atoi(argv[++i])) : 10000;
+        } else if (strcmp(argv[i], "--analyze") == 0 && i + 1 < argc) {
+            musicAnalysisPath = argv[++i];
+        } else if (strcmp(argv[i], "--music") == 0 && i + 1 < argc) {
+            musicPath = argv[++i];
+        } else if (strcmp(argv[i], "--audio-sink") == 0 && i + 1 < argc) {
+            const char* sink = argv[++i];
+            audioSinkType = strcmp(sink, "device") == 0 ? AUDIO_SINK_DEVICE
+                          : strcmp(sink, "null") == 0 ? AUDIO_SINK_NULL : AUDIO_SINK_FILE;
+            audioSinkPath = audioSinkType == AUDIO_SINK_FILE ? sink : NULL;
+            audioSinkGiven = true;
+        } else if (strcmp(argv[i], "--audio-bench") == 0) {
+            audioBenchSeconds = i + 1 < argc && argv[i + 1][0] != '-' ? std::max(0.5f, static_cast<float>(atof(argv[++i]))) : 5.0f;
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            worldSeed = strtoull(argv[++i], NULL, 0);
+            seedGiven = true;
+        }
+    }
+    clampSceneConfig();
+    selectTrafficKernel(trafficKernelName);
+}
+
+bool applyScenePreset(const char* name) {
+    for (size_t i = 0; i < sizeof(scenePresets) / sizeof(scenePresets[0]); i++) {
+        if (strcmp(scenePresets[i].name, name) == 0) {
+            scene = scenePresets[i].config;
+            scenePresetName = scenePresets[i].name;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Returns false for names that are not scene settings
+bool applySceneSetting(const char* name, const char* value) {
+    for (int i = 0; i < SCENE_SETTING_COUNT; i++) {
+        if (strcmp(sceneSettings[i].name, name) != 0) continue;
+
+        if (sceneSettings[i].intValue) {
+            *sceneSettings[i].intValue = atoi(value);
+        } else {
+            *sceneSettings[i].floatValue = static_cast<float>(atof(value));
+        }
+        return true;
+    }
+    return false;
+}
+
+// "name = value" per line, '#' starts a comment; "preset = city" is allowed
+bool loadSceneConfig(const char* path) {
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        std::cerr << "Failed to open config: " << path << std::endl;
+        return false;
+    }
+
+    char line[256];
+    int lineNumber = 0;
+    while (fgets(line, sizeof(line), file)) {
+        lineNumber++;
+        char* comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        char name[64], value[64];
+        if (sscanf(line, " %63[^= \t] = %63s", name, value) != 2) {
+            if (sscanf(line, " %63s", name) == 1) {
+                std::cerr << path << ":" << lineNumber << ": expected name = value" << std::endl;
+            }
+            continue;
+        }
+
+        bool known = strcmp(name, "preset") == 0 ? applyScenePreset(value) : applySceneSetting(name, value);
+        if (!known) {
+            std::cerr << path << ":" << lineNumber << ": unknown setting " << name << " = " << value << std::endl;
+        }
+    }
+
+    fclose(file);
+    return true;
+}
+
+// Keeps hand-edited values within what the scene code can draw
+void clampSceneConfig() {
+    scene.stars = std::max(0, scene.stars);
+    scene.spinners = std::max(0, scene.spinners);
+    scene.lotSize = std::max(2.0f, std::min(CHUNK_SIZE, scene.lotSize));
+    scene.buildingDensity = std::max(0.0f, std::min(1.0f, scene.buildingDensity));
+    scene.carsPerChunk = std::max(0, scene.carsPerChunk);
+    scene.chunkRadius = std::max(0, std::min(7, scene.chunkRadius));
+
+    // Room for every chunk in range, otherwise they would evict each other
+    int chunksInRange = (2 * scene.chunkRadius + 1) * (2 * scene.chunkRadius + 1);
+    scene.chunkBudget = std::max(chunksInRange, scene.chunkBudget);
+
+    scene.spinnerSegments = std::max(4, scene.spinnerSegments);
+    scene.tunnelSegments = std::max(3, scene.tunnelSegments);
+    scene.tunnelRings = std::max(1, scene.tunnelRings);
+    scene.gridSize = std::max(1.0f, scene.gridSize);
+    scene.gridDivisions = std::max(1, scene.gridDivisions);
+    scene.torusSides = std::max(3, scene.torusSides);
+    scene.torusRings = std::max(3, scene.torusRings);
+}
+
+// Seconds since startup, or the simulated clock when benchmarking
+float getElapsedTime() {
+    if (benchMode) return benchClock;
+    return glutGet(GLUT_ELAPSED_TIME) / 1000.0f;
+}
+
+void init() {
+    profiler.epoch = std::chrono::steady_clock::now();
+
+    // Shaders and buffer objects are optional
+    loadGLExtensions();
+
+    // Set background color (deep purple)
+    glClearColor(0.05f, 0.0f, 0.1f, 1.0f);
+
+    // Enable depth testing and lighting
+    glEnable(GL_DEPTH_TEST);
+    glEnable(GL_LIGHTING);
+    glEnable(GL_LIGHT0);
+
+    // Setup light
+    GLfloat ambientLight[] = { 0.1f, 0.1f, 0.2f, 1.0f };
+    GLfloat diffuseLight[] = { 0.8f, 0.8f, 1.0f, 1.0f };
+    GLfloat position[] = { -10.0f, 20.0f, 10.0f, 1.0f };
+
+    glLightfv(GL_LIGHT0, GL_AMBIENT, ambientLight);
+    glLightfv(GL_LIGHT0, GL_DIFFUSE, diffuseLight);
+    glLightfv(GL_LIGHT0, GL_POSITION, position);
+
+    // Enable color material
+    glEnable(GL_COLOR_MATERIAL);
+    glColorMaterial(GL_FRONT, GL_AMBIENT_AND_DIFFUSE);
+
+    // A fresh scene every run unless a seed was given
+    if (!seedGiven) {
+        worldSeed = static_cast<unsigned long long>(time(NULL));
+        if (!benchMode) printf("Scene seed: %llu (replay with --seed)\n", worldSeed);
+    }
+    if (quality.automatic) {
+        logQualityLevel("adaptive, holding the frame-time budget");
+    } else if (!benchMode) {
+        logQualityLevel("fixed");
+    }
+
+    // Initialize stars
+    Random starRandom(RNG_STARS, 0);
+    for (int i = 0; i < scene.stars; i++) {
+        Star s;
+        s.x = starRandom.range(-150.0f, 150.0f);
+        s.y = starRandom.range(20.0f, 100.0f);
+        s.z = starRandom.range(-150.0f, -50.0f);
+        s.brightness = starRandom.range(0.5f, 1.0f);
+        s.size = starRandom.range(1.0f, 3.0f);
+        s.colorType = starRandom.below(10); // Different star colors
+        stars.push_back(s);
+    }
+    initStarField();
+    initWindowRenderer();
+    initGridRenderer();
+    initBloom();
+
+    // Initialize spinners
+    // Main spinner (vortex tunnel in the sky)
+    Spinner mainVortex;
+    mainVortex.x = 0.0f;
+    mainVortex.y = 30.0f;
+    mainVortex.z = -80.0f;
+    mainVortex.radius = 25.0f;
+    mainVortex.rotation = 0.0f;
+    mainVortex.rotationSpeed = 30.0f;
+    mainVortex.type = 1; // spiral
+    mainVortex.isPink = true;
+    simCurrent.spinners.push_back(mainVortex);
+
+    // Additional floating spinners
+    Random spinnerRandom(RNG_SPINNERS, 0);
+    for (int i = 0; i < scene.spinners; i++) {
+        Spinner s;
+        s.x = spinnerRandom.range(-40.0f, 40.0f);
+        s.y = spinnerRandom.range(15.0f, 35.0f);
+        s.z = spinnerRandom.range(-100.0f, -60.0f);
+        s.radius = spinnerRandom.range(3.0f, 8.0f);
+        s.rotation = 0.0f;
+        s.rotationSpeed = spinnerRandom.range(10.0f, 40.0f);
+        s.type = spinnerRandom.below(2);
+        s.isPink = (spinnerRandom.below(2) == 0);
+        simCurrent.spinners.push_back(s);
+    }
+
+    // The player's car starts on the avenue's free outer strip, in front of the camera
+    simCurrent.player.x = -10.0f;
+    simCurrent.player.z = 40.0f;
+    simCurrent.player.boost = 1.0f;
+
+    // Per-frame vertex building runs on these
+    startJobSystem(jobThreadCount);
+
+    // Stream the city (buildings and traffic) around the camera
+    startChunkStreaming();
+    preloadChunks();
+
+    // Both simulation buffers start from the same state
+    simPrevious = simCurrent;
+    simRender = simCurrent;
+    startSimulationThread(getElapsedTime());
+
+    // Initialize time
+    previousTime = getElapsedTime();
+
+    // Better graphics quality
+    glEnable(GL_POINT_SMOOTH);
+    glEnable(GL_LINE_SMOOTH);
+    glShadeModel(GL_SMOOTH);
+}
+
+void initAudio() {
+    // PLACE retrowave_music.wav IN THE SAME FOLDER AS YOUR EXE FILE (or pass
+    // --music). The track plays and is analyzed so the city pulses with it.
+    if (!startAudio(musicPath)) {
+        std::cerr << "Warning: Failed to play background music: " << musicPath << std::endl;
+        return;
+    }
+    startMusicAnalysis(musicPath);
 }
 
 void cleanup() {
-    audioPlayer.stopMusic();
+    stopMusicAnalysis();
+    stopSimulationThread();
+    stopChunkStreaming();
+    stopJobSystem();
+    stopAudio();
+}
+
+void display() {
+    // Snapshot the clock once for everything drawn this frame
+    float now = getElapsedTime();
+    static float lastFrameTime = now;
+    FrameContext frame = makeFrameContext(now, lastFrameTime);
+    lastFrameTime = frame.time;
+
+    profilerBeginFrame();
+    renderFrame(frame);
+
+    // Frame-time graph on top of the scene
+    if (profiler.showOverlay) {
+        drawProfilerOverlay();
+    }
+    if (showRaceStats) {
+        drawRaceStats();
+    }
+    drawQualityLabel();
+
+    // Calculate and display FPS
+    calculateFPS(frame);
+
+    // Swap buffers
+    {
+        ProfileScope profile(ZONE_SWAP);
+        glutSwapBuffers();
+    }
+    profilerEndFrame();
+    updateQualityGovernor();
+}
+
+void renderFrame(const FrameContext& frame) {
+    // Transient data from the last frame is released
+    resetFrameArena();
+
+    // Adopt generated chunks, request new ones and evict far ones
+    updateChunkStreaming();
+
+    // Run the fixed-step simulation and interpolate the state to draw
+    advanceSimulation(frame);
+    if (chaseCamera) {
+        updateChaseCamera(frame);
+    }
+
+    // Draw offscreen when bloom is on
+    beginBloomFrame();
+
+    // Clear the screen
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    beginOverdrawFrame();
+
+    // Reset transformations
+    glLoadIdentity();
+
+    // Set the camera position
+    gluLookAt(cameraX, cameraY, cameraZ,
+              cameraX + lookX, cameraY + lookY, cameraZ + lookZ,
+              0.0f, 1.0f, 0.0f);
+    updateViewFrustum();
+    beginRenderQueue();
+
+    // Draw sky with stars
+    drawSky(frame);
+
+    // Add the new shapes
+    drawPyramid(frame);
+    drawTorus(frame);
+
+    // Draw spinners (futuristic elements)
+    drawSpinners(frame);
+
+    // Draw tunnel effect in the sky
+    drawTunnel(30.0f, qualitySegments(scene.tunnelSegments, 3), qualitySegments(scene.tunnelRings, 1), frame);
+
+    // Draw grid
+    drawGrid(scene.gridSize, scene.gridDivisions, frame);
+
+    // Draw buildings
+    drawBuildings(frame);
+
+    // Draw cars
+    drawCars(frame);
+    drawPlayerCar(frame);
+
+    // Everything above only queued commands and the jobs that fill their
+    // vertex arrays
+    runQueuedJobs(frame);
+    submitRenderQueue(frame);
+    endOverdrawFrame();
+
+    // Glow from the bright pixels instead of the skipped glow passes
+    applyBloom();
+
+    // Fragment counts replace the picture in the overdraw view
+    if (overdraw.enabled) {
+        drawOverdrawView();
+    }
+}
+
+void reshape(int width, int height) {
+    windowWidth = width;
+    windowHeight = height > 0 ? height : 1;
+
+    // Set viewport to window dimensions
+    glViewport(0, 0, width, height);
+
+    // Set perspective projection
+    glMatrixMode(GL_PROJECTION);
+    glLoadIdentity();
+    gluPerspective(45.0f, (float)width / (float)height, 0.1f, VIEW_DISTANCE);
+
+    // Switch back to modelview matrix
+    glMatrixMode(GL_MODELVIEW);
+    glLoadIdentity();
+}
+
+void idle() {
+    glutPostRedisplay();
+}
+
+static float lerpWrapped(float from, float to, float alpha, float period) {
+    float delta = to - from;
+    if (delta < -period * 0.5f) delta += period;
+    else if (delta > period * 0.5f) delta -= period;
+
+    float value = from + delta * alpha;
+    if (value > period) value -= period;
+    if (value < 0.0f) value += period;
+    return value;
+}
+
+static void interpolateSimState(const SimState& previous, const SimState& current, float alpha, SimState& out) {
+    out.time = previous.time + (current.time - previous.time) * alpha;
+    out.gridOffset = lerpWrapped(previous.gridOffset, current.gridOffset, alpha, 1.0f);
+    out.vortexAngle = lerpWrapped(previous.vortexAngle, current.vortexAngle, alpha, 360.0f);
+    out.tunnelDepth = lerpWrapped(previous.tunnelDepth, current.tunnelDepth, alpha, 10.0f);
+    out.buildingPulse = previous.buildingPulse + (current.buildingPulse - previous.buildingPulse) * alpha;
+
+    out.spinners = current.spinners;
+    for (size_t i = 0; i < out.spinners.size(); i++) {
+        out.spinners[i].rotation = lerpWrapped(previous.spinners[i].rotation, current.spinners[i].rotation, alpha, 360.0f);
+    }
+
+    out.music = current.music;
+
+    out.player = current.player;
+    out.player.x = previous.player.x + (current.player.x - previous.player.x) * alpha;
+    out.player.z = previous.player.z + (current.player.z - previous.player.z) * alpha;
+    out.player.heading = lerpWrapped(previous.player.heading, current.player.heading, alpha, TWO_PI);
+
+    out.traffic = current.traffic;
+    if (out.traffic.size() == 0) return;
+    const float* fromX = &previous.traffic.x[0];
+    const float* toX = &current.traffic.x[0];
+    const float* from = &previous.traffic.z[0];
+    const float* to = &current.traffic.z[0];
+    float* x = &out.traffic.x[0];
+    float* z = &out.traffic.z[0];
+    for (size_t i = 0; i < out.traffic.size(); i++) {
+        x[i] = fromX[i] + (toX[i] - fromX[i]) * alpha;
+        // A car that respawned this step snaps to its new position
+        if (to[i] >= from[i]) {
+            z[i] = from[i] + (to[i] - from[i]) * alpha;
+        }
+    }
+}
+
+// Simulation thread (or the caller while it is stopped)
+static void stepSimulation(float deltaTime) {
+    simAccumulator += std::min(std::max(deltaTime, 0.0f), MAX_FRAME_DELTA);
+
+    while (simAccumulator >= SIM_STEP) {
+        simPrevious = simCurrent;
+
+        FrameContext tick = makeFrameContext(static_cast<float>(simCurrent.time + SIM_STEP),
+                                             static_cast<float>(simCurrent.time));
+        tick.deltaTime = SIM_STEP;
+        updateSimulation(simCurrent, tick);
+
+        simAccumulator -= SIM_STEP;
+    }
+}
+
+static void applySimCommand(const SimCommand& command) {
+    switch (command.type) {
+        case SIM_ADVANCE:
+            stepSimulation(command.clock - simThread.clock);
+            simThread.clock = command.clock;
+            break;
+        case SIM_ADD_CHUNK:
+            // Both buffers get the new cars so interpolation stays aligned
+            if (command.cars) {
+                simCurrent.traffic.append(*command.cars);
+                simPrevious.traffic.append(*command.cars);
+                delete command.cars;
+            }
+            if (command.buildings) {
+                ChunkColliders*& colliders = buildingColliders.insert(command.chunk);
+                delete colliders;
+                colliders = command.buildings;
+            }
+            break;
+        case SIM_REMOVE_CHUNK: {
+            simCurrent.traffic.removeChunk(command.chunk);
+            simPrevious.traffic.removeChunk(command.chunk);
+            ChunkColliders** colliders = buildingColliders.find(command.chunk);
+            if (colliders) {
+                delete *colliders;
+                buildingColliders.erase(command.chunk);
+            }
+            break;
+        }
+        case SIM_PLAYER_INPUT:
+            simCurrent.player.input = command.input;
+            break;
+        case SIM_MUSIC:
+            simCurrent.music = command.music;
+            break;
+    }
+}
+
+static void publishSimSnapshot() {
+    SimSnapshot& snapshot = simThread.snapshots.writeSlot();
+    snapshot.previous = simPrevious;
+    snapshot.current = simCurrent;
+    snapshot.accumulator = simAccumulator;
+    snapshot.clock = simThread.clock;
+    simThread.snapshots.publish();
+}
+
+static void simulationThreadMain() {
+    while (true) {
+        // Commands sent before a stop are still applied
+        bool stopping = !simThread.running.load();
+        long long start = profilerNow();
+        bool changed = false;
+        SimCommand command;
+        while (simThread.commands.pop(command)) {
+            applySimCommand(command);
+            changed = true;
+        }
+        if (changed) {
+            publishSimSnapshot();
+            simThread.busyNanoseconds += profilerNow() - start;
+        } else if (!stopping) {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+        if (stopping) return;
+    }
+}
+
+// Applied in order by the simulation thread, or right away while it is stopped
+void sendSimCommand(const SimCommand& command) {
+    if (!simThread.running.load()) {
+        applySimCommand(command);
+        return;
+    }
+    while (!simThread.commands.push(command)) {
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+    }
+}
+
+// Publishes the current state as the first snapshot, at clock
+void startSimulationThread(float clock) {
+    simThread.clock = clock;
+    simThread.requested = clock;
+    publishSimSnapshot();
+    simThread.running = true;
+    simThread.thread = std::thread(simulationThreadMain);
+}
+
+void stopSimulationThread() {
+    if (!simThread.running.load()) return;
+    simThread.running = false;
+    simThread.thread.join();
+}
+
+// Takes the newest snapshot, then lets the simulation run up to this frame's
+// clock while the snapshot is drawn. The bench waits for the snapshot of the
+// previous frame's clock so every run draws the same states.
+void advanceSimulation(const FrameContext& frame) {
+    ProfileScope profile(ZONE_SIMULATION);
+    TripleBuffer<SimSnapshot>& snapshots = simThread.snapshots;
+    snapshots.update();
+    while (benchMode && snapshots.readSlot().clock != simThread.requested) {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+        snapshots.update();
+    }
+    const SimSnapshot& snapshot = snapshots.readSlot();
+
+    updateSoundEffects(snapshot.current.player, frame.time);
+    updateMusicLevels(frame);
+    SimCommand controls = makeSimCommand(SIM_PLAYER_INPUT);
+    controls.input = readPlayerInput(frame);
+    sendSimCommand(controls);
+    SimCommand advance = makeSimCommand(SIM_ADVANCE);
+    advance.clock = frame.time;
+    sendSimCommand(advance);
+    simThread.requested = frame.time;
+
+    interpolateSimState(snapshot.previous, snapshot.current, snapshot.accumulator / SIM_STEP, simRender);
+}
+
+// Car following uses the Intelligent Driver Model: each car accelerates
+// towards its desired speed and brakes to keep a speed-dependent gap to the
+// car ahead in its lane
+const float CAR_LENGTH = 4.0f;
+const float IDM_ACCELERATION = 6.0f;  // Units/s^2 on an open road
+const float IDM_BRAKING = 8.0f;       // Comfortable deceleration
+const float IDM_MAX_BRAKING = 40.0f;  // Hardest stop, for cars that end up overlapping
+const float IDM_MIN_GAP = 1.5f;       // Bumper to bumper when stopped
+const float IDM_HEADWAY = 0.6f;       // Seconds of gap at speed
+const float IDM_GAP_FLOOR = 0.1f;     // Keeps the braking term finite
+const float IDM_BRAKE_SCALE = 1.0f / (2.0f * 6.92820323f); // 1 / (2 sqrt(acceleration * braking))
+const float OPEN_ROAD_GAP = 1000.0f;  // Gap of the front car in a lane
+
+// Lane changes follow MOBIL: a car moves over when it gains more acceleration
+// than it costs the car it cuts in front of (weighted by politeness), and
+// never when that car would have to brake harder than LANE_CHANGE_MAX_BRAKING
+const float LANE_CHANGE_POLITENESS = 0.3f;
+const float LANE_CHANGE_THRESHOLD = 0.5f;
+const float LANE_CHANGE_MAX_BRAKING = 4.0f;
+const float LANE_CHANGE_SPEED = 4.0f;      // Sideways, units/s
+const unsigned int LANE_CHANGE_PERIOD = 16; // Each car considers changing every 16 steps
+
+static inline float laneCenter(int lane) {
+    return (static_cast<float>(lane) + 0.5f) * LANE_WIDTH - 8.0f;
+}
+
+// Same operand order as _mm256_max_ps/_mm256_min_ps, so both kernels round alike
+static inline float maxOf(float a, float b) { return a > b ? a : b; }
+static inline float minOf(float a, float b) { return a < b ? a : b; }
+
+static inline float idmAcceleration(float speed, float desired, float gap, float closing) {
+    float ratio = speed / desired;
+    float ratio2 = ratio * ratio;
+    float wanted = IDM_MIN_GAP + maxOf(0.0f, speed * IDM_HEADWAY + speed * closing * IDM_BRAKE_SCALE);
+    float pressure = wanted / maxOf(gap, IDM_GAP_FLOOR);
+    return maxOf(IDM_ACCELERATION * (1.0f - ratio2 * ratio2 - pressure * pressure), -IDM_MAX_BRAKING);
+}
+
+// Orders cars by z, then by index so equal positions sort the same every run
+struct CarAhead {
+    const float* z;
+    bool operator()(unsigned int a, unsigned int b) const {
+        return z[a] < z[b] || (z[a] == z[b] && a < b);
+    }
+};
+
+// Regroups the cars by stretch and lane and sorts each lane by z
+static void sortTrafficLanes(const Traffic& traffic, TrafficIndex& index) {
+    size_t count = traffic.size();
+    CarAhead ahead = { count ? &traffic.z[0] : NULL };
+    bool rebuild = index.generation != traffic.generation || index.builtFor != count;
+    if (rebuild) {
+        // Cars of a chunk are contiguous, see Traffic::append
+        index.stretches.clear();
+        for (size_t first = 0; first < count;) {
+            size_t last = first + 1;
+            while (last < count && traffic.chunk[last] == traffic.chunk[first]) last++;
+            TrafficIndex::Stretch stretch = { first, last, { 0 } };
+            index.stretches.push_back(stretch);
+            first = last;
+        }
+        index.order.resize(count);
+        for (size_t i = 0; i < count; i++) index.order[i] = static_cast<unsigned int>(i);
+        index.scratch.resize(count);
+        index.gap.resize(count);
+        index.closing.resize(count);
+        index.generation = traffic.generation;
+        index.builtFor = count;
+    }
+
+    for (size_t s = 0; s < index.stretches.size(); s++) {
+        TrafficIndex::Stretch& stretch = index.stretches[s];
+
+        // Stable counting sort by lane keeps each lane nearly sorted by z
+        unsigned int laneCounts[TRAFFIC_LANES] = { 0 };
+        for (size_t k = stretch.first; k < stretch.last; k++) laneCounts[traffic.lane[index.order[k]]]++;
+        unsigned int next[TRAFFIC_LANES];
+        stretch.lanes[0] = static_cast<unsigned int>(stretch.first);
+        for (int l = 0; l < TRAFFIC_LANES; l++) {
+            next[l] = stretch.lanes[l];
+            stretch.lanes[l + 1] = stretch.lanes[l] + laneCounts[l];
+        }
+        for (size_t k = stretch.first; k < stretch.last; k++) {
+            unsigned int car = index.order[k];
+            index.scratch[next[traffic.lane[car]]++] = car;
+        }
+        std::copy(index.scratch.begin() + stretch.first, index.scratch.begin() + stretch.last, index.order.begin() + stretch.first);
+
+        for (int l = 0; l < TRAFFIC_LANES; l++) {
+            unsigned int* begin = &index.order[0] + stretch.lanes[l];
+            unsigned int* end = &index.order[0] + stretch.lanes[l + 1];
+            if (rebuild) {
+                std::sort(begin, end, ahead);
+                continue;
+            }
+            // Insertion sort: only cars that passed someone or respawned move
+            for (unsigned int* p = begin + 1; p < end; p++) {
+                unsigned int car = *p;
+                unsigned int* q = p;
+                while (q > begin && ahead(car, q[-1])) {
+                    *q = q[-1];
+                    q--;
+                }
+                *q = car;
+            }
+        }
+    }
+}
+
+// Gap and closing speed to the next car in the same lane
+static void findCarsAhead(const Traffic& traffic, TrafficIndex& index) {
+    const float* z = traffic.z.empty() ? NULL : &traffic.z[0];
+    const float* speed = traffic.speed.empty() ? NULL : &traffic.speed[0];
+    for (size_t s = 0; s < index.stretches.size(); s++) {
+        const TrafficIndex::Stretch& stretch = index.stretches[s];
+        for (int l = 0; l < TRAFFIC_LANES; l++) {
+            unsigned int end = stretch.lanes[l + 1];
+            for (unsigned int k = stretch.lanes[l]; k < end; k++) {
+                unsigned int car = index.order[k];
+                if (k + 1 < end) {
+                    unsigned int leader = index.order[k + 1];
+                    index.gap[car] = z[leader] - z[car] - CAR_LENGTH;
+                    index.closing[car] = speed[car] - speed[leader];
+                } else {
+                    // The front car leaves the stretch, so its road is open
+                    index.gap[car] = OPEN_ROAD_GAP;
+                    index.closing[car] = 0.0f;
+                }
+            }
+        }
+    }
+}
+
+// Lets every LANE_CHANGE_PERIOD-th car move to a neighboring lane. Cars are
+// visited in z order, so the cars around it in the other lane are found by
+// cursors that only move forward.
+static void changeLanes(Traffic& traffic, TrafficIndex& index) {
+    const float* z = traffic.z.empty() ? NULL : &traffic.z[0];
+    const float* speed = traffic.speed.empty() ? NULL : &traffic.speed[0];
+    const float* desired = traffic.desired.empty() ? NULL : &traffic.desired[0];
+    CarAhead ahead = { z };
+    index.laneChanges = 0;
+
+    for (size_t s = 0; s < index.stretches.size(); s++) {
+        const TrafficIndex::Stretch& stretch = index.stretches[s];
+        for (int l = 0; l < TRAFFIC_LANES; l++) {
+            unsigned int cursor[TRAFFIC_LANES];
+            for (int t = 0; t < TRAFFIC_LANES; t++) cursor[t] = stretch.lanes[t];
+
+            for (unsigned int k = stretch.lanes[l]; k < stretch.lanes[l + 1]; k++) {
+                unsigned int car = index.order[k];
+                if ((car + traffic.step) % LANE_CHANGE_PERIOD != 0) continue;
+                // Finish one lane change before starting another
+                if (fabsf(traffic.x[car] - laneCenter(l)) > 0.25f) continue;
+
+                float current = idmAcceleration(speed[car], desired[car], index.gap[car], index.closing[car]);
+                float bestGain = LANE_CHANGE_THRESHOLD;
+                int bestLane = l;
+                float bestGap = 0.0f, bestClosing = 0.0f;
+                for (int side = -1; side <= 1; side += 2) {
+                    int t = l + side;
+                    if (t < 0 || t >= TRAFFIC_LANES) continue;
+                    unsigned int begin = stretch.lanes[t], end = stretch.lanes[t + 1];
+                    while (cursor[t] < end && !ahead(car, index.order[cursor[t]])) cursor[t]++;
+
+                    // New leader: first car ahead in lane t
+                    float gap = OPEN_ROAD_GAP, closing = 0.0f;
+                    if (cursor[t] < end) {
+                        unsigned int leader = index.order[cursor[t]];
+                        gap = z[leader] - z[car] - CAR_LENGTH;
+                        closing = speed[car] - speed[leader];
+                    }
+                    if (gap < IDM_MIN_GAP) continue;
+                    float gain = idmAcceleration(speed[car], desired[car], gap, closing) - current;
+
+                    // New follower: last car behind in lane t
+                    if (cursor[t] > begin) {
+                        unsigned int follower = index.order[cursor[t] - 1];
+                        float followerGap = z[car] - z[follower] - CAR_LENGTH;
+                        if (followerGap < IDM_MIN_GAP) continue;
+                        float before = idmAcceleration(speed[follower], desired[follower], index.gap[follower], index.closing[follower]);
+                        float after = idmAcceleration(speed[follower], desired[follower], followerGap, speed[follower] - speed[car]);
+                        if (after < -LANE_CHANGE_MAX_BRAKING) continue;
+                        gain += LANE_CHANGE_POLITENESS * (after - before);
+                    }
+                    if (gain > bestGain) {
+                        bestGain = gain;
+                        bestLane = t;
+                        bestGap = gap;
+                        bestClosing = closing;
+                    }
+                }
+
+                if (bestLane != l) {
+                    // Follows the new lane from this step; the index regroups it next step
+                    traffic.lane[car] = static_cast<unsigned char>(bestLane);
+                    index.gap[car] = bestGap;
+                    index.closing[car] = bestClosing;
+                    index.laneChanges++;
+                }
+            }
+        }
+    }
+}
+
+// Respawn random numbers: a Weyl sequence per car through an integer hash
+// (lowbias32), which needs only 32-bit adds, shifts, xors and multiplies and
+// so runs the same in the scalar and AVX2 kernels
+const unsigned int TRAFFIC_RNG_STEP = 0x9E3779B9u;
+const unsigned int TRAFFIC_FLIP_BELOW = 3355444; // 24-bit draws under this are a 1 in 5 chance
+
+static inline unsigned int trafficRandom(unsigned int x) {
+    x ^= x >> 16;
+    x *= 0x7FEB352Du;
+    x ^= x >> 15;
+    x *= 0x846CA68Bu;
+    x ^= x >> 16;
+    return x;
+}
+
+bool trafficUseAVX2 = false; // Set by selectTrafficKernel()
+
+// Accelerates cars [first, last) for their gaps, moves them, steers them
+// towards their lane and respawns the ones past the end of their stretch
+static void updateTrafficScalar(Traffic& traffic, const TrafficIndex& index, size_t first, size_t last, float deltaTime) {
+    if (first >= last) return;
+    float* x = &traffic.x[0];
+    float* z = &traffic.z[0];
+    float* speed = &traffic.speed[0];
+    float* desired = &traffic.desired[0];
+    const float* startZ = &traffic.startZ[0];
+    const float* endZ = &traffic.endZ[0];
+    const float* gap = &index.gap[0];
+    const float* closing = &index.closing[0];
+    const unsigned char* lane = &traffic.lane[0];
+    unsigned int* rng = &traffic.rng[0];
+    unsigned char* isBlue = &traffic.isBlue[0];
+    const float lateral = LANE_CHANGE_SPEED * deltaTime;
+    for (size_t i = first; i < last; i++) {
+        float accel = idmAcceleration(speed[i], desired[i], gap[i], closing[i]);
+        float carSpeed = maxOf(speed[i] + accel * deltaTime, 0.0f);
+        speed[i] = carSpeed;
+        float carZ = z[i] + carSpeed * deltaTime;
+
+        float drift = laneCenter(lane[i]) - x[i];
+        x[i] += minOf(maxOf(drift, -lateral), lateral);
+
+        // Reset position when car goes too far
+        if (carZ > endZ[i]) {
+            carZ = startZ[i];
+            unsigned int speedState = rng[i] + TRAFFIC_RNG_STEP;
+            unsigned int flipState = speedState + TRAFFIC_RNG_STEP;
+            rng[i] = flipState;
+            float unit = static_cast<float>(trafficRandom(speedState) >> 8) * (1.0f / 16777216.0f);
+            desired[i] = 15.0f + unit * 10.0f;
+
+            // 20% chance to switch color when respawning
+            if ((trafficRandom(flipState) >> 8) < TRAFFIC_FLIP_BELOW) {
+                isBlue[i] ^= 1;
+            }
+        }
+        z[i] = carZ;
+    }
+}
+
+#ifdef RETRO_AVX2_KERNELS
+RETRO_TARGET_AVX2
+static inline __m256i trafficRandom8(__m256i x) {
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32(0x7FEB352D));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 15));
+    x = _mm256_mullo_epi32(x, _mm256_set1_epi32(static_cast<int>(0x846CA68Bu)));
+    x = _mm256_xor_si256(x, _mm256_srli_epi32(x, 16));
+    return x;
+}
+
+// Same arithmetic as updateTrafficScalar, 8 cars per iteration. Respawns are
+// rare, so their lanes are computed only when some car in the group needs one.
+RETRO_TARGET_AVX2
+static void updateTrafficAVX2(Traffic& traffic, const TrafficIndex& index, float deltaTime) {
+    size_t count = traffic.size();
+    size_t vectorEnd = count & ~static_cast<size_t>(7);
+    if (vectorEnd > 0) {
+        float* x = &traffic.x[0];
+        float* z = &traffic.z[0];
+        float* speed = &traffic.speed[0];
+        float* desired = &traffic.desired[0];
+        const float* startZ = &traffic.startZ[0];
+        const float* endZ = &traffic.endZ[0];
+        const float* gap = &index.gap[0];
+        const float* closing = &index.closing[0];
+        const unsigned char* lane = &traffic.lane[0];
+        unsigned int* rng = &traffic.rng[0];
+
+        const __m256 dt = _mm256_set1_ps(deltaTime);
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 one = _mm256_set1_ps(1.0f);
+        const __m256 lateral = _mm256_set1_ps(LANE_CHANGE_SPEED * deltaTime);
+        const __m256 negLateral = _mm256_set1_ps(-(LANE_CHANGE_SPEED * deltaTime));
+        const __m256i step = _mm256_set1_epi32(static_cast<int>(TRAFFIC_RNG_STEP));
+        for (size_t i = 0; i < vectorEnd; i += 8) {
+            // idmAcceleration
+            __m256 carSpeed = _mm256_load_ps(speed + i);
+            __m256 ratio = _mm256_div_ps(carSpeed, _mm256_load_ps(desired + i));
+            __m256 ratio2 = _mm256_mul_ps(ratio, ratio);
+            __m256 headway = _mm256_add_ps(_mm256_mul_ps(carSpeed, _mm256_set1_ps(IDM_HEADWAY)),
+                                           _mm256_mul_ps(_mm256_mul_ps(carSpeed, _mm256_load_ps(closing + i)),
+                                                         _mm256_set1_ps(IDM_BRAKE_SCALE)));
+            __m256 wanted = _mm256_add_ps(_mm256_set1_ps(IDM_MIN_GAP), _mm256_max_ps(zero, headway));
+            __m256 pressure = _mm256_div_ps(wanted, _mm256_max_ps(_mm256_load_ps(gap + i), _mm256_set1_ps(IDM_GAP_FLOOR)));
+            __m256 push = _mm256_sub_ps(_mm256_sub_ps(one, _mm256_mul_ps(ratio2, ratio2)), _mm256_mul_ps(pressure, pressure));
+            __m256 accel = _mm256_max_ps(_mm256_mul_ps(_mm256_set1_ps(IDM_ACCELERATION), push), _mm256_set1_ps(-IDM_MAX_BRAKING));
+
+            carSpeed = _mm256_max_ps(_mm256_add_ps(carSpeed, _mm256_mul_ps(accel, dt)), zero);
+            _mm256_store_ps(speed + i, carSpeed);
+            __m256 carZ = _mm256_add_ps(_mm256_load_ps(z + i), _mm256_mul_ps(carSpeed, dt));
+
+            // laneCenter, then at most LANE_CHANGE_SPEED sideways
+            __m128i lanes8 = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(lane + i));
+            __m256 laneF = _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(lanes8));
+            __m256 center = _mm256_sub_ps(_mm256_mul_ps(_mm256_add_ps(laneF, _mm256_set1_ps(0.5f)), _mm256_set1_ps(LANE_WIDTH)),
+                                          _mm256_set1_ps(8.0f));
+            __m256 carX = _mm256_load_ps(x + i);
+            __m256 drift = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(center, carX), negLateral), lateral);
+            _mm256_store_ps(x + i, _mm256_add_ps(carX, drift));
+
+            __m256 past = _mm256_cmp_ps(carZ, _mm256_load_ps(endZ + i), _CMP_GT_OQ);
+            int respawned = _mm256_movemask_ps(past);
+            if (respawned != 0) {
+                carZ = _mm256_blendv_ps(carZ, _mm256_load_ps(startZ + i), past);
+
+                __m256i state = _mm256_load_si256(reinterpret_cast<const __m256i*>(rng + i));
+                __m256i speedState = _mm256_add_epi32(state, step);
+                __m256i flipState = _mm256_add_epi32(speedState, step);
+                __m256i pastMask = _mm256_castps_si256(past);
+                _mm256_store_si256(reinterpret_cast<__m256i*>(rng + i), _mm256_blendv_epi8(state, flipState, pastMask));
+
+                __m256 unit = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_srli_epi32(trafficRandom8(speedState), 8)),
+                                            _mm256_set1_ps(1.0f / 16777216.0f));
+                __m256 newDesired = _mm256_add_ps(_mm256_set1_ps(15.0f), _mm256_mul_ps(unit, _mm256_set1_ps(10.0f)));
+                _mm256_store_ps(desired + i, _mm256_blendv_ps(_mm256_load_ps(desired + i), newDesired, past));
+
+                __m256i flip = _mm256_cmpgt_epi32(_mm256_set1_epi32(static_cast<int>(TRAFFIC_FLIP_BELOW)),
+                                                  _mm256_srli_epi32(trafficRandom8(flipState), 8));
+                int flipped = respawned & _mm256_movemask_ps(_mm256_castsi256_ps(flip));
+                for (int car = 0; car < 8; car++) {
+                    if (flipped & (1 << car)) traffic.isBlue[i + car] ^= 1;
+                }
+            }
+            _mm256_store_ps(z + i, carZ);
+        }
+    }
+    updateTrafficScalar(traffic, index, vectorEnd, count, deltaTime);
+}
+
+static bool cpuHasAVX2() {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuid(info, 1);
+    bool osSavesYmm = (info[2] & (1 << 27)) != 0 && (_xgetbv(0) & 6) == 6;
+    __cpuidex(info, 7, 0);
+    return osSavesYmm && (info[1] & (1 << 5)) != 0;
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+// --traffic-kernel auto|avx2|scalar; AVX2 only where the CPU has it
+void selectTrafficKernel(const char* name) {
+    trafficUseAVX2 = false;
+#ifdef RETRO_AVX2_KERNELS
+    if (strcmp(name, "scalar") != 0) {
+        trafficUseAVX2 = cpuHasAVX2();
+        if (!trafficUseAVX2 && strcmp(name, "avx2") == 0) {
+            std::cerr << "AVX2 not supported, using the scalar traffic kernel" << std::endl;
+        }
+    }
+#else
+    (void)name;
+#endif
+}
+
+// One traffic step: index the lanes, find each car's leader, decide lane
+// changes, then run the kernel over all cars. The lanes are sorted again
+// afterwards: the player's collision binary searches them, and moved or
+// respawned cars would otherwise sit out of z order until the next step.
+// The sort at the start then only has work when chunks came or went.
+void updateTraffic(Traffic& traffic, TrafficIndex& index, float deltaTime) {
+    sortTrafficLanes(traffic, index);
+    findCarsAhead(traffic, index);
+    changeLanes(traffic, index);
+    traffic.step++;
+#ifdef RETRO_AVX2_KERNELS
+    if (trafficUseAVX2) {
+        updateTrafficAVX2(traffic, index, deltaTime);
+    } else {
+        updateTrafficScalar(traffic, index, 0, traffic.size(), deltaTime);
+    }
+#else
+    updateTrafficScalar(traffic, index, 0, traffic.size(), deltaTime);
+#endif
+    sortTrafficLanes(traffic, index);
+}
+
+// Player car handling. The engine pulls towards a top speed, drag slows
+// the car, and grip bleeds off sideways sliding; with the handbrake grip
+// drops and the car drifts.
+const float PLAYER_HALF_WIDTH = 1.0f;
+const float PLAYER_HALF_LENGTH = 2.0f;
+const float PLAYER_ENGINE = 28.0f;          // Units/s^2 from standstill
+const float PLAYER_TOP_SPEED = 45.0f;
+const float PLAYER_BOOST_ENGINE = 55.0f;
+const float PLAYER_BOOST_TOP_SPEED = 75.0f;
+const float PLAYER_BRAKE = 60.0f;
+const float PLAYER_REVERSE = 12.0f;
+const float PLAYER_REVERSE_SPEED = 12.0f;
+const float PLAYER_DRAG = 0.3f;             // Fraction of speed lost per second
+const float PLAYER_HANDBRAKE_DRAG = 0.8f;
+const float PLAYER_GRIP = 10.0f;            // Sideways speed lost per second, as a rate
+const float PLAYER_DRIFT_GRIP = 1.2f;
+const float PLAYER_DRIFT_SLIP = 4.0f;       // Sideways speed that counts as drifting
+const float PLAYER_STEER_RATE = 2.4f;       // Yaw rate at full lock, radians/s
+const float PLAYER_DRIFT_STEER = 1.4f;      // Extra rotation with the handbrake
+const float PLAYER_STEER_RESPONSE = 10.0f;  // How fast the yaw rate follows the wheel
+const float PLAYER_BOOST_DRAIN = 0.5f;      // Boost meter per second
+const float PLAYER_BOOST_REFILL = 0.15f;
+const float PLAYER_RESTITUTION = 0.3f;      // Bounce off whatever it hits
+const float PLAYER_SWEEP_MARGIN = 1.0f;     // Traffic moved since its lanes were sorted
+
+struct BoxNearerZ {
+    bool operator()(const CollisionBox& box, float z) const { return box.minZ < z; }
+    bool operator()(const CollisionBox& a, const CollisionBox& b) const { return a.minZ < b.minZ; }
+};
+
+// Traffic order entries against a z, for binary searches in a lane
+struct CarBeforeZ {
+    const float* z;
+    bool operator()(unsigned int car, float value) const { return z[car] < value; }
+};
+
+static void integratePlayer(PlayerCar& car, float deltaTime) {
+    const PlayerInput& input = car.input;
+    float forwardX = sinf(car.heading), forwardZ = -cosf(car.heading);
+    float rightX = cosf(car.heading), rightZ = sinf(car.heading);
+    float forward = car.velocityX * forwardX + car.velocityZ * forwardZ;
+    float sideways = car.velocityX * rightX + car.velocityZ * rightZ;
+
+    bool boosting = input.boost && input.throttle > 0.0f && car.boost > 0.0f;
+    if (boosting) {
+        car.boost = std::max(0.0f, car.boost - PLAYER_BOOST_DRAIN * deltaTime);
+    } else {
+        car.boost = std::min(1.0f, car.boost + PLAYER_BOOST_REFILL * deltaTime);
+    }
+    float engine = boosting ? PLAYER_BOOST_ENGINE : PLAYER_ENGINE;
+    float topSpeed = boosting ? PLAYER_BOOST_TOP_SPEED : PLAYER_TOP_SPEED;
+    float accel = input.throttle * engine * std::max(0.0f, 1.0f - forward / topSpeed);
+    if (forward > 0.5f) {
+        accel -= input.brake * PLAYER_BRAKE;
+    } else if (forward > -PLAYER_REVERSE_SPEED) {
+        accel -= input.brake * PLAYER_REVERSE;
+    }
+    forward += accel * deltaTime;
+    forward -= forward * (input.handbrake ? PLAYER_HANDBRAKE_DRAG : PLAYER_DRAG) * deltaTime;
+
+    // Sideways speed the tires can't hold on to is the drift
+    float grip = input.handbrake ? PLAYER_DRIFT_GRIP : PLAYER_GRIP;
+    sideways -= sideways * std::min(1.0f, grip * deltaTime);
+    car.drifting = fabsf(sideways) > PLAYER_DRIFT_SLIP;
+
+    // Steering needs the wheels to roll, and reverses with them
+    float rolling = std::min(1.0f, fabsf(forward) / 8.0f) * (forward < 0.0f ? -1.0f : 1.0f);
+    float targetYaw = input.steer * PLAYER_STEER_RATE * rolling * (input.handbrake ? PLAYER_DRIFT_STEER : 1.0f);
+    car.yawRate += (targetYaw - car.yawRate) * std::min(1.0f, PLAYER_STEER_RESPONSE * deltaTime);
+
+    // The velocity stays in the world; turning the body under it is what
+    // makes the next step see a sideways component
+    car.velocityX = forwardX * forward + rightX * sideways;
+    car.velocityZ = forwardZ * forward + rightZ * sideways;
+    car.x += car.velocityX * deltaTime;
+    car.z += car.velocityZ * deltaTime;
+    car.heading += car.yawRate * deltaTime;
+    if (car.heading < 0.0f) car.heading += TWO_PI;
+    if (car.heading >= TWO_PI) car.heading -= TWO_PI;
+}
+
+// Player's box extents along x and z, for the broadphase
+static void playerBounds(const PlayerCar& car, CollisionBox& bounds) {
+    float forwardX = sinf(car.heading), forwardZ = -cosf(car.heading);
+    float extentX = PLAYER_HALF_LENGTH * fabsf(forwardX) + PLAYER_HALF_WIDTH * fabsf(forwardZ);
+    float extentZ = PLAYER_HALF_LENGTH * fabsf(forwardZ) + PLAYER_HALF_WIDTH * fabsf(forwardX);
+    bounds.minX = car.x - extentX;
+    bounds.maxX = car.x + extentX;
+    bounds.minZ = car.z - extentZ;
+    bounds.maxZ = car.z + extentZ;
+}
+
+// Separating axis test of the player's rotated box against an axis-aligned
+// one. On overlap, gives the shortest push that moves the player out.
+static bool collidePlayerBox(const PlayerCar& car, const CollisionBox& box, float& pushX, float& pushZ) {
+    float forwardX = sinf(car.heading), forwardZ = -cosf(car.heading);
+    const float axes[4][2] = { { 1.0f, 0.0f }, { 0.0f, 1.0f }, { forwardX, forwardZ }, { forwardZ, -forwardX } };
+    float halfX = (box.maxX - box.minX) * 0.5f, halfZ = (box.maxZ - box.minZ) * 0.5f;
+    float toBoxX = (box.minX + halfX) - car.x, toBoxZ = (box.minZ + halfZ) - car.z;
+
+    float best = 1e30f;
+    for (int a = 0; a < 4; a++) {
+        float ax = axes[a][0], az = axes[a][1];
+        float playerRadius = PLAYER_HALF_LENGTH * fabsf(forwardX * ax + forwardZ * az) +
+                             PLAYER_HALF_WIDTH * fabsf(forwardZ * ax - forwardX * az);
+        float boxRadius = halfX * fabsf(ax) + halfZ * fabsf(az);
+        float distance = toBoxX * ax + toBoxZ * az;
+        float overlap = playerRadius + boxRadius - fabsf(distance);
+        if (overlap <= 0.0f) return false;
+        if (overlap < best) {
+            best = overlap;
+            float away = distance > 0.0f ? -overlap : overlap;
+            pushX = ax * away;
+            pushZ = az * away;
+        }
+    }
+    return true;
+}
+
+// Moves the player out of a contact and takes away the speed into it
+static void resolvePlayerContact(PlayerCar& car, float pushX, float pushZ, float otherVelocityX, float otherVelocityZ) {
+    float depth = sqrtf(pushX * pushX + pushZ * pushZ);
+    if (depth <= 0.0f) return;
+    float normalX = pushX / depth, normalZ = pushZ / depth;
+    car.x += pushX;
+    car.z += pushZ;
+    float closing = (car.velocityX - otherVelocityX) * normalX + (car.velocityZ - otherVelocityZ) * normalZ;
+    if (closing < 0.0f) {
+        car.velocityX -= (1.0f + PLAYER_RESTITUTION) * closing * normalX;
+        car.velocityZ -= (1.0f + PLAYER_RESTITUTION) * closing * normalZ;
+    }
+    car.contacts++;
+}
+
+// Sweep and prune along z against buildings and traffic. Building footprints are sorted per chunk and
+// traffic per lane, so each list is binary searched to the player's z range
+// and swept from there; x overlap prunes the rest before the box test. The
+// work follows the density around the player, not the size of the city.
+static void collidePlayer(PlayerCar& car, Traffic& traffic, const TrafficIndex& index) {
+    CollisionBox bounds;
+    playerBounds(car, bounds);
+    float pushX, pushZ;
+
+    for (int cz = chunkCoord(bounds.minZ); cz <= chunkCoord(bounds.maxZ); cz++) {
+        for (int cx = chunkCoord(bounds.minX); cx <= chunkCoord(bounds.maxX); cx++) {
+            ChunkColliders* const* colliders = buildingColliders.find(chunkKey(cx, cz));
+            if (!colliders) continue;
+            const std::vector<CollisionBox>& boxes = (*colliders)->boxes;
+            std::vector<CollisionBox>::const_iterator box =
+                std::lower_bound(boxes.begin(), boxes.end(), bounds.minZ - (*colliders)->maxDepth, BoxNearerZ());
+            for (; box != boxes.end() && box->minZ <= bounds.maxZ; ++box) {
+                car.swept++;
+                if (box->maxZ < bounds.minZ || box->maxX < bounds.minX || box->minX > bounds.maxX) continue;
+                car.tested++;
+                if (collidePlayerBox(car, *box, pushX, pushZ)) {
+                    resolvePlayerContact(car, pushX, pushZ, 0.0f, 0.0f);
+                    playerBounds(car, bounds);
+                }
+            }
+        }
+    }
+
+    if (traffic.size() != index.builtFor) return;
+    const float halfCar = CAR_LENGTH * 0.5f;
+    const float reach = halfCar + PLAYER_SWEEP_MARGIN;
+    CarBeforeZ before = { &traffic.z[0] };
+    for (size_t s = 0; s < index.stretches.size(); s++) {
+        const TrafficIndex::Stretch& stretch = index.stretches[s];
+        size_t first = stretch.first;
+        if (bounds.maxZ < traffic.startZ[first] - reach || bounds.minZ > traffic.endZ[first] + reach) continue;
+        for (int l = 0; l < TRAFFIC_LANES; l++) {
+            const unsigned int* begin = &index.order[0] + stretch.lanes[l];
+            const unsigned int* end = &index.order[0] + stretch.lanes[l + 1];
+            for (const unsigned int* p = std::lower_bound(begin, end, bounds.minZ - reach, before); p < end; p++) {
+                unsigned int i = *p;
+                float x = traffic.x[i], z = traffic.z[i];
+                if (z > bounds.maxZ + reach) break;
+                car.swept++;
+                if (z + halfCar < bounds.minZ || z - halfCar > bounds.maxZ ||
+                    x + 1.0f < bounds.minX || x - 1.0f > bounds.maxX) continue;
+                car.tested++;
+                CollisionBox box = { x - 1.0f, z - halfCar, x + 1.0f, z + halfCar };
+                if (collidePlayerBox(car, box, pushX, pushZ)) {
+                    // A car running into the player is stopped down to the
+                    // player's speed rather than shoving it along; the cars
+                    // behind brake for it as usual
+                    if (pushZ > 0.0f) traffic.speed[i] = std::min(traffic.speed[i], std::max(0.0f, car.velocityZ));
+                    resolvePlayerContact(car, pushX, pushZ, 0.0f, traffic.speed[i]);
+                    playerBounds(car, bounds);
+                }
+            }
+        }
+    }
+}
+
+void updatePlayer(SimState& state, float deltaTime) {
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    PlayerCar& car = state.player;
+    integratePlayer(car, deltaTime);
+    collidePlayer(car, state.traffic, trafficIndex);
+    car.ticks++;
+    car.physicsNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count();
+}
+
+// One fixed simulation step
+void updateSimulation(SimState& state, const FrameContext& tick) {
+    float currentTime = tick.time;
+    float deltaTime = tick.deltaTime;
+    state.time += deltaTime;
+    const MusicLevels& music = state.music;
+
+    // Update grid animation; the bass pushes it along
+    float gridSpeed = music.active ? 0.5f + 1.2f * music.bass : 0.8f;
+    state.gridOffset += gridSpeed * deltaTime;
+    if (state.gridOffset > 1.0f) state.gridOffset -= 1.0f;
+
+    // Update vortex angle; highs spin it up and beats kick it
+    float vortexSpeed = music.active ? 15.0f + 40.0f * music.high + 60.0f * music.beat
+                                     : 25.0f + 15.0f * sinf(currentTime * 0.2f);
+    state.vortexAngle += vortexSpeed * deltaTime;
+    if (state.vortexAngle > 360.0f) state.vortexAngle -= 360.0f;
+
+    // Update tunnel depth
+    state.tunnelDepth += 15.0f * deltaTime;
+    if (state.tunnelDepth > 10.0f) state.tunnelDepth -= 10.0f;
+
+    // Update spinner rotations
+    std::vector<Spinner>& spinners = state.spinners;
+    for (size_t i = 0; i < spinners.size(); i++) {
+        spinners[i].rotation += spinners[i].rotationSpeed * deltaTime;
+        if (spinners[i].rotation > 360.0f) spinners[i].rotation -= 360.0f;
+    }
+
+    // Update car movement
+    updateTraffic(state.traffic, trafficIndex, deltaTime);
+
+    // Player car, against the traffic as it is after this step
+    updatePlayer(state, deltaTime);
+
+    // Update building pulse effect for windows
+    state.buildingPulse = music.active ? 0.4f + 0.6f * music.mid + 0.3f * music.beat
+                                       : 0.7f + 0.3f * sinf(currentTime * 0.5f);
+}
+
+void keyboard(unsigned char key, int x, int y) {
+    float speed = 1.0f;
+    keysDown[tolower(key)] = true;
+    shiftDown = (glutGetModifiers() & GLUT_ACTIVE_SHIFT) != 0;
+
+    // Driving keys steer the car instead of the camera
+    if (chaseCamera && strchr("wasd ", tolower(key)) != NULL) {
+        return;
+    }
+
+    switch (key) {
+        case 27: // ESC key
+            exit(0);
+            break;
+        case 'c': // Chase camera or free camera
+            chaseCamera = !chaseCamera;
+            break;
+        case '\t': // Speed, boost and collision counters
+            showRaceStats = !showRaceStats;
+            break;
+        case 'w': // Move forward
+            cameraX += lookX * speed;
+            cameraZ += lookZ * speed;
+            break;
+        case 's': // Move backward
+            cameraX -= lookX * speed;
+            cameraZ -= lookZ * speed;
+            break;
+        case 'd': // Strafe left
+            cameraX -= lookZ * speed;
+            cameraZ += lookX * speed;
+            break;
+        case 'a': // Strafe right
+            cameraX += lookZ * speed;
+            cameraZ -= lookX * speed;
+            break;
+        case 'q': // Move up
+            cameraY += speed;
+            break;
+        case 'e': // Move down
+            cameraY -= speed;
+            break;
+        case 'p': // Toggle music playback
+            toggleMusicPause();
+            break;
+        case 'm': // Toggle the music-driven pulses
+            showMusicVisualization = !showMusicVisualization;
+            break;
+        case '+': // Increase volume
+            adjustMusicVolume(0.1f);
+            break;
+        case '-': // Decrease volume
+            adjustMusicVolume(-0.1f);
+            break;
+        case 'b': // Toggle bloom (replaces the glow passes)
+            bloom.enabled = !bloom.enabled;
+            if (bloom.enabled && !bloom.available) {
+                std::cout << "Bloom needs shaders and framebuffer objects" << std::endl;
+            }
+            break;
+        case 'v': // Adaptive quality or the top level
+            toggleQualityGovernor();
+            break;
+        case 'o': // Toggle the overdraw heatmap
+            overdraw.enabled = !overdraw.enabled;
+            break;
+        case 'g': // Toggle frame-time graph
+            profiler.showOverlay = !profiler.showOverlay;
+            break;
+        case 't': // Dump the recorded frames as a Chrome trace
+            if (writeChromeTrace("retrowave_trace.json")) {
+                std::cout << "Trace written to retrowave_trace.json" << std::endl;
+            }
+            break;
+    }
+    glutPostRedisplay();
+}
+
+void keyboardUp(unsigned char key, int x, int y) {
+    keysDown[tolower(key)] = false;
+    shiftDown = (glutGetModifiers() & GLUT_ACTIVE_SHIFT) != 0;
+}
+
+void specialKeys(int key, int x, int y) {
+    float rotationSpeed = 0.05f;
+    specialKeysDown[key & 0xFF] = true;
+    shiftDown = (glutGetModifiers() & GLUT_ACTIVE_SHIFT) != 0;
+    if (chaseCamera) {
+        return;
+    }
+
+    switch (key) {
+        case GLUT_KEY_UP:
+            lookY += rotationSpeed;
+            break;
+        case GLUT_KEY_DOWN:
+            lookY -= rotationSpeed;
+            break;
+        case GLUT_KEY_LEFT:
+            {
+                float tempX = lookX;
+                lookX = lookX * cosf(rotationSpeed) - lookZ * sinf(rotationSpeed);
+                lookZ = tempX * sinf(rotationSpeed) + lookZ * cosf(rotationSpeed);
+            }
+            break;
+        case GLUT_KEY_RIGHT:
+            {
+                float tempX = lookX;
+                lookX = lookX * cosf(-rotationSpeed) - lookZ * sinf(-rotationSpeed);
+                lookZ = tempX * sinf(-rotationSpeed) + lookZ * cosf(-rotationSpeed);
+            }
+            break;
+    }
+
+    // Normalize look vector
+    float length = sqrt(lookX * lookX + lookY * lookY + lookZ * lookZ);
+    lookX /= length;
+    lookY /= length;
+    lookZ /= length;
+
+    glutPostRedisplay();
+}
+
+void specialKeysUp(int key, int x, int y) {
+    specialKeysDown[key & 0xFF] = false;
+    shiftDown = (glutGetModifiers() & GLUT_ACTIVE_SHIFT) != 0;
+}
+
+// The bench's driver. Pinned against a wall it backs off for a moment,
+// swinging its nose towards the middle of the road.
+struct BenchDriver {
+    long long contacts;  // Player contacts seen at the last frame
+    float reverseUntil;
+};
+
+BenchDriver benchDriver = BenchDriver();
+
+// True if a car is within range ahead of a line at x, both driving +z
+static bool benchLaneBlocked(const PlayerCar& car, float x, float range) {
+    const Traffic& traffic = simRender.traffic;
+    for (size_t i = 0; i < traffic.size(); i++) {
+        float ahead = traffic.z[i] - car.z;
+        if (ahead > 0.0f && ahead < range && fabsf(traffic.x[i] - x) < 2.5f) return true;
+    }
+    return false;
+}
+
+// Keys (or the bench's scripted lap) to controls. Shift only shows up as a
+// modifier of other keys, except on freeglut, which reports it on its own.
+PlayerInput readPlayerInput(const FrameContext& frame) {
+    PlayerInput input = PlayerInput();
+    if (benchMode) {
+        // Turn around into the flow of traffic, then weave across its lanes
+        // and out to the building line, swerving past cars where a lane is
+        // free and boosting and drifting now and then
+        const PlayerCar& car = simRender.player;
+        BenchDriver& driver = benchDriver;
+        float time = frame.time;
+        float forward = car.velocityX * sinf(car.heading) - car.velocityZ * cosf(car.heading);
+        if (forward < 2.0f && car.contacts != driver.contacts && time >= driver.reverseUntil + 1.0f) {
+            driver.reverseUntil = time + 0.6f;
+        }
+        driver.contacts = car.contacts;
+
+        // From the far traffic lane out to overlapping the buildings' edge
+        float line = buildingLineX();
+        float weaveX = (8.0f - line) * 0.5f + (8.0f + line) * 0.5f * sinf(time * 0.6f);
+        float wantX = weaveX;
+        const float swerves[4] = { -LANE_WIDTH, LANE_WIDTH, -2.0f * LANE_WIDTH, 2.0f * LANE_WIDTH };
+        for (int k = 0; k < 4 && benchLaneBlocked(car, wantX, 8.0f); k++) {
+            float x = std::max(-line, std::min(8.0f, weaveX + swerves[k]));
+            if (!benchLaneBlocked(car, x, 8.0f)) wantX = x;
+        }
+        // Facing +z is a heading of pi, and right turns move towards -x
+        float error = static_cast<float>(M_PI) - atan2f(wantX - car.x, 10.0f) - car.heading;
+        if (error > static_cast<float>(M_PI)) error -= TWO_PI;
+        if (error < -static_cast<float>(M_PI)) error += TWO_PI;
+        float steer = std::max(-1.0f, std::min(1.0f, 2.0f * error));
+        if (time < driver.reverseUntil) {
+            input.brake = 1.0f;
+            input.steer = -steer;
+            return input;
+        }
+        float phase = fmodf(time, 6.0f);
+        input.throttle = 1.0f;
+        input.steer = steer;
+        input.handbrake = phase > 5.0f;
+        input.boost = phase < 1.5f;
+        return input;
+    }
+    if (!chaseCamera) {
+        return input;
+    }
+
+    bool shift = shiftDown;
+#ifdef GLUT_KEY_SHIFT_L
+    shift = shift || specialKeysDown[GLUT_KEY_SHIFT_L & 0xFF] || specialKeysDown[GLUT_KEY_SHIFT_R & 0xFF];
+#endif
+    bool left = keysDown['a'] || specialKeysDown[GLUT_KEY_LEFT];
+    bool right = keysDown['d'] || specialKeysDown[GLUT_KEY_RIGHT];
+    input.throttle = keysDown['w'] || specialKeysDown[GLUT_KEY_UP] ? 1.0f : 0.0f;
+    input.brake = keysDown['s'] || specialKeysDown[GLUT_KEY_DOWN] ? 1.0f : 0.0f;
+    input.steer = (right ? 1.0f : 0.0f) - (left ? 1.0f : 0.0f);
+    input.handbrake = keysDown[' '];
+    input.boost = shift;
+    return input;
+}
+
+// Eases the camera to a point behind and above the car, looking past it
+void updateChaseCamera(const FrameContext& frame) {
+    const PlayerCar& car = simRender.player;
+    float forwardX = sinf(car.heading), forwardZ = -cosf(car.heading);
+    float follow = 1.0f - expf(-6.0f * frame.deltaTime);
+    cameraX += (car.x - forwardX * 10.0f - cameraX) * follow;
+    cameraY += (4.0f - cameraY) * follow;
+    cameraZ += (car.z - forwardZ * 10.0f - cameraZ) * follow;
+
+    float targetX = car.x + forwardX * 8.0f - cameraX;
+    float targetY = 1.0f - cameraY;
+    float targetZ = car.z + forwardZ * 8.0f - cameraZ;
+    float length = sqrtf(targetX * targetX + targetY * targetY + targetZ * targetZ);
+    if (length > 0.0f) {
+        lookX = targetX / length;
+        lookY = targetY / length;
+        lookZ = targetZ / length;
+    }
+}
+
+// Gribb-Hartmann plane extraction from projection * modelview
+void updateViewFrustum() {
+    GLfloat projection[16], modelview[16], clip[16];
+    glGetFloatv(GL_PROJECTION_MATRIX, projection);
+    glGetFloatv(GL_MODELVIEW_MATRIX, modelview);
+
+    // Column-major clip = projection * modelview
+    for (int c = 0; c < 4; c++) {
+        for (int r = 0; r < 4; r++) {
+            clip[c * 4 + r] = projection[0 * 4 + r] * modelview[c * 4 + 0] +
+                              projection[1 * 4 + r] * modelview[c * 4 + 1] +
+                              projection[2 * 4 + r] * modelview[c * 4 + 2] +
+                              projection[3 * 4 + r] * modelview[c * 4 + 3];
+        }
+    }
+
+    // Left, right, bottom, top, near, far: row 3 plus or minus rows 0, 1, 2
+    for (int p = 0; p < 6; p++) {
+        int row = p / 2;
+        float sign = (p % 2 == 0) ? 1.0f : -1.0f;
+        float* plane = viewFrustum.planes[p];
+        for (int k = 0; k < 4; k++) {
+            plane[k] = clip[k * 4 + 3] + sign * clip[k * 4 + row];
+        }
+        float length = sqrtf(plane[0] * plane[0] + plane[1] * plane[1] + plane[2] * plane[2]);
+        for (int k = 0; k < 4; k++) {
+            plane[k] /= length;
+        }
+    }
+
+    memset(&cullStats, 0, sizeof(cullStats));
+}
+
+static bool beyondDrawDistance(float cx, float cy, float cz, float radius) {
+    float dx = cx - cameraX, dy = cy - cameraY, dz = cz - cameraZ;
+    float limit = MAX_DRAW_DISTANCE + radius;
+    return dx * dx + dy * dy + dz * dz > limit * limit;
+}
+
+// Axis-aligned box given by center and half extents
+bool boxVisible(float cx, float cy, float cz, float ex, float ey, float ez, CullCategory category, CullStats& stats) {
+    bool visible = !beyondDrawDistance(cx, cy, cz, sqrtf(ex * ex + ey * ey + ez * ez));
+    for (int p = 0; p < 6 && visible; p++) {
+        const float* plane = viewFrustum.planes[p];
+        float distance = plane[0] * cx + plane[1] * cy + plane[2] * cz + plane[3];
+        float reach = ex * fabsf(plane[0]) + ey * fabsf(plane[1]) + ez * fabsf(plane[2]);
+        if (distance < -reach) visible = false;
+    }
+
+    if (visible) stats.drawn[category]++;
+    else stats.culled[category]++;
+    return visible;
+}
+
+bool sphereVisible(float cx, float cy, float cz, float radius, CullCategory category, CullStats& stats) {
+    bool visible = !beyondDrawDistance(cx, cy, cz, radius);
+    for (int p = 0; p < 6 && visible; p++) {
+        const float* plane = viewFrustum.planes[p];
+        if (plane[0] * cx + plane[1] * cy + plane[2] * cz + plane[3] < -radius) visible = false;
+    }
+
+    if (visible) stats.drawn[category]++;
+    else stats.culled[category]++;
+    return visible;
+}
+
+// Baked building geometry, filled once per chunk by bakeBuildingGeometry()
+// and drawn with vertex arrays. Only roof height and, without shaders,
+// window alpha change per frame.
+struct BuildingGeometryCache {
+    std::vector<GLfloat> edgeVertices;       // GL_LINES, 20 vertices per building
+    std::vector<GLfloat> edgeGlowVertices;   // GL_LINES, 6 vertices per building
+    std::vector<GLfloat> windowVertices;     // Shader path, 4 WINDOW_VERTEX_FLOATS vertices per window
+    std::vector<GLfloat> outlineVertices;    // GL_QUADS, black window frames
+    std::vector<GLfloat> innerVertices;      // GL_QUADS, lit window panes
+    std::vector<GLfloat> innerColors;        // RGBA per inner vertex
+    std::vector<GLfloat> glowVertices;       // GL_QUADS, window glow
+    std::vector<GLfloat> glowColors;         // RGBA per glow vertex
+    std::vector<float> windowWeight;         // centerFactor * heightFactor
+    std::vector<bool> windowBlinks;
+    std::vector<int> windowStart;            // First window of each building, plus an end entry
+};
+
+// Window vertex: quad corner x, y, then the per-window attributes repeated
+// on all four corners: facade center x, y, z, window width, color index,
+// weight, blinks
+const int WINDOW_VERTEX_FLOATS = 9;
+
+// Windows expanded and animated in the vertex shader from per-window
+// attributes; without shaders the baked quads in BuildingGeometryCache are used
+struct WindowRenderer {
+    GLuint program;
+    GLint timeLocation;
+    GLint passLocation;
+    GLint musicPulseLocation;
+    GLint windowLocation;
+    GLint styleLocation;
+};
+
+WindowRenderer windowRenderer = { 0, -1, -1, -1, -1, -1 };
+
+// Vertices (per building) that sit on the roof and follow the height wobble
+const int EDGE_VERTS_PER_BUILDING = 20;
+const int EDGE_GLOW_VERTS_PER_BUILDING = 6;
+const int edgeRoofVertices[] = { 1, 3, 6, 7, 9, 11, 14, 15, 16, 17, 18, 19 };
+const int edgeGlowRoofVertices[] = { 1, 3, 4, 5 };
+
+static void pushVertex(std::vector<GLfloat>& v, float x, float y, float z) {
+    v.push_back(x);
+    v.push_back(y);
+    v.push_back(z);
+}
+
+static void pushQuad(std::vector<GLfloat>& v, float x0, float y0, float x1, float y1, float z) {
+    pushVertex(v, x0, y0, z);
+    pushVertex(v, x1, y0, z);
+    pushVertex(v, x1, y1, z);
+    pushVertex(v, x0, y1, z);
+}
+
+static void pushQuadColor(std::vector<GLfloat>& c, float r, float g, float b) {
+    for (int i = 0; i < 4; i++) {
+        c.push_back(r);
+        c.push_back(g);
+        c.push_back(b);
+        c.push_back(0.0f); // Alpha is written per frame
+    }
+}
+
+// Touches no GL state, so chunks are baked on the streaming thread
+void bakeBuildingGeometry(const std::vector<Building>& buildings, BuildingGeometryCache& cache) {
+    cache = BuildingGeometryCache();
+
+    // Set window colors - use only classic retrowave colors
+    const int numColors = 3;
+    float colors[numColors][3] = {
+        {0.0f, 0.9f, 1.0f},  // Brighter Cyan/Teal
+        {1.0f, 0.8f, 0.0f},  // Golden/Orange
+        {1.0f, 0.3f, 0.7f}   // Hot Pink/Magenta
+    };
+
+    for (size_t b = 0; b < buildings.size(); b++) {
+        const Building& building = buildings[b];
+        float x = building.x;
+        float z = building.z;
+        float width = building.width;
+        float height = building.height;
+        float halfWidth = width / 2.0f;
+        float halfDepth = building.depth / 2.0f;
+        float left = x - halfWidth;
+        float right = x + halfWidth;
+        float front = z + halfDepth;
+        float back = z - halfDepth;
+
+        // Neon edges (roof vertices get their wobble in drawBuildings)
+        std::vector<GLfloat>& e = cache.edgeVertices;
+        pushVertex(e, left, 0.0f, front);  pushVertex(e, left, height, front);
+        pushVertex(e, right, 0.0f, front); pushVertex(e, right, height, front);
+        pushVertex(e, left, 0.0f, front);  pushVertex(e, right, 0.0f, front);
+        pushVertex(e, left, height, front); pushVertex(e, right, height, front);
+        pushVertex(e, left, 0.0f, back);   pushVertex(e, left, height, back);
+        pushVertex(e, right, 0.0f, back);  pushVertex(e, right, height, back);
+        pushVertex(e, left, 0.0f, back);   pushVertex(e, right, 0.0f, back);
+        pushVertex(e, left, height, back);  pushVertex(e, right, height, back);
+        pushVertex(e, left, height, front); pushVertex(e, left, height, back);
+        pushVertex(e, right, height, front); pushVertex(e, right, height, back);
+
+        // Front edges redrawn as glow
+        std::vector<GLfloat>& g = cache.edgeGlowVertices;
+        pushVertex(g, left, 0.0f, front);  pushVertex(g, left, height, front);
+        pushVertex(g, right, 0.0f, front); pushVertex(g, right, height, front);
+        pushVertex(g, left, height, front); pushVertex(g, right, height, front);
+
+        // Calculate perfect grid for windows
+        int numFloors = static_cast<int>(height / 2.5f);
+        int windowsPerFloor = static_cast<int>(width / 1.2f);
+
+        // Ensure minimum number of windows
+        numFloors = std::max(numFloors, 3);
+        windowsPerFloor = std::max(windowsPerFloor, 2);
+
+        // Window properties
+        float windowWidth = width / (windowsPerFloor + 1);
+        float windowHeight = windowWidth * 1.5f; // Rectangular windows
+        float floorHeight = (height - 2.0f) / numFloors;
+        float margin = windowWidth * 0.15f;
+        float glowSize = windowWidth * 2.0f;
+
+        // Determine color palette for this building based on its position
+        int buildingColorScheme = static_cast<int>(fabs(x * 1000)) % numColors;
+        cache.windowStart.push_back(static_cast<int>(cache.windowWeight.size()));
+        bool shaded = windowRenderer.program != 0;
+
+        for (int floor = 0; floor < numFloors; floor++) {
+            float floorY = 2.0f + floor * floorHeight;
+
+            for (int w = 0; w < windowsPerFloor; w++) {
+                float windowX = x - halfWidth + (width / (windowsPerFloor + 1)) * (w + 1);
+                float windowY = floorY + floorHeight * 0.5f;
+
+                // Skip some windows randomly but consistently for this building (based on position)
+                int hash = static_cast<int>((windowX * 100 + windowY * 50 + x * z * 10) * 10) % 10;
+                if (hash < 3 && floor > 0) continue; // 30% chance of missing window except on first floor
+
+                int colorIndex = (buildingColorScheme + floor) % numColors;
+                float centerFactor = 1.0f - 2.0f * fabs((w + 0.5f) / windowsPerFloor - 0.5f); // 0-1-0 across building
+                float heightFactor = 1.0f - (float)floor / numFloors * 0.3f; // brighter at bottom
+                float weight = centerFactor * heightFactor;
+                const float* c = colors[colorIndex];
+
+                cache.windowWeight.push_back(weight);
+                cache.windowBlinks.push_back(hash == 8); // 10% chance of blinking window
+
+                if (shaded) {
+                    static const float cornerX[4] = { -1.0f, 1.0f, 1.0f, -1.0f };
+                    static const float cornerY[4] = { -1.0f, -1.0f, 1.0f, 1.0f };
+                    for (int v = 0; v < 4; v++) {
+                        GLfloat vertex[WINDOW_VERTEX_FLOATS] = {
+                            cornerX[v], cornerY[v], windowX, windowY, front, windowWidth,
+                            static_cast<GLfloat>(colorIndex), weight, hash == 8 ? 1.0f : 0.0f
+                        };
+                        cache.windowVertices.insert(cache.windowVertices.end(), vertex, vertex + WINDOW_VERTEX_FLOATS);
+                    }
+                    continue;
+                }
+
+                pushQuad(cache.outlineVertices,
+                         windowX - windowWidth/2, windowY - windowHeight/2,
+                         windowX + windowWidth/2, windowY + windowHeight/2, front + 0.01f);
+
+                // Additive blending adds rgb * alpha, so the static weight lives in
+                // the pane color and the animated intensity goes into alpha
+                pushQuad(cache.innerVertices,
+                         windowX - windowWidth/2 + margin, windowY - windowHeight/2 + margin,
+                         windowX + windowWidth/2 - margin, windowY + windowHeight/2 - margin, front + 0.02f);
+                pushQuadColor(cache.innerColors, c[0] * weight, c[1] * weight, c[2] * weight);
+
+                pushQuad(cache.glowVertices,
+                         windowX - glowSize/2, windowY - glowSize/2,
+                         windowX + glowSize/2, windowY + glowSize/2, front + 0.015f);
+                pushQuadColor(cache.glowColors, c[0], c[1], c[2]);
+            }
+        }
+    }
+    cache.windowStart.push_back(static_cast<int>(cache.windowWeight.size()));
+}
+
+// Infinite city, split into square chunks generated around the camera.
+// Chunk content depends only on the world seed and chunk coordinates.
+// Lot size, density, traffic, radius and budget come from the scene config.
+const float AVENUE_HALF_WIDTH = 12.0f;   // Traffic avenue along z at x = 0
+
+// Visible buildings are drawn as runs of consecutive buildings: one draw
+// call per run and pass instead of one per building
+struct BuildingRun {
+    int first, last; // [first, last)
+};
+
+struct CityChunk {
+    int cx, cz;
+    float maxHeight;
+    std::vector<Building> buildings;
+    BuildingGeometryCache geometry;
+    Traffic* traffic;           // Built by the worker and handed to the simulation on arrival; NULL without cars
+    ChunkColliders* colliders;  // Building footprints, handed over with the traffic; NULL without buildings
+    bool simulated;             // The simulation holds this chunk's cars or footprints
+    GLuint windowBuffer;        // Shader path window vertices, uploaded on first draw
+    std::vector<BuildingRun> visibleRuns; // This frame's, read by its queued draws
+
+    CityChunk() : traffic(NULL), colliders(NULL), simulated(false) {}
+    ~CityChunk() {
+        delete traffic;
+        delete colliders;
+    }
+};
+
+// A resident chunk and its neighbors in the LRU order
+struct ChunkSlot {
+    CityChunk* chunk;
+    int newer, older; // Slots, -1 at the ends; older links the free slots
+};
+
+const int CHUNK_QUEUE_SIZE = 256;
+const int CHUNK_SLOT_SLACK = 64;  // Slots past the budget, for chunks arriving between evictions
+const int CHUNK_PENDING = -1;     // In ChunkStreamer::keys: requested, not yet delivered
+
+// The render thread owns everything except the queues and the worker. The
+// bookkeeping is sized from the chunk budget when streaming starts, so
+// chunks coming and going never touch the heap on the render thread; the
+// worker builds what the simulation gets and deletes evicted chunks.
+struct ChunkStreamer {
+    SpscQueue<long long, CHUNK_QUEUE_SIZE> requests;    // Render thread -> worker
+    SpscQueue<CityChunk*, CHUNK_QUEUE_SIZE> completed;  // Worker -> render thread
+    SpscQueue<CityChunk*, CHUNK_QUEUE_SIZE> retired;    // Render thread -> worker, to delete
+    std::atomic<bool> running;
+    std::thread worker;
+
+    std::vector<ChunkSlot> slots;
+    int newest, oldest;      // Ends of the LRU list
+    int freeSlot;            // First free slot, -1 when all are taken
+    int residentCount;
+    ChunkKeyMap<int> keys;   // Chunk key -> slot of a resident chunk, or CHUNK_PENDING
+    long long adopted, evicted; // Since the start, for the bench
+};
+
+ChunkStreamer streamer;
+
+// Distance from the avenue's middle to where an average building of the
+// first row off the avenue starts, for the bench's driver to brush against
+float buildingLineX() {
+    int lots = static_cast<int>(CHUNK_SIZE / scene.lotSize);
+    float lotSize = CHUNK_SIZE / lots;
+    for (int i = lots / 2; i < lots; i++) {
+        float lotX = (i + 0.5f) * lotSize - CHUNK_SIZE * 0.5f;
+        if (lotX - lotSize * 0.5f >= AVENUE_HALF_WIDTH) return lotX - 0.3125f * lotSize;
+    }
+    return CHUNK_SIZE * 0.5f;
+}
+
+CityChunk* generateChunk(int cx, int cz) {
+    CityChunk* chunk = new CityChunk();
+    chunk->cx = cx;
+    chunk->cz = cz;
+    chunk->maxHeight = 0.0f;
+    chunk->windowBuffer = 0;
+
+    unsigned long long key = static_cast<unsigned long long>(chunkKey(cx, cz));
+    Random random(RNG_BUILDINGS, key);
+    float x0 = cx * CHUNK_SIZE - CHUNK_SIZE * 0.5f;
+    float z0 = cz * CHUNK_SIZE - CHUNK_SIZE * 0.5f;
+    int lots = static_cast<int>(CHUNK_SIZE / scene.lotSize); // Whole lots per chunk
+    float lotSize = CHUNK_SIZE / lots;
+
+    // Buildings on a lot grid, leaving the avenue free (see buildingLineX)
+    for (int i = 0; i < lots; i++) {
+        for (int j = 0; j < lots; j++) {
+            float lotX = x0 + (i + 0.5f) * lotSize;
+            float lotZ = z0 + (j + 0.5f) * lotSize;
+            if (fabsf(lotX) - lotSize * 0.5f < AVENUE_HALF_WIDTH) continue;
+            if (random.nextFloat() >= scene.buildingDensity) continue;
+
+            Building b;
+            b.width = random.range(0.375f, 0.875f) * lotSize;
+            b.height = random.range(10.0f, 30.0f);
+            b.depth = random.range(0.375f, 0.875f) * lotSize;
+            b.x = lotX;
+            b.z = lotZ;
+            chunk->buildings.push_back(b);
+            chunk->maxHeight = std::max(chunk->maxHeight, b.height);
+        }
+    }
+    bakeBuildingGeometry(chunk->buildings, chunk->geometry);
+    chunk->visibleRuns.reserve((chunk->buildings.size() + 1) / 2); // Runs are split by at least one culled building
+
+    // Footprints for the player's collisions, in sweep order
+    if (!chunk->buildings.empty()) {
+        ChunkColliders* colliders = new ChunkColliders();
+        colliders->maxDepth = 0.0f;
+        for (size_t i = 0; i < chunk->buildings.size(); i++) {
+            const Building& b = chunk->buildings[i];
+            CollisionBox box = { b.x - b.width * 0.5f, b.z - b.depth * 0.5f, b.x + b.width * 0.5f, b.z + b.depth * 0.5f };
+            colliders->boxes.push_back(box);
+            colliders->maxDepth = std::max(colliders->maxDepth, b.depth);
+        }
+        std::sort(colliders->boxes.begin(), colliders->boxes.end(), BoxNearerZ());
+        chunk->colliders = colliders;
+    }
+
+    // Traffic on the avenue, looping over this chunk's stretch of road
+    if (x0 <= 0.0f && 0.0f < x0 + CHUNK_SIZE && scene.carsPerChunk > 0) {
+        chunk->traffic = new Traffic();
+        Random traffic(RNG_TRAFFIC, key);
+        for (int i = 0; i < scene.carsPerChunk; i++) {
+            float x = traffic.range(-8.0f, 8.0f);
+            float z = z0 + traffic.nextFloat() * CHUNK_SIZE;
+            bool isBlue = traffic.below(2) == 0;
+            float speed = traffic.range(15.0f, 25.0f);
+            unsigned int respawn = Random(RNG_RESPAWN, key * scene.carsPerChunk + i).nextU32();
+            chunk->traffic->add(x, z, isBlue, speed, z0, z0 + CHUNK_SIZE, chunkKey(cx, cz), respawn);
+        }
+    }
+    return chunk;
+}
+
+static void chunkWorkerMain() {
+    heapUntracked = true; // Generating chunks allocates by design, off the frame
+    while (streamer.running.load()) {
+        CityChunk* chunk;
+        while (streamer.retired.pop(chunk)) delete chunk;
+
+        long long key;
+        if (!streamer.requests.pop(key)) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            continue;
+        }
+
+        chunk = generateChunk(static_cast<int>(key >> 32), static_cast<int>(key & 0xFFFFFFFF));
+        while (!streamer.completed.push(chunk)) {
+            if (!streamer.running.load()) {
+                delete chunk;
+                return;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+// Room in the simulation for everything the resident chunks can bring, so
+// adding them never grows its arrays. Only the avenue's column of chunks has
+// cars: a drive along it keeps about one avenue chunk per row of resident
+// chunks, plus the ones in range. Called before the simulation thread starts.
+static void reserveSimulationCapacity(int slots) {
+    int width = 2 * scene.chunkRadius + 1;
+    int avenueChunks = std::min(slots, slots / width + width + 1);
+    size_t cars = static_cast<size_t>(avenueChunks) * scene.carsPerChunk;
+    simCurrent.traffic.reserve(cars);
+    simPrevious.traffic.reserve(cars);
+    simRender.traffic.reserve(cars);
+    for (int i = 0; i < 3; i++) {
+        SimSnapshot& snapshot = simThread.snapshots.slotAt(i);
+        snapshot.previous.traffic.reserve(cars);
+        snapshot.current.traffic.reserve(cars);
+    }
+    trafficIndex.stretches.reserve(avenueChunks);
+    trafficIndex.order.reserve(cars);
+    trafficIndex.scratch.reserve(cars);
+    trafficIndex.gap.reserve(cars);
+    trafficIndex.closing.reserve(cars);
+    buildingColliders.reset(slots);
+}
+
+void startChunkStreaming() {
+    int slots = scene.chunkBudget + CHUNK_SLOT_SLACK;
+    streamer.slots.assign(slots, ChunkSlot());
+    for (int i = 0; i < slots; i++) {
+        streamer.slots[i].chunk = NULL;
+        streamer.slots[i].older = i + 1 < slots ? i + 1 : -1;
+    }
+    streamer.freeSlot = 0;
+    streamer.newest = streamer.oldest = -1;
+    streamer.residentCount = 0;
+    // Pending keys wait in the two queues or in the worker
+    streamer.keys.reset(slots + 2 * CHUNK_QUEUE_SIZE + 1);
+    reserveSimulationCapacity(slots);
+
+    streamer.running = true;
+    streamer.worker = std::thread(chunkWorkerMain);
+}
+
+void stopChunkStreaming() {
+    if (!streamer.running.load()) return;
+    streamer.running = false;
+    streamer.worker.join();
+
+    // Window buffers are released with the GL context
+    CityChunk* chunk;
+    while (streamer.completed.pop(chunk)) delete chunk;
+    while (streamer.retired.pop(chunk)) delete chunk;
+    for (int slot = streamer.newest; slot >= 0; slot = streamer.slots[slot].older) {
+        delete streamer.slots[slot].chunk;
+    }
+    streamer.slots.clear();
+    streamer.newest = streamer.oldest = streamer.freeSlot = -1;
+    streamer.residentCount = 0;
+    streamer.keys.clear();
+}
+
+static void unlinkChunkSlot(int slot) {
+    ChunkSlot& entry = streamer.slots[slot];
+    if (entry.newer >= 0) {
+        streamer.slots[entry.newer].older = entry.older;
+    } else {
+        streamer.newest = entry.older;
+    }
+    if (entry.older >= 0) {
+        streamer.slots[entry.older].newer = entry.newer;
+    } else {
+        streamer.oldest = entry.newer;
+    }
+}
+
+static void linkNewestChunkSlot(int slot) {
+    ChunkSlot& entry = streamer.slots[slot];
+    entry.newer = -1;
+    entry.older = streamer.newest;
+    if (streamer.newest >= 0) {
+        streamer.slots[streamer.newest].newer = slot;
+    } else {
+        streamer.oldest = slot;
+    }
+    streamer.newest = slot;
+}
+
+// Deleting a chunk frees its geometry, so the worker does it off the frame
+static void retireChunk(CityChunk* chunk) {
+    if (!streamer.running.load() || !streamer.retired.push(chunk)) delete chunk;
+}
+
+static bool chunkResident(long long key) {
+    const int* slot = streamer.keys.find(key);
+    return slot != NULL && *slot != CHUNK_PENDING;
+}
+
+static void evictOldestChunk() {
+    int slot = streamer.oldest;
+    CityChunk* chunk = streamer.slots[slot].chunk;
+    long long key = chunkKey(chunk->cx, chunk->cz);
+    if (chunk->simulated) {
+        SimCommand remove = makeSimCommand(SIM_REMOVE_CHUNK);
+        remove.chunk = key;
+        sendSimCommand(remove);
+    }
+
+    unlinkChunkSlot(slot);
+    streamer.slots[slot].chunk = NULL;
+    streamer.slots[slot].older = streamer.freeSlot;
+    streamer.freeSlot = slot;
+    streamer.residentCount--;
+    streamer.evicted++;
+    streamer.keys.erase(key);
+    if (chunk->windowBuffer != 0) pglDeleteBuffers(1, &chunk->windowBuffer);
+    retireChunk(chunk);
+}
+
+static void adoptChunk(CityChunk* chunk) {
+    long long key = chunkKey(chunk->cx, chunk->cz);
+    if (chunkResident(key)) {
+        retireChunk(chunk);
+        return;
+    }
+
+    // The slack past the budget only runs out if chunks arrive faster than
+    // the end of the frame evicts them
+    if (streamer.freeSlot < 0) evictOldestChunk();
+    int slot = streamer.freeSlot;
+    streamer.freeSlot = streamer.slots[slot].older;
+    streamer.slots[slot].chunk = chunk;
+    linkNewestChunkSlot(slot);
+    streamer.residentCount++;
+    streamer.adopted++;
+    streamer.keys.insert(key) = slot;
+
+    if (chunk->traffic || chunk->colliders) {
+        SimCommand add = makeSimCommand(SIM_ADD_CHUNK);
+        add.chunk = key;
+        add.cars = chunk->traffic;
+        add.buildings = chunk->colliders;
+        chunk->traffic = NULL;
+        chunk->colliders = NULL;
+        chunk->simulated = true;
+        sendSimCommand(add);
+    }
+}
+
+static void cameraChunk(int& cx, int& cz) {
+    cx = chunkCoord(cameraX);
+    cz = chunkCoord(cameraZ);
+}
+
+// Generates the chunks around the camera on the calling thread, so the
+// first frame (and every benchmark frame) sees a complete city
+void preloadChunks() {
+    int camX, camZ;
+    cameraChunk(camX, camZ);
+    for (int dz = -scene.chunkRadius; dz <= scene.chunkRadius; dz++) {
+        for (int dx = -scene.chunkRadius; dx <= scene.chunkRadius; dx++) {
+            if (!chunkResident(chunkKey(camX + dx, camZ + dz))) {
+                adoptChunk(generateChunk(camX + dx, camZ + dz));
+            }
+        }
+    }
+}
+
+void updateChunkStreaming() {
+    ProfileScope profile(ZONE_STREAMING);
+
+    CityChunk* chunk;
+    while (streamer.completed.pop(chunk)) {
+        adoptChunk(chunk);
+    }
+
+    // Nearest rings first so the chunks around the camera arrive before far ones
+    int camX, camZ;
+    cameraChunk(camX, camZ);
+    for (int ring = 0; ring <= scene.chunkRadius; ring++) {
+        for (int dz = -ring; dz <= ring; dz++) {
+            for (int dx = -ring; dx <= ring; dx++) {
+                if (std::max(abs(dx), abs(dz)) != ring) continue;
+
+                long long key = chunkKey(camX + dx, camZ + dz);
+                int* slot = streamer.keys.find(key);
+                if (slot == NULL) {
+                    if (streamer.requests.push(key)) streamer.keys.insert(key) = CHUNK_PENDING;
+                } else if (*slot != CHUNK_PENDING) {
+                    unlinkChunkSlot(*slot);
+                    linkNewestChunkSlot(*slot);
+                }
+            }
+        }
+    }
+
+    // The bench waits for what it asked for, so every run streams the same chunks
+    while (benchMode && streamer.keys.size() > static_cast<size_t>(streamer.residentCount)) {
+        std::this_thread::sleep_for(std::chrono::microseconds(50));
+        while (streamer.completed.pop(chunk)) adoptChunk(chunk);
+    }
+
+    // Least recently used chunks go once over budget
+    while (streamer.residentCount > scene.chunkBudget) {
+        evictOldestChunk();
+    }
+}
+
+int residentBuildingCount() {
+    int count = 0;
+    for (int slot = streamer.newest; slot >= 0; slot = streamer.slots[slot].older) {
+        count += static_cast<int>(streamer.slots[slot].chunk->buildings.size());
+    }
+    return count;
+}
+
+static void drawBuildingRuns(const std::vector<BuildingRun>& runs, GLenum mode, int vertsPerBuilding) {
+    for (size_t r = 0; r < runs.size(); r++) {
+        glDrawArrays(mode, runs[r].first * vertsPerBuilding, (runs[r].last - runs[r].first) * vertsPerBuilding);
+    }
+}
+
+static void drawWindowRuns(const BuildingGeometryCache& cache, const std::vector<BuildingRun>& runs) {
+    for (size_t r = 0; r < runs.size(); r++) {
+        int firstWindow = cache.windowStart[runs[r].first];
+        int windowCount = cache.windowStart[runs[r].last] - firstWindow;
+        if (windowCount > 0) glDrawArrays(GL_QUADS, firstWindow * 4, windowCount * 4);
+    }
+}
+
+const char* windowVertexShader =
+    "#version 120\n"
+    "uniform float time;\n"
+    "uniform float pass;\n"          // 0 = black frame, 1 = lit pane, 2 = glow
+    "uniform float musicPulse;\n"    // Negative without music
+    "attribute vec4 window;\n"       // Facade center x, y, z, window width
+    "attribute vec3 style;\n"        // Color index, weight, blinks
+    "varying vec4 windowColor;\n"
+    "void main() {\n"
+    "    float width = window.w;\n"
+    "    vec2 halfSize = vec2(0.5, 0.75) * width;\n"
+    "    float pulse = musicPulse < 0.0 ? (0.7 + 0.3 * sin(time * 1.5)) * (0.6 + 0.4 * sin(time * 0.3)) : musicPulse;\n"
+    "    float blink = sin(time * 13.0) > 0.0 ? 1.0 : 0.3;\n"
+    "    float intensity = style.z > 0.5 ? pulse * blink : pulse;\n"
+    "    vec3 color = style.x < 0.5 ? vec3(0.0, 0.9, 1.0) : (style.x < 1.5 ? vec3(1.0, 0.8, 0.0) : vec3(1.0, 0.3, 0.7));\n"
+    "    float z = window.z;\n"
+    "    if (pass < 0.5) {\n"
+    "        windowColor = vec4(0.0, 0.0, 0.0, 0.9);\n"
+    "        z += 0.01;\n"
+    "    } else if (pass < 1.5) {\n"
+    "        halfSize -= vec2(0.15 * width);\n"
+    "        windowColor = vec4(color * style.y, 0.95 * intensity);\n"
+    "        z += 0.02;\n"
+    "    } else {\n"
+    "        halfSize = vec2(width);\n"
+    "        windowColor = vec4(color, 0.6 * intensity * style.y);\n"
+    "        z += 0.015;\n"
+    "    }\n"
+    "    gl_Position = gl_ModelViewProjectionMatrix * vec4(window.xy + gl_Vertex.xy * halfSize, z, 1.0);\n"
+    "}\n";
+
+const char* windowFragmentShader =
+    "#version 120\n"
+    "varying vec4 windowColor;\n"
+    "void main() {\n"
+    "    gl_FragColor = windowColor;\n"
+    "}\n";
+
+void initWindowRenderer() {
+    windowRenderer.program = createShaderProgram(windowVertexShader, windowFragmentShader);
+    if (windowRenderer.program == 0) return;
+
+    windowRenderer.timeLocation = pglGetUniformLocation(windowRenderer.program, "time");
+    windowRenderer.passLocation = pglGetUniformLocation(windowRenderer.program, "pass");
+    windowRenderer.musicPulseLocation = pglGetUniformLocation(windowRenderer.program, "musicPulse");
+    windowRenderer.windowLocation = pglGetAttribLocation(windowRenderer.program, "window");
+    windowRenderer.styleLocation = pglGetAttribLocation(windowRenderer.program, "style");
+    renderQueue.programs[MATERIAL_WINDOW_SHADER] = windowRenderer.program;
+}
+
+// Static per-chunk buffer, one draw per pass (frame, pane, glow) and run of
+// visible buildings; nothing per window is touched on the CPU
+static void drawShadedWindows(const CityChunk& chunk, const std::vector<BuildingRun>& runs, float time) {
+    const BuildingGeometryCache& cache = chunk.geometry;
+    const GLsizei stride = WINDOW_VERTEX_FLOATS * sizeof(GLfloat);
+    const WindowRenderer& r = windowRenderer;
+
+    pglUniform1f(r.timeLocation, time);
+    pglUniform1f(r.musicPulseLocation, simRender.music.active ? simRender.buildingPulse : -1.0f);
+
+    pglBindBuffer(GL_ARRAY_BUFFER, chunk.windowBuffer);
+    glVertexPointer(2, GL_FLOAT, stride, (const GLvoid*)0);
+    pglEnableVertexAttribArray(r.windowLocation);
+    pglEnableVertexAttribArray(r.styleLocation);
+    pglVertexAttribPointer(r.windowLocation, 4, GL_FLOAT, GL_FALSE, stride, (const GLvoid*)(2 * sizeof(GLfloat)));
+    pglVertexAttribPointer(r.styleLocation, 3, GL_FLOAT, GL_FALSE, stride, (const GLvoid*)(6 * sizeof(GLfloat)));
+
+    // Bloom stands in for the glow pass
+    int passes = glowPassesActive() ? 3 : 2;
+    for (int pass = 0; pass < passes; pass++) {
+        pglUniform1f(r.passLocation, static_cast<float>(pass));
+        drawWindowRuns(cache, runs);
+    }
+
+    pglDisableVertexAttribArray(r.windowLocation);
+    pglDisableVertexAttribArray(r.styleLocation);
+    pglBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+enum BuildingPart {
+    BUILDING_EDGES,
+    BUILDING_EDGE_GLOW,
+    BUILDING_WINDOWS
+};
+
+static void drawBuildingPart(const FrameContext& frame, const void* object, int part) {
+    const CityChunk& chunk = *static_cast<const CityChunk*>(object);
+    const BuildingGeometryCache& cache = chunk.geometry;
+    const std::vector<BuildingRun>& runs = chunk.visibleRuns;
+    if (runs.empty()) return;
+    glEnableClientState(GL_VERTEX_ARRAY);
+
+    if (part == BUILDING_EDGES) {
+        // Draw buildings with neon outlines
+        // Building outline color - hot pink (classic retrowave color)
+        RetroColor::Pink(frame, 0.95f);
+        glVertexPointer(3, GL_FLOAT, 0, &cache.edgeVertices[0]);
+        drawBuildingRuns(runs, GL_LINES, EDGE_VERTS_PER_BUILDING);
+    } else if (part == BUILDING_EDGE_GLOW) {
+        // Add outline glow for buildings
+        RetroColor::Pink(frame, 0.25f);
+        glVertexPointer(3, GL_FLOAT, 0, &cache.edgeGlowVertices[0]);
+        drawBuildingRuns(runs, GL_LINES, EDGE_GLOW_VERTS_PER_BUILDING);
+    } else if (windowRenderer.program != 0) {
+        drawShadedWindows(chunk, runs, frame.time);
+    } else {
+        // Window outlines (black)
+        glColor4f(0.0f, 0.0f, 0.0f, 0.9f);
+        glVertexPointer(3, GL_FLOAT, 0, &cache.outlineVertices[0]);
+        drawWindowRuns(cache, runs);
+
+        // Lit panes, then glow
+        glEnableClientState(GL_COLOR_ARRAY);
+        glVertexPointer(3, GL_FLOAT, 0, &cache.innerVertices[0]);
+        glColorPointer(4, GL_FLOAT, 0, &cache.innerColors[0]);
+        drawWindowRuns(cache, runs);
+        if (glowPassesActive()) {
+            glVertexPointer(3, GL_FLOAT, 0, &cache.glowVertices[0]);
+            glColorPointer(4, GL_FLOAT, 0, &cache.glowColors[0]);
+            drawWindowRuns(cache, runs);
+        }
+        glDisableClientState(GL_COLOR_ARRAY);
+    }
+
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+// Job: culls the chunk's buildings and animates their baked vertices
+static void prepareBuildingChunk(const FrameContext& frame, void* object, JobThread& thread) {
+    CityChunk& chunk = *static_cast<CityChunk*>(object);
+    const std::vector<Building>& buildings = chunk.buildings;
+    BuildingGeometryCache& cache = chunk.geometry;
+    float time = frame.time;
+
+    // Skip buildings outside the view before touching their vertices
+    std::vector<BuildingRun>& runs = chunk.visibleRuns;
+    runs.clear();
+    for (size_t b = 0; b < buildings.size(); b++) {
+        const Building& building = buildings[b];
+        if (!boxVisible(building.x, building.height * 0.5f, building.z,
+                        building.width * 0.5f, building.height * 0.5f + 1.0f, building.depth * 0.5f + 0.05f,
+                        CULL_BUILDINGS, thread.cull)) {
+            continue;
+        }
+        int index = static_cast<int>(b);
+        if (!runs.empty() && runs.back().last == index) {
+            runs.back().last = index + 1;
+        } else {
+            BuildingRun run = { index, index + 1 };
+            runs.push_back(run);
+        }
+    }
+    if (runs.empty()) return;
+
+    // Window intensity (computed in the shader when available)
+    bool shaded = windowRenderer.program != 0;
+    float windowPulse = 0.7f + 0.3f * sinf(time * 1.5f);
+    float globalWindowIntensity = 0.6f + 0.4f * sinf(time * 0.3f); // Stronger building pulse
+    float pulse = simRender.music.active ? simRender.buildingPulse : windowPulse * globalWindowIntensity;
+    float blink = (sinf(time * 13.0f) > 0) ? 1.0f : 0.3f;
+
+    for (size_t r = 0; r < runs.size(); r++) {
+        for (int b = runs[r].first; b < runs[r].last; b++) {
+            // Roof wobble
+            float roof = buildings[b].height + sinf(time * 0.5f + buildings[b].x * 0.1f) * 0.2f;
+            GLfloat* edge = &cache.edgeVertices[b * EDGE_VERTS_PER_BUILDING * 3];
+            for (size_t i = 0; i < sizeof(edgeRoofVertices) / sizeof(edgeRoofVertices[0]); i++) {
+                edge[edgeRoofVertices[i] * 3 + 1] = roof;
+            }
+            GLfloat* glow = &cache.edgeGlowVertices[b * EDGE_GLOW_VERTS_PER_BUILDING * 3];
+            for (size_t i = 0; i < sizeof(edgeGlowRoofVertices) / sizeof(edgeGlowRoofVertices[0]); i++) {
+                glow[edgeGlowRoofVertices[i] * 3 + 1] = roof;
+            }
+
+            if (shaded) continue;
+            for (int w = cache.windowStart[b]; w < cache.windowStart[b + 1]; w++) {
+                float intensity = cache.windowBlinks[w] ? pulse * blink : pulse;
+                float innerAlpha = 0.95f * intensity;
+                float glowAlpha = 0.6f * intensity * cache.windowWeight[w];
+                for (int v = 0; v < 4; v++) {
+                    cache.innerColors[(w * 4 + v) * 4 + 3] = innerAlpha;
+                    cache.glowColors[(w * 4 + v) * 4 + 3] = glowAlpha;
+                }
+            }
+        }
+    }
+}
+
+// Queues the chunk's job and its draws, which skip the chunk if the job
+// finds no visible building
+static void drawBuildingChunk(CityChunk& chunk) {
+    const BuildingGeometryCache& cache = chunk.geometry;
+    bool shaded = windowRenderer.program != 0;
+    if (shaded && chunk.windowBuffer == 0 && !cache.windowVertices.empty()) {
+        pglGenBuffers(1, &chunk.windowBuffer);
+        pglBindBuffer(GL_ARRAY_BUFFER, chunk.windowBuffer);
+        pglBufferData(GL_ARRAY_BUFFER, cache.windowVertices.size() * sizeof(GLfloat), &cache.windowVertices[0], GL_STATIC_DRAW);
+        pglBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+
+    queueJob(prepareBuildingChunk, &chunk);
+    RenderState windows = neonState(PRIM_FACES);
+    windows.material = shaded ? MATERIAL_WINDOW_SHADER : MATERIAL_FIXED;
+    queueDraw(neonState(PRIM_LINES, 3.0f), ZONE_BUILDINGS, drawBuildingPart, &chunk, BUILDING_EDGES);
+    if (glowPassesActive()) {
+        queueDraw(neonState(PRIM_LINES, 5.0f), ZONE_BUILDINGS, drawBuildingPart, &chunk, BUILDING_EDGE_GLOW);
+    }
+    if (!cache.windowWeight.empty()) {
+        queueDraw(windows, ZONE_BUILDINGS, drawBuildingPart, &chunk, BUILDING_WINDOWS);
+    }
+}
+
+void drawBuildings(const FrameContext& frame) {
+    ProfileScope profile(ZONE_BUILDINGS);
+
+    for (int slot = streamer.newest; slot >= 0; slot = streamer.slots[slot].older) {
+        CityChunk& chunk = *streamer.slots[slot].chunk;
+        if (chunk.buildings.empty()) continue;
+
+        // Whole chunk first, then its buildings one by one
+        float halfHeight = chunk.maxHeight * 0.5f + 1.0f;
+        if (!boxVisible(chunk.cx * CHUNK_SIZE, halfHeight, chunk.cz * CHUNK_SIZE,
+                        CHUNK_SIZE * 0.5f, halfHeight, CHUNK_SIZE * 0.5f, CULL_CHUNKS)) {
+            cullStats.culled[CULL_BUILDINGS] += static_cast<int>(chunk.buildings.size());
+            continue;
+        }
+        drawBuildingChunk(chunk);
+    }
+}
+
+struct GridGeometry {
+    float size;
+    int divisions;
+    FrameVector<ColorVertex> vertices; // GL_LINES
+};
+
+// Job: the grid lines for this frame's scroll offset and pulse
+static void buildGridVertices(const FrameContext& frame, void* object, JobThread&) {
+    GridGeometry& grid = *static_cast<GridGeometry*>(object);
+    FrameVector<ColorVertex>& v = grid.vertices;
+    v.clear();
+    int divisions = grid.divisions;
+    float step = grid.size / divisions;
+    float halfSize = grid.size / 2.0f;
+    GLfloat material[4];
+    GLubyte color[4];
+    float startY = 0.0f;
+    float time = frame.time;
+
+    // Animation offset with smooth movement
+    float offsetZ = fmodf(simRender.gridOffset * step, step);
+    float speedFactor = 1.0f + 0.5f * sinf(time * 0.3f);
+    offsetZ *= speedFactor;
+
+    // With music the lines flash with the bass and on beats
+    const MusicLevels& music = simRender.music;
+    float musicPulse = 0.4f + 0.5f * music.bass + 0.4f * music.beat;
+
+    // Draw grid lines along Z axis (pink/magenta)
+    for (int i = 0; i <= divisions; i++) {
+        float x = -halfSize + i * step;
+        float brightness = 1.0f - fabsf(x) / halfSize; // Fade out at edges
+
+        // Skip some lines for a cleaner look
+        if (i % 2 != 0 && abs(i - divisions/2) > 5) continue;
+
+        // Adjust color for neon effect - more vibrant magenta
+        float pulse = music.active ? musicPulse : 0.7f + 0.3f * sinf(time * 2.0f + i * 0.1f);
+        float alpha = 0.4f + 0.6f * brightness * pulse;
+        RetroColor::getPinkMaterial(frame, alpha, material);
+        toColorBytes(material, color);
+        pushColorVertex(v, color, x, startY, -halfSize + offsetZ);
+        pushColorVertex(v, color, x, startY, halfSize + offsetZ);
+    }
+
+    // Draw grid lines along X axis (cyan/blue)
+    for (int i = 0; i <= divisions; i++) {
+        float z = -halfSize + i * step + offsetZ;
+        if (z > halfSize) continue;
+
+        float brightness = 1.0f - fabsf(z) / halfSize; // Fade out at distance
+
+        // Skip some lines for a cleaner look
+        if (i % 2 != 0 && i > 5) continue;
+
+        float pulse = music.active ? musicPulse : 0.7f + 0.3f * sinf(time * 2.0f + i * 0.1f + 1.5f);
+        float alpha = 0.4f + 0.6f * brightness * pulse;
+        RetroColor::getCyanMaterial(frame, alpha, material);
+        toColorBytes(material, color);
+        pushColorVertex(v, color, -halfSize, startY, z);
+        pushColorVertex(v, color, halfSize, startY, z);
+    }
+}
+
+static void drawGridCommand(const FrameContext&, const void* object, int) {
+    const GridGeometry& grid = *static_cast<const GridGeometry*>(object);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    drawColorVertices(grid.vertices, GL_LINES);
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+// The ground grid as one plane under the camera, out to the far clip plane.
+// Lines, scrolling, distance fade and pulse are evaluated per fragment, so
+// the grid reaches the horizon at a fixed cost and needs no vertices built
+// on the CPU. Without shaders the line grid above is drawn instead.
+struct GridRenderer {
+    GLuint program;
+    GLint timeLocation;
+    GLint colorPulseLocation;
+    GLint musicPulseLocation;
+    GLint spacingLocation;
+    GLint scrollLocation;
+    GLint originLocation;
+    GLint cameraLocation;
+    GLint fadeLocation;
+};
+
+GridRenderer gridRenderer = { 0, -1, -1, -1, -1, -1, -1, -1, -1 };
+
+const char* gridVertexShader =
+    "#version 120\n"
+    "uniform vec2 origin;\n"         // Grid-aligned point near the camera
+    "varying vec2 gridPosition;\n"   // World x, z relative to origin
+    "void main() {\n"
+    "    gridPosition = gl_Vertex.xz - origin;\n"
+    "    gl_Position = gl_ModelViewProjectionMatrix * gl_Vertex;\n"
+    "}\n";
+
+const char* gridFragmentShader =
+    "#version 120\n"
+    "uniform float time;\n"
+    "uniform float colorPulse;\n"
+    "uniform float musicPulse;\n"    // Negative without music
+    "uniform float spacing;\n"       // Distance between lines
+    "uniform float scroll;\n"        // Z offset of the cross lines
+    "uniform vec2 origin;\n"
+    "uniform vec2 camera;\n"         // Camera x, z relative to origin
+    "uniform vec2 fade;\n"           // Near fade length, horizon distance
+    "varying vec2 gridPosition;\n"
+    "float lineCoverage(float coordinate, out float index) {\n"
+    "    float cells = coordinate / spacing;\n"
+    "    index = floor(cells + 0.5);\n"
+    "    float pixels = fwidth(cells);\n"
+    "    float offset = abs(cells - index) / max(pixels, 1e-6);\n"
+    "    // 2.5 pixel lines, faded out where the cells shrink below a few pixels\n"
+    "    return (1.0 - smoothstep(0.75, 1.75, offset)) * (1.0 - smoothstep(0.15, 0.4, pixels));\n"
+    "}\n"
+    "float linePulse(float index, float phase) {\n"
+    "    return musicPulse < 0.0 ? 0.7 + 0.3 * sin(time * 2.0 + index * 0.1 + phase) : musicPulse;\n"
+    "}\n"
+    "void main() {\n"
+    "    float cameraDistance = length(gridPosition - camera);\n"
+    "    float brightness = 1.0 - min(cameraDistance / fade.x, 1.0);\n"
+    "    float horizon = 1.0 - smoothstep(0.6 * fade.y, fade.y, cameraDistance);\n"
+    "\n"
+    "    // Lines along z (pink): every one near the avenue, every other further out\n"
+    "    float column;\n"
+    "    float along = lineCoverage(gridPosition.x, column);\n"
+    "    float worldColumn = column + floor(origin.x / spacing + 0.5);\n"
+    "    if (abs(worldColumn) > 5.0 && mod(worldColumn, 2.0) > 0.5) along = 0.0;\n"
+    "    float pinkAlpha = along * (0.4 + 0.6 * brightness * linePulse(worldColumn, 0.0));\n"
+    "\n"
+    "    // Lines along x (cyan), scrolling towards the camera\n"
+    "    float row;\n"
+    "    float across = lineCoverage(gridPosition.y - scroll, row);\n"
+    "    float worldRow = row + floor(origin.y / spacing + 0.5);\n"
+    "    float cyanAlpha = across * (0.4 + 0.6 * brightness * linePulse(worldRow, 1.5));\n"
+    "\n"
+    "    float alpha = max(pinkAlpha, cyanAlpha) * horizon;\n"
+    "    if (alpha < 0.004) discard;\n"
+    "    vec3 color = pinkAlpha >= cyanAlpha ? vec3(1.0, 0.1, 0.8) : vec3(0.0, 0.8, 1.0);\n"
+    "    gl_FragColor = vec4(color * colorPulse, alpha);\n"
+    "}\n";
+
+void initGridRenderer() {
+    gridRenderer.program = createShaderProgram(gridVertexShader, gridFragmentShader);
+    if (gridRenderer.program == 0) return;
+
+    GLuint program = gridRenderer.program;
+    gridRenderer.timeLocation = pglGetUniformLocation(program, "time");
+    gridRenderer.colorPulseLocation = pglGetUniformLocation(program, "colorPulse");
+    gridRenderer.musicPulseLocation = pglGetUniformLocation(program, "musicPulse");
+    gridRenderer.spacingLocation = pglGetUniformLocation(program, "spacing");
+    gridRenderer.scrollLocation = pglGetUniformLocation(program, "scroll");
+    gridRenderer.originLocation = pglGetUniformLocation(program, "origin");
+    gridRenderer.cameraLocation = pglGetUniformLocation(program, "camera");
+    gridRenderer.fadeLocation = pglGetUniformLocation(program, "fade");
+    renderQueue.programs[MATERIAL_GRID_SHADER] = gridRenderer.program;
+}
+
+static void drawGridPlane(const FrameContext& frame, const void* object, int) {
+    const GridGeometry& grid = *static_cast<const GridGeometry*>(object);
+    const GridRenderer& r = gridRenderer;
+    float step = grid.size / grid.divisions;
+
+    // Relative to a line crossing near the camera, so the coordinates the
+    // fragments see stay small however far the camera has travelled
+    float originX = floorf(cameraX / step) * step;
+    float originZ = floorf(cameraZ / step) * step;
+
+    // With music the lines flash with the bass and on beats
+    const MusicLevels& music = simRender.music;
+    float musicPulse = 0.4f + 0.5f * music.bass + 0.4f * music.beat;
+
+    pglUniform1f(r.timeLocation, frame.time);
+    pglUniform1f(r.colorPulseLocation, frame.colorPulse);
+    pglUniform1f(r.musicPulseLocation, music.active ? musicPulse : -1.0f);
+    pglUniform1f(r.spacingLocation, step);
+    pglUniform1f(r.scrollLocation, simRender.gridOffset * step);
+    pglUniform2f(r.originLocation, originX, originZ);
+    pglUniform2f(r.cameraLocation, cameraX - originX, cameraZ - originZ);
+    pglUniform2f(r.fadeLocation, grid.size / 2.0f, VIEW_DISTANCE);
+
+    float extent = VIEW_DISTANCE;
+    glBegin(GL_QUADS);
+    glVertex3f(originX - extent, 0.0f, originZ - extent);
+    glVertex3f(originX - extent, 0.0f, originZ + extent);
+    glVertex3f(originX + extent, 0.0f, originZ + extent);
+    glVertex3f(originX + extent, 0.0f, originZ - extent);
+    glEnd();
+}
+
+void drawGrid(float size, int divisions, const FrameContext& frame) {
+    ProfileScope profile(ZONE_GRID);
+
+    static GridGeometry grid;
+    grid.size = size;
+    grid.divisions = divisions;
+    if (gridRenderer.program != 0) {
+        RenderState state = { PASS_NEON, BLEND_ADDITIVE, false, PRIM_FACES, 0.0f, 0.0f, MATERIAL_GRID_SHADER };
+        queueDraw(state, ZONE_GRID, drawGridPlane, &grid);
+        return;
+    }
+
+    // Thicker lines for the glow
+    queueJob(buildGridVertices, &grid);
+    queueDraw(neonState(PRIM_LINES, 2.5f), ZONE_GRID, drawGridCommand, &grid);
+}
+
+// Compile-time sine and cosine for the unit-circle tables below: Taylor
+// series on [-pi, pi], as single-expression recursion for C++11 constexpr
+constexpr double CT_PI = 3.14159265358979323846;
+
+constexpr double ctSinSeries(double x2, double term, int n, double sum) {
+    return n > 30 ? sum : ctSinSeries(x2, -term * x2 / ((2.0 * n) * (2.0 * n + 1.0)), n + 1, sum + term);
+}
+
+constexpr double ctCosSeries(double x2, double term, int n, double sum) {
+    return n > 30 ? sum : ctCosSeries(x2, -term * x2 / ((2.0 * n - 1.0) * (2.0 * n)), n + 1, sum + term);
+}
+
+constexpr double ctWrapAngle(double x) { return x > CT_PI ? x - 2.0 * CT_PI : x; }
+constexpr double ctSin(double x) { return ctSinSeries(ctWrapAngle(x) * ctWrapAngle(x), ctWrapAngle(x), 1, 0.0); }
+constexpr double ctCos(double x) { return ctCosSeries(ctWrapAngle(x) * ctWrapAngle(x), 1.0, 1, 0.0); }
+
+struct UnitCirclePoint {
+    float c, s;
+};
+
+template <int... I> struct IndexList {};
+template <int N, int... I> struct MakeIndexList : MakeIndexList<N - 1, N - 1, I...> {};
+template <int... I> struct MakeIndexList<0, I...> { typedef IndexList<I...> type; };
+
+// points[i] = (cos, sin) of i / N of a full turn
+template <int N, typename Indices = typename MakeIndexList<N>::type> struct UnitCircleTable;
+template <int N, int... I> struct UnitCircleTable<N, IndexList<I...> > {
+    static constexpr UnitCirclePoint points[N] = {
+        { static_cast<float>(ctCos(2.0 * CT_PI * I / N)), static_cast<float>(ctSin(2.0 * CT_PI * I / N)) }...
+    };
+};
+template <int N, int... I> constexpr UnitCirclePoint UnitCircleTable<N, IndexList<I...> >::points[N];
+
+static_assert(UnitCircleTable<24>::points[6].s > 0.999999f && UnitCircleTable<24>::points[6].c < 1e-6f,
+              "compile-time unit circle is off");
+
+// Tables for the common segment counts are built into the binary; other
+// counts are computed on first use and kept
+const UnitCirclePoint* unitCircle(int segments) {
+    switch (segments) {
+        case 24: return UnitCircleTable<24>::points;
+        case 36: return UnitCircleTable<36>::points;
+        case 48: return UnitCircleTable<48>::points;
+    }
+
+    static std::map<int, std::vector<UnitCirclePoint> > computed;
+    std::vector<UnitCirclePoint>& points = computed[segments];
+    if (points.empty()) {
+        for (int i = 0; i < segments; i++) {
+            float angle = static_cast<float>(i) / segments * 2.0f * M_PI;
+            UnitCirclePoint p = { cosf(angle), sinf(angle) };
+            points.push_back(p);
+        }
+    }
+    return &points[0];
+}
+
+// Tessellated shapes, built once per (shape, parameters) and drawn from
+// vertex arrays; only transforms and colors change per frame
+enum MeshShape {
+    MESH_PYRAMID,
+    MESH_WIRE_TORUS,
+    MESH_SOLID_TORUS,
+    MESH_SPINNER_CIRCLE,
+    MESH_SPINNER_SPIRAL,
+    MESH_TUNNEL
+};
+
+struct MeshPart {
+    GLenum mode;
+    GLint first;
+    GLsizei count;
+};
+
+struct Mesh {
+    std::vector<GLfloat> vertices;   // xyz
+    std::vector<GLfloat> normals;    // xyz per vertex, lit meshes only
+    std::vector<GLubyte> colorSlots; // Palette entry per vertex, multicolored meshes only
+    std::vector<GLfloat> colors;     // RGBA, filled from the palette when drawn
+    std::vector<MeshPart> parts;     // One glDrawArrays each
+};
+
+struct MeshKey {
+    MeshShape shape;
+    int segments, rings;
+    float size0, size1;
+
+    bool operator<(const MeshKey& other) const {
+        if (shape != other.shape) return shape < other.shape;
+        if (segments != other.segments) return segments < other.segments;
+        if (rings != other.rings) return rings < other.rings;
+        if (size0 != other.size0) return size0 < other.size0;
+        return size1 < other.size1;
+    }
+};
+
+std::map<MeshKey, Mesh> meshCache;
+
+static void beginMeshPart(Mesh& mesh, GLenum mode) {
+    MeshPart part = { mode, static_cast<GLint>(mesh.vertices.size() / 3), 0 };
+    mesh.parts.push_back(part);
+}
+
+static void endMeshPart(Mesh& mesh) {
+    MeshPart& part = mesh.parts.back();
+    part.count = static_cast<GLsizei>(mesh.vertices.size() / 3) - part.first;
+}
+
+static void meshVertex(Mesh& mesh, float x, float y, float z) {
+    mesh.vertices.push_back(x);
+    mesh.vertices.push_back(y);
+    mesh.vertices.push_back(z);
+}
+
+static void meshNormal(Mesh& mesh, float x, float y, float z) {
+    mesh.normals.push_back(x);
+    mesh.normals.push_back(y);
+    mesh.normals.push_back(z);
+}
+
+static void buildPyramidMesh(Mesh& mesh) {
+    const float base[4][3] = {
+        { -1.0f, -1.0f, -1.0f }, { 1.0f, -1.0f, -1.0f }, { 1.0f, -1.0f, 1.0f }, { -1.0f, -1.0f, 1.0f }
+    };
+
+    // Base outline, edges to the apex, then the first two edges again for glow
+    beginMeshPart(mesh, GL_LINE_LOOP);
+    for (int i = 0; i < 4; i++) meshVertex(mesh, base[i][0], base[i][1], base[i][2]);
+    endMeshPart(mesh);
+    for (int glow = 0; glow < 2; glow++) {
+        beginMeshPart(mesh, GL_LINES);
+        for (int i = 0; i < (glow ? 2 : 4); i++) {
+            meshVertex(mesh, base[i][0], base[i][1], base[i][2]);
+            meshVertex(mesh, 0.0f, 2.0f, 0.0f);
+        }
+        endMeshPart(mesh);
+    }
+    size_t lineVertices = mesh.vertices.size() / 3;
+    for (size_t i = 0; i < lineVertices; i++) meshNormal(mesh, 0.0f, 1.0f, 0.0f);
+
+    // Faces: front, right, back, left with approximate normals
+    const int faces[4][2] = { { 3, 2 }, { 2, 1 }, { 1, 0 }, { 0, 3 } };
+    const float faceNormals[4][3] = {
+        { 0.0f, 0.5f, 0.5f }, { 0.5f, 0.5f, 0.0f }, { 0.0f, 0.5f, -0.5f }, { -0.5f, 0.5f, 0.0f }
+    };
+    beginMeshPart(mesh, GL_TRIANGLES);
+    for (int f = 0; f < 4; f++) {
+        const float* a = base[faces[f][0]];
+        const float* b = base[faces[f][1]];
+        meshVertex(mesh, 0.0f, 2.0f, 0.0f);
+        meshVertex(mesh, a[0], a[1], a[2]);
+        meshVertex(mesh, b[0], b[1], b[2]);
+        for (int v = 0; v < 3; v++) meshNormal(mesh, faceNormals[f][0], faceNormals[f][1], faceNormals[f][2]);
+    }
+    endMeshPart(mesh);
+}
+
+// Same tessellation as glutWireTorus/glutSolidTorus, which cannot be used
+// without a GLUT window (benchmark mode)
+static void torusVertex(Mesh& mesh, float innerRadius, float outerRadius,
+                        const UnitCirclePoint& phi, const UnitCirclePoint& theta) {
+    float distance = outerRadius + innerRadius * theta.c;
+    meshNormal(mesh, phi.c * theta.c, phi.s * theta.c, theta.s);
+    meshVertex(mesh, phi.c * distance, phi.s * distance, innerRadius * theta.s);
+}
+
+static void buildWireTorusMesh(Mesh& mesh, float innerRadius, float outerRadius, int sides, int rings) {
+    const UnitCirclePoint* ring = unitCircle(rings);
+    const UnitCirclePoint* side = unitCircle(sides);
+
+    // Small circles around the tube
+    for (int i = 0; i < rings; i++) {
+        beginMeshPart(mesh, GL_LINE_LOOP);
+        for (int j = 0; j < sides; j++) torusVertex(mesh, innerRadius, outerRadius, ring[i], side[j]);
+        endMeshPart(mesh);
+    }
+
+    // Large circles along the tube
+    for (int j = 0; j < sides; j++) {
+        beginMeshPart(mesh, GL_LINE_LOOP);
+        for (int i = 0; i < rings; i++) torusVertex(mesh, innerRadius, outerRadius, ring[i], side[j]);
+        endMeshPart(mesh);
+    }
+}
+
+static void buildSolidTorusMesh(Mesh& mesh, float innerRadius, float outerRadius, int sides, int rings) {
+    const UnitCirclePoint* ring = unitCircle(rings);
+    const UnitCirclePoint* side = unitCircle(sides);
+
+    for (int i = 0; i < rings; i++) {
+        beginMeshPart(mesh, GL_QUAD_STRIP);
+        for (int j = 0; j <= sides; j++) {
+            torusVertex(mesh, innerRadius, outerRadius, ring[(i + 1) % rings], side[j % sides]);
+            torusVertex(mesh, innerRadius, outerRadius, ring[i], side[j % sides]);
+        }
+        endMeshPart(mesh);
+    }
+}
+
+static void buildSpinnerCircleMesh(Mesh& mesh, int segments, float radius) {
+    const UnitCirclePoint* circle = unitCircle(segments);
+    beginMeshPart(mesh, GL_LINE_LOOP);
+    for (int i = 0; i < segments; i++) meshVertex(mesh, radius * circle[i].c, radius * circle[i].s, 0.0f);
+    endMeshPart(mesh);
+
+    // Spokes
+    int spokes = std::max(1, segments / 4);
+    const UnitCirclePoint* spoke = unitCircle(spokes);
+    beginMeshPart(mesh, GL_LINES);
+    for (int i = 0; i < spokes; i++) {
+        meshVertex(mesh, 0.0f, 0.0f, 0.0f);
+        meshVertex(mesh, radius * spoke[i].c, radius * spoke[i].s, 0.0f);
+    }
+    endMeshPart(mesh);
+}
+
+// Colors alternate between palette entries 0 (pink) and 1 (cyan)
+static void buildSpinnerSpiralMesh(Mesh& mesh, int segments, float outline) {
+    const UnitCirclePoint* circle = unitCircle(segments);
+    const int rings = 5;
+    float ringStep = outline / rings;
+
+    for (int r = 0; r < rings; r++) {
+        float innerRadius = r * ringStep;
+        float outerRadius = (r + 1) * ringStep;
+
+        beginMeshPart(mesh, GL_LINE_STRIP);
+        for (int i = 0; i <= segments; i++) {
+            float radius = innerRadius + (outerRadius - innerRadius) * i / segments;
+            meshVertex(mesh, radius * circle[i % segments].c, radius * circle[i % segments].s, 0.0f);
+            mesh.colorSlots.push_back(static_cast<GLubyte>((r + i) % 2));
+        }
+        endMeshPart(mesh);
+    }
+
+    // Circular outline
+    beginMeshPart(mesh, GL_LINE_LOOP);
+    for (int i = 0; i < segments; i++) {
+        meshVertex(mesh, outline * circle[i].c, outline * circle[i].s, 0.0f);
+        mesh.colorSlots.push_back(static_cast<GLubyte>(i % 2));
+    }
+    endMeshPart(mesh);
+}
+
+// Radial strips (one part per segment), then rings + 5 loops, at depth
+// offset 0; drawTunnel translates by the animated depth
+static void buildTunnelMesh(Mesh& mesh, float radius, int segments, int rings) {
+    const UnitCirclePoint* circle = unitCircle(segments);
+
+    for (int i = 0; i < segments; i++) {
+        beginMeshPart(mesh, GL_LINE_STRIP);
+        for (int r = 0; r < rings; r++) {
+            float scaleFactor = (1.0f - r / (float)rings) * 0.9f + 0.1f;
+            meshVertex(mesh, radius * circle[i].c * scaleFactor, radius * circle[i].s * scaleFactor, -50.0f + r * 3.0f);
+        }
+        endMeshPart(mesh);
+    }
+
+    for (int r = 0; r < rings + 5; r++) {
+        float scaleFactor = (1.0f - r / (float)rings) * 0.9f + 0.1f;
+        beginMeshPart(mesh, GL_LINE_LOOP);
+        for (int i = 0; i < segments; i++) {
+            meshVertex(mesh, radius * scaleFactor * circle[i].c, radius * scaleFactor * circle[i].s, -50.0f + r * 3.0f);
+        }
+        endMeshPart(mesh);
+    }
+}
+
+Mesh& getMesh(MeshShape shape, int segments = 0, int rings = 0, float size0 = 0.0f, float size1 = 0.0f) {
+    MeshKey key = { shape, segments, rings, size0, size1 };
+    std::map<MeshKey, Mesh>::iterator it = meshCache.find(key);
+    if (it != meshCache.end()) return it->second;
+
+    Mesh& mesh = meshCache[key];
+    switch (shape) {
+        case MESH_PYRAMID:        buildPyramidMesh(mesh); break;
+        case MESH_WIRE_TORUS:     buildWireTorusMesh(mesh, size0, size1, segments, rings); break;
+        case MESH_SOLID_TORUS:    buildSolidTorusMesh(mesh, size0, size1, segments, rings); break;
+        case MESH_SPINNER_CIRCLE: buildSpinnerCircleMesh(mesh, segments, size0); break;
+        case MESH_SPINNER_SPIRAL: buildSpinnerSpiralMesh(mesh, segments, size0); break;
+        case MESH_TUNNEL:         buildTunnelMesh(mesh, size0, segments, rings); break;
+    }
+    return mesh;
+}
+
+// palette holds one RGBA color per slot for meshes with colorSlots
+static void bindMesh(Mesh& mesh, const GLfloat (*palette)[4] = NULL) {
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glVertexPointer(3, GL_FLOAT, 0, &mesh.vertices[0]);
+    if (!mesh.normals.empty()) {
+        glEnableClientState(GL_NORMAL_ARRAY);
+        glNormalPointer(GL_FLOAT, 0, &mesh.normals[0]);
+    }
+    if (palette && !mesh.colorSlots.empty()) {
+        mesh.colors.resize(mesh.colorSlots.size() * 4);
+        for (size_t i = 0; i < mesh.colorSlots.size(); i++) {
+            memcpy(&mesh.colors[i * 4], palette[mesh.colorSlots[i]], 4 * sizeof(GLfloat));
+        }
+        glEnableClientState(GL_COLOR_ARRAY);
+        glColorPointer(4, GL_FLOAT, 0, &mesh.colors[0]);
+    }
+}
+
+// Array draws leave the current normal and color undefined; later lit
+// draws rely on them being the last ones sent, as in immediate mode
+static void unbindMesh(const Mesh& mesh) {
+    if (!mesh.normals.empty()) {
+        glDisableClientState(GL_NORMAL_ARRAY);
+        glNormal3fv(&mesh.normals[mesh.normals.size() - 3]);
+    }
+    if (glIsEnabled(GL_COLOR_ARRAY)) {
+        glDisableClientState(GL_COLOR_ARRAY);
+        glColor4fv(&mesh.colors[mesh.colors.size() - 4]);
+    }
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
+
+static void drawMeshPart(const Mesh& mesh, size_t part) {
+    glDrawArrays(mesh.parts[part].mode, mesh.parts[part].first, mesh.parts[part].count);
+}
+
+static void drawMesh(Mesh& mesh, const GLfloat (*palette)[4] = NULL) {
+    bindMesh(mesh, palette);
+    for (size_t i = 0; i < mesh.parts.size(); i++) drawMeshPart(mesh, i);
+    unbindMesh(mesh);
+}
+
+void drawSpinners(const FrameContext& frame) {
+    ProfileScope profile(ZONE_SPINNERS);
+    // Draw each spinner
+    for (size_t i = 0; i < simRender.spinners.size(); i++) {
+        const Spinner& spinner = simRender.spinners[i];
+        if (sphereVisible(spinner.x, spinner.y, spinner.z, spinner.radius, CULL_SPINNERS)) {
+            drawSpinner(spinner, frame);
+        }
+    }
+}
+
+static void drawSpinnerCommand(const FrameContext& frame, const void* object, int) {
+    const Spinner& spinner = *static_cast<const Spinner*>(object);
+    glPushMatrix();
+    glTranslatef(spinner.x, spinner.y, spinner.z);
+    glRotatef(spinner.rotation, 0.0f, 0.0f, 1.0f);
+
+    int segments = qualitySegments(scene.spinnerSegments, 4);
+
+    if (spinner.type == 0) {  // Circular spinner
+        Mesh& mesh = getMesh(MESH_SPINNER_CIRCLE, segments, 0, spinner.radius);
+        bindMesh(mesh);
+
+        // Circle, then spokes
+        for (size_t part = 0; part < 2; part++) {
+            float alpha = part == 0 ? 0.8f : 0.5f;
+            if (spinner.isPink) {
+                RetroColor::Pink(frame, alpha);
+            } else {
+                RetroColor::Cyan(frame, alpha);
+            }
+            drawMeshPart(mesh, part);
+        }
+        unbindMesh(mesh);
+
+    } else {  // Spiral spinner, alternating pink and cyan along the lines
+        GLfloat palette[2][4];
+        RetroColor::getPinkMaterial(frame, 0.8f, palette[0]);
+        RetroColor::getCyanMaterial(frame, 0.8f, palette[1]);
+        drawMesh(getMesh(MESH_SPINNER_SPIRAL, segments, 0, spinner.radius), palette);
+    }
+
+    glPopMatrix();
+}
+
+void drawSpinner(const Spinner& spinner, const FrameContext& frame) {
+    // Circles use 2-pixel lines, spirals the default width
+    float width = spinner.type == 0 ? 2.0f : 1.0f;
+    queueDraw(neonState(PRIM_LINES, width), ZONE_SPINNERS, drawSpinnerCommand, &spinner);
+}
+
+struct TunnelParams {
+    float radius;
+    int segments, rings;
+};
+
+static void drawTunnelCommand(const FrameContext& frame, const void* object, int) {
+    const TunnelParams& params = *static_cast<const TunnelParams*>(object);
+    float radius = params.radius;
+    int segments = params.segments;
+    int rings = params.rings;
+
+    // Position the tunnel in the sky - adjusted position for bigger tunnel
+    glPushMatrix();
+    glTranslatef(0.0f, 40.0f, -90.0f); // Moved higher and farther back
+
+    // Rotate for better visibility
+    glRotatef(15.0f, 1.0f, 0.0f, 0.0f);
+
+    // Spin the tunnel
+    glRotatef(simRender.vortexAngle * 0.2f, 0.0f, 0.0f, 1.0f);
+
+    // Scroll the baked tunnel towards the viewer
+    glTranslatef(0.0f, 0.0f, simRender.tunnelDepth);
+    Mesh& mesh = getMesh(MESH_TUNNEL, segments, rings, radius);
+    bindMesh(mesh);
+
+    // Draw radial lines, pink for odd radials, blue for even
+    for (int i = 0; i < segments; i++) {
+        if (i % 2 == 0) {
+            RetroColor::Pink(frame, 0.8f);
+        } else {
+            RetroColor::Cyan(frame, 0.8f);
+        }
+        drawMeshPart(mesh, i);
+    }
+
+    // Draw concentric rings with increased count
+    for (int r = 0; r < rings + 5; r++) { // Added 5 more rings
+        // Alternate between pink and blue rings
+        if (r % 2 == 0) {
+            RetroColor::Pink(frame, 0.7f - (float)r/rings * 0.5f);
+        } else {
+            RetroColor::Cyan(frame, 0.7f - (float)r/rings * 0.5f);
+        }
+        drawMeshPart(mesh, segments + r);
+    }
+    unbindMesh(mesh);
+
+    glPopMatrix();
 }
 
-void display() {
-    // Clear the screen
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+// Updated tunnel function to make it bigger
+void drawTunnel(float radius, int segments, int rings, const FrameContext& frame) {
+    ProfileScope profile(ZONE_TUNNEL);
 
-    // Reset transformations
-    glLoadIdentity();
+    // INCREASED RADIUS from 30.0f to 50.0f to make the tunnel bigger
+    radius = 50.0f;
 
-    // Set the camera position
-    gluLookAt(cameraX, cameraY, cameraZ,
-              cameraX + lookX, cameraY + lookY, cameraZ + lookZ,
-              0.0f, 1.0f, 0.0f);
+    // Read back during submission, later in the same frame
+    static TunnelParams params;
+    params.radius = radius;
+    params.segments = segments;
+    params.rings = rings;
+    queueDraw(neonState(PRIM_LINES, 2.0f), ZONE_TUNNEL, drawTunnelCommand, &params);
+}
 
-    // Draw sky with stars
-    drawSky();
+enum CarPart {
+    CAR_OUTLINE,
+    CAR_GLOW,
+    CAR_HEADLIGHTS,
+    CAR_HEADLIGHT_GLOW,
+    CAR_TAILLIGHTS,
+    CAR_TRAIL,
+    CAR_PART_COUNT
+};
 
-    // Add the new shapes
-    float time = glutGet(GLUT_ELAPSED_TIME) / 1000.0f;
-    drawPyramid(time);
-    drawTorus(time);
+const int CARS_PER_JOB = 1024;
 
-    // Draw spinners (futuristic elements)
-    drawSpinners();
+// One job's range of simRender.traffic, each part in its own vertex array
+struct CarBlock {
+    int first, last;
+    FrameVector<ColorVertex> parts[CAR_PART_COUNT];
+};
 
-    // Disable lighting temporarily for neon effects
-    glDisable(GL_LIGHTING);
+// This frame's colors, [isBlue][part], and the blocks drawn part by part
+struct CarGeometry {
+    bool glow;                          // Glow parts are built (no bloom)
+    GLubyte colors[2][CAR_PART_COUNT][4];
+    GLubyte trailEnd[2][4];             // Far end of the trail fades out
+    FrameVector<CarBlock> blocks;
+};
 
-    // Draw tunnel effect in the sky
-    drawTunnel(30.0f, 36, 15);
+CarGeometry carGeometry;
 
-    // Draw grid
-    drawGrid(100.0f, 40);
+static void pushCarLine(FrameVector<ColorVertex>& v, const GLubyte* color, float x, float y, float z,
+                        float x0, float y0, float z0, float x1, float y1, float z1) {
+    pushColorVertex(v, color, x + x0, y + y0, z + z0);
+    pushColorVertex(v, color, x + x1, y + y1, z + z1);
+}
 
-    // Draw buildings
-    for (size_t i = 0; i < buildings.size(); i++) {
-        drawBuilding(buildings[i]);
+// Job: culls the block's cars and writes their outlines, lights and trails
+static void buildCarBlock(const FrameContext& frame, void* object, JobThread& thread) {
+    CarBlock& block = *static_cast<CarBlock*>(object);
+    const CarGeometry& geometry = carGeometry;
+    const Traffic& traffic = simRender.traffic;
+    const float carLength = 4.0f;
+    const float carWidth = 2.0f;
+    const float carHeight = 1.2f;
+    const float w = carWidth / 2, l = carLength / 2;
+
+    for (int p = 0; p < CAR_PART_COUNT; p++) {
+        block.parts[p].clear();
     }
+    for (int i = block.first; i < block.last; i++) {
+        float x = traffic.x[i];
+        float z = traffic.z[i];
+        // Box around body, lights and the 20-unit trail behind the car
+        if (!boxVisible(x, 0.6f, z - 10.0f, 1.1f, 0.8f, 12.2f, CULL_CARS, thread.cull)) continue;
+
+        // Add bobbing animation
+        float y = 0.5f + sinf(frame.time * 4.0f + x) * 0.1f;
+        int blue = traffic.isBlue[i];
+        const GLubyte (*color)[4] = geometry.colors[blue];
+
+        // Bottom and top outlines as line pairs, then bottom to top
+        FrameVector<ColorVertex>& outline = block.parts[CAR_OUTLINE];
+        const float bottom[4][2] = { { -w, -l }, { w, -l }, { w, l }, { -w, l } };
+        const float top[4][2] = { { -w, -l }, { w, -l }, { w, l - 1.0f }, { -w, l - 1.0f } };
+        for (int k = 0; k < 4; k++) {
+            int n = (k + 1) % 4;
+            pushCarLine(outline, color[CAR_OUTLINE], x, y, z, bottom[k][0], 0.0f, bottom[k][1], bottom[n][0], 0.0f, bottom[n][1]);
+        }
+        for (int k = 0; k < 4; k++) {
+            int n = (k + 1) % 4;
+            pushCarLine(outline, color[CAR_OUTLINE], x, y, z, top[k][0], carHeight, top[k][1], top[n][0], carHeight, top[n][1]);
+        }
+        pushCarLine(outline, color[CAR_OUTLINE], x, y, z, -w, 0.0f, l, -w, carHeight, l - 1.0f);  // Front-left
+        pushCarLine(outline, color[CAR_OUTLINE], x, y, z, w, 0.0f, l, w, carHeight, l - 1.0f);    // Front-right
+        pushCarLine(outline, color[CAR_OUTLINE], x, y, z, -w, 0.0f, -l, -w, carHeight, -l);       // Back-left
+        pushCarLine(outline, color[CAR_OUTLINE], x, y, z, w, 0.0f, -l, w, carHeight, -l);         // Back-right
+
+        // Headlights and taillights
+        float lightX = carWidth / 3, lightY = y + carHeight / 3;
+        pushColorVertex(block.parts[CAR_HEADLIGHTS], color[CAR_HEADLIGHTS], x - lightX, lightY, z + l + 0.1f);
+        pushColorVertex(block.parts[CAR_HEADLIGHTS], color[CAR_HEADLIGHTS], x + lightX, lightY, z + l + 0.1f);
+        pushColorVertex(block.parts[CAR_TAILLIGHTS], color[CAR_TAILLIGHTS], x - lightX, lightY, z - l - 0.1f);
+        pushColorVertex(block.parts[CAR_TAILLIGHTS], color[CAR_TAILLIGHTS], x + lightX, lightY, z - l - 0.1f);
+
+        if (geometry.glow) {
+            // Bottom outline glow and big headlight glow
+            for (int k = 0; k < 4; k++) {
+                int n = (k + 1) % 4;
+                pushCarLine(block.parts[CAR_GLOW], color[CAR_GLOW], x, y, z,
+                            bottom[k][0], 0.0f, bottom[k][1], bottom[n][0], 0.0f, bottom[n][1]);
+            }
+            pushColorVertex(block.parts[CAR_HEADLIGHT_GLOW], color[CAR_HEADLIGHT_GLOW], x - lightX, lightY, z + l + 0.1f);
+            pushColorVertex(block.parts[CAR_HEADLIGHT_GLOW], color[CAR_HEADLIGHT_GLOW], x + lightX, lightY, z + l + 0.1f);
+        }
 
-    // Draw cars
-    for (size_t i = 0; i < cars.size(); i++) {
-        drawCar(cars[i]);
+        // Ground light trail, fading to transparent 20 units behind
+        FrameVector<ColorVertex>& trail = block.parts[CAR_TRAIL];
+        const GLubyte* trailEnd = geometry.trailEnd[blue];
+        pushColorVertex(trail, color[CAR_TRAIL], x - carWidth / 4, y + 0.05f, z - l);
+        pushColorVertex(trail, color[CAR_TRAIL], x + carWidth / 4, y + 0.05f, z - l);
+        pushColorVertex(trail, trailEnd, x + carWidth / 4, y + 0.05f, z - l - 20.0f);
+        pushColorVertex(trail, trailEnd, x - carWidth / 4, y + 0.05f, z - l - 20.0f);
+    }
+}
+
+static void drawCarPart(const FrameContext&, const void* object, int part) {
+    const CarGeometry& geometry = *static_cast<const CarGeometry*>(object);
+    GLenum mode = part == CAR_TRAIL ? GL_QUADS : (part == CAR_OUTLINE || part == CAR_GLOW) ? GL_LINES : GL_POINTS;
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_COLOR_ARRAY);
+    for (size_t b = 0; b < geometry.blocks.size(); b++) {
+        drawColorVertices(geometry.blocks[b].parts[part], mode);
     }
+    glDisableClientState(GL_COLOR_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+}
 
-    // Re-enable lighting
-    glEnable(GL_LIGHTING);
+// Sets this frame's car colors, then queues a job per block of cars and a
+// single draw per part for all of them
+void drawCars(const FrameContext& frame) {
+    ProfileScope profile(ZONE_CARS);
+    CarGeometry& geometry = carGeometry;
 
-    // Calculate and display FPS
-    calculateFPS();
+    // Headlights, headlight glow and taillights: orange cars, then blue ones
+    static const GLfloat lights[2][3][4] = {
+        { { 1.0f, 0.8f, 0.3f, 1.0f }, { 1.0f, 0.8f, 0.3f, 0.5f }, { 1.0f, 0.2f, 0.2f, 1.0f } },
+        { { 0.0f, 0.9f, 1.0f, 1.0f }, { 0.0f, 0.9f, 1.0f, 0.5f }, { 0.0f, 0.5f, 1.0f, 1.0f } }
+    };
+    float trailIntensity = 0.8f + 0.2f * sinf(frame.time * 5.0f);
+    for (int blue = 0; blue < 2; blue++) {
+        GLfloat color[4];
+        GLubyte (*colors)[4] = geometry.colors[blue];
+        for (int part = CAR_OUTLINE; part <= CAR_GLOW; part++) {
+            float alpha = part == CAR_OUTLINE ? 0.95f : 0.3f;
+            if (blue) {
+                RetroColor::getCyanMaterial(frame, alpha, color);
+            } else {
+                RetroColor::getGoldMaterial(frame, alpha, color);
+            }
+            toColorBytes(color, colors[part]);
+        }
+        toColorBytes(lights[blue][0], colors[CAR_HEADLIGHTS]);
+        toColorBytes(lights[blue][1], colors[CAR_HEADLIGHT_GLOW]);
+        toColorBytes(lights[blue][2], colors[CAR_TAILLIGHTS]);
+
+        // Cyan trail for blue cars, orange/red for the others
+        GLfloat trail[4] = { 1.0f * trailIntensity, 0.5f * trailIntensity, 0.0f, 0.8f };
+        if (blue) {
+            trail[0] = 0.0f;
+            trail[1] = 0.8f * trailIntensity;
+            trail[2] = 1.0f * trailIntensity;
+        }
+        toColorBytes(trail, colors[CAR_TRAIL]);
+        for (int k = 0; k < 3; k++) trail[k] *= 0.3f;
+        trail[3] = 0.0f;
+        toColorBytes(trail, geometry.trailEnd[blue]);
+    }
 
-    // Swap buffers
-    glutSwapBuffers();
+    // Blocks and their vertex arrays live in the frame arena
+    int count = static_cast<int>(simRender.traffic.size());
+    geometry.glow = glowPassesActive();
+    geometry.blocks.clear();
+    geometry.blocks.resize((count + CARS_PER_JOB - 1) / CARS_PER_JOB);
+    for (size_t b = 0; b < geometry.blocks.size(); b++) {
+        CarBlock& block = geometry.blocks[b];
+        block.first = static_cast<int>(b) * CARS_PER_JOB;
+        block.last = std::min(count, block.first + CARS_PER_JOB);
+        queueJob(buildCarBlock, &block);
+    }
+
+    // Glow passes only without bloom
+    queueDraw(neonState(PRIM_LINES, 2.5f), ZONE_CARS, drawCarPart, &geometry, CAR_OUTLINE);  // Thicker lines
+    if (geometry.glow) queueDraw(neonState(PRIM_LINES, 4.0f), ZONE_CARS, drawCarPart, &geometry, CAR_GLOW);
+    queueDraw(neonState(PRIM_POINTS, 0.0f, 5.0f), ZONE_CARS, drawCarPart, &geometry, CAR_HEADLIGHTS);  // Bigger, brighter lights
+    if (geometry.glow) queueDraw(neonState(PRIM_POINTS, 0.0f, 10.0f), ZONE_CARS, drawCarPart, &geometry, CAR_HEADLIGHT_GLOW);  // Big glow
+    queueDraw(neonState(PRIM_POINTS, 0.0f, 4.0f), ZONE_CARS, drawCarPart, &geometry, CAR_TAILLIGHTS);
+    queueDraw(neonState(PRIM_FACES), ZONE_CARS, drawCarPart, &geometry, CAR_TRAIL);
 }
 
-void reshape(int width, int height) {
-    // Set viewport to window dimensions
-    glViewport(0, 0, width, height);
+enum PlayerCarPart {
+    PLAYER_OUTLINE,
+    PLAYER_GLOW,
+    PLAYER_LIGHTS
+};
 
-    // Set perspective projection
-    glMatrixMode(GL_PROJECTION);
-    glLoadIdentity();
-    gluPerspective(45.0f, (float)width / (float)height, 0.1f, 500.0f);
+// The player's car in pink, in its own frame: front towards -z
+static void drawPlayerCarPart(const FrameContext& frame, const void* object, int part) {
+    const PlayerCar& car = *static_cast<const PlayerCar*>(object);
+    const float w = PLAYER_HALF_WIDTH, l = PLAYER_HALF_LENGTH, h = 1.2f;
+    glPushMatrix();
+    glTranslatef(car.x, 0.5f + sinf(frame.time * 4.0f) * 0.05f, car.z);
+    glRotatef(-car.heading * 180.0f / static_cast<float>(M_PI), 0.0f, 1.0f, 0.0f);
 
-    // Switch back to modelview matrix
-    glMatrixMode(GL_MODELVIEW);
-    glLoadIdentity();
+    if (part == PLAYER_LIGHTS) {
+        // Headlights, and taillights that flare while braking
+        glBegin(GL_POINTS);
+        glColor4f(1.0f, 0.9f, 0.6f, 1.0f);
+        glVertex3f(-w * 0.66f, h / 3, -l - 0.1f);
+        glVertex3f(w * 0.66f, h / 3, -l - 0.1f);
+        float brake = car.input.brake > 0.0f || car.input.handbrake ? 1.0f : 0.5f;
+        glColor4f(1.0f * brake, 0.1f, 0.3f * brake, 1.0f);
+        glVertex3f(-w * 0.66f, h / 3, l + 0.1f);
+        glVertex3f(w * 0.66f, h / 3, l + 0.1f);
+        glEnd();
+        glPopMatrix();
+        return;
+    }
+
+    // Boost turns the outline gold, a drift shows in the glow
+    if (car.input.boost && car.boost > 0.0f) {
+        RetroColor::Gold(frame, part == PLAYER_OUTLINE ? 0.95f : 0.4f);
+    } else {
+        RetroColor::Pink(frame, part == PLAYER_OUTLINE ? 0.95f : (car.drifting ? 0.6f : 0.3f));
+    }
+    const float bottom[4][2] = { { -w, l }, { w, l }, { w, -l }, { -w, -l } };
+    const float top[4][2] = { { -w, l }, { w, l }, { w, -l + 1.0f }, { -w, -l + 1.0f } };
+    glBegin(GL_LINE_LOOP);
+    for (int k = 0; k < 4; k++) glVertex3f(bottom[k][0], 0.0f, bottom[k][1]);
+    glEnd();
+    if (part == PLAYER_OUTLINE) {
+        glBegin(GL_LINE_LOOP);
+        for (int k = 0; k < 4; k++) glVertex3f(top[k][0], h, top[k][1]);
+        glEnd();
+        glBegin(GL_LINES);
+        for (int k = 0; k < 4; k++) {
+            glVertex3f(bottom[k][0], 0.0f, bottom[k][1]);
+            glVertex3f(top[k][0], h, top[k][1]);
+        }
+        glEnd();
+    }
+    glPopMatrix();
 }
 
-void timer(int value) {
-    // Calculate delta time
-    float currentTime = glutGet(GLUT_ELAPSED_TIME) / 1000.0f;
-    float deltaTime = currentTime - lastTime;
-    lastTime = currentTime;
+void drawPlayerCar(const FrameContext& frame) {
+    ProfileScope profile(ZONE_CARS);
+    const PlayerCar& car = simRender.player;
+    if (!sphereVisible(car.x, 0.6f, car.z, 2.5f, CULL_CARS)) return;
 
-    // Update grid animation
-    gridOffset += 0.8f * deltaTime;
-    if (gridOffset > 1.0f) gridOffset -= 1.0f;
+    queueDraw(neonState(PRIM_LINES, 2.5f), ZONE_CARS, drawPlayerCarPart, &car, PLAYER_OUTLINE);
+    if (glowPassesActive()) queueDraw(neonState(PRIM_LINES, 5.0f), ZONE_CARS, drawPlayerCarPart, &car, PLAYER_GLOW);
+    queueDraw(neonState(PRIM_POINTS, 0.0f, 6.0f), ZONE_CARS, drawPlayerCarPart, &car, PLAYER_LIGHTS);
+}
 
-    // Update vortex angle
-    float vortexSpeed = 25.0f + 15.0f * sinf(currentTime * 0.2f);
-    vortexAngle += vortexSpeed * deltaTime;
-    if (vortexAngle > 360.0f) vortexAngle -= 360.0f;
+// Star field uploaded once into a buffer object; twinkle, size and color
+// are evaluated in the vertex shader from the time uniform
+struct StarField {
+    GLuint program;
+    GLuint buffer;
+    GLint timeLocation;
+    GLint glowLocation;
+    GLsizei count;
+    GLsizei firstBright; // Stars from here on also get a glow pass
+};
 
-    // Update tunnel depth
-    tunnelDepth += 15.0f * deltaTime;
-    if (tunnelDepth > 10.0f) tunnelDepth -= 10.0f;
+StarField starField = { 0, 0, -1, -1, 0, 0 };
+
+const char* starVertexShader =
+    "#version 120\n"
+    "uniform float time;\n"
+    "uniform float glowPass;\n"
+    "varying vec4 starColor;\n"
+    "void main() {\n"
+    "    float brightness = gl_MultiTexCoord0.x;\n"
+    "    float size = gl_MultiTexCoord0.y;\n"
+    "    float colorType = gl_MultiTexCoord0.z;\n"
+    "    float index = gl_MultiTexCoord0.w;\n"
+    "    float twinkleSpeed = 3.0 + mod(index, 5.0);\n"
+    "    float twinkle = 0.5 + 0.5 * sin(time * twinkleSpeed + index * 0.1);\n"
+    "    if (glowPass > 0.5) {\n"
+    "        float alpha = 0.2 * brightness * twinkle;\n"
+    "        if (colorType < 7.0) starColor = vec4(0.6, 0.6, 1.0, alpha);\n"
+    "        else if (colorType < 9.0) starColor = vec4(1.0, 0.7, 0.3, alpha);\n"
+    "        else starColor = vec4(1.0, 0.3, 0.2, alpha);\n"
+    "        gl_PointSize = size * 3.0 * twinkle;\n"
+    "    } else {\n"
+    "        if (colorType < 7.0) starColor = vec4(0.8 + 0.2 * twinkle, 0.8 + 0.2 * twinkle, 1.0, 1.0);\n"
+    "        else if (colorType < 9.0) starColor = vec4(1.0, 0.7 + 0.3 * twinkle, 0.4 * twinkle, 1.0);\n"
+    "        else starColor = vec4(1.0, 0.3 * twinkle, 0.2 * twinkle, 1.0);\n"
+    "        gl_PointSize = size * (0.8 + 0.4 * twinkle);\n"
+    "    }\n"
+    "    gl_Position = gl_ModelViewProjectionMatrix * vec4(gl_Vertex.xyz, 1.0);\n"
+    "}\n";
+
+const char* starFragmentShader =
+    "#version 120\n"
+    "varying vec4 starColor;\n"
+    "void main() {\n"
+    "    // Round, soft-edged points like GL_POINT_SMOOTH\n"
+    "    vec2 d = gl_PointCoord - vec2(0.5);\n"
+    "    float r = dot(d, d) * 4.0;\n"
+    "    if (r > 1.0) discard;\n"
+    "    gl_FragColor = vec4(starColor.rgb, starColor.a * (1.0 - r * r));\n"
+    "}\n";
+
+void initStarField() {
+    starField.program = createShaderProgram(starVertexShader, starFragmentShader);
+    if (starField.program == 0) return;
+
+    starField.timeLocation = pglGetUniformLocation(starField.program, "time");
+    starField.glowLocation = pglGetUniformLocation(starField.program, "glowPass");
+    renderQueue.programs[MATERIAL_STAR_SHADER] = starField.program;
+
+    // Interleaved x, y, z, brightness, size, colorType, index; bright stars last
+    std::vector<GLfloat> data;
+    data.reserve(stars.size() * 7);
+    for (int pass = 0; pass < 2; pass++) {
+        if (pass == 1) starField.firstBright = static_cast<GLsizei>(data.size() / 7);
+        for (size_t i = 0; i < stars.size(); i++) {
+            const Star& star = stars[i];
+            if ((star.brightness > 0.8f) != (pass == 1)) continue;
+            data.push_back(star.x);
+            data.push_back(star.y);
+            data.push_back(star.z);
+            data.push_back(star.brightness);
+            data.push_back(star.size);
+            data.push_back(static_cast<float>(star.colorType));
+            data.push_back(static_cast<float>(i));
+        }
+    }
+    starField.count = static_cast<GLsizei>(stars.size());
 
-    // Update spinner rotations
-    for (size_t i = 0; i < spinners.size(); i++) {
-        spinners[i].rotation += spinners[i].rotationSpeed * deltaTime;
-        if (spinners[i].rotation > 360.0f) spinners[i].rotation -= 360.0f;
+    pglGenBuffers(1, &starField.buffer);
+    pglBindBuffer(GL_ARRAY_BUFFER, starField.buffer);
+    pglBufferData(GL_ARRAY_BUFFER, data.size() * sizeof(GLfloat), data.empty() ? NULL : &data[0], GL_STATIC_DRAW);
+    pglBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+static void drawStarField(const FrameContext& frame, const void*, int) {
+    const GLsizei stride = 7 * sizeof(GLfloat);
+
+    glEnable(GL_VERTEX_PROGRAM_POINT_SIZE);
+    glEnable(GL_POINT_SPRITE);
+
+    pglUniform1f(starField.timeLocation, frame.time);
+
+    pglBindBuffer(GL_ARRAY_BUFFER, starField.buffer);
+    glEnableClientState(GL_VERTEX_ARRAY);
+    glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+    glVertexPointer(3, GL_FLOAT, stride, (const GLvoid*)0);
+    glTexCoordPointer(4, GL_FLOAT, stride, (const GLvoid*)(3 * sizeof(GLfloat)));
+
+    // The quality level keeps a share of the dim and of the bright stars
+    float fraction = currentQuality().starFraction;
+    GLsizei dim = static_cast<GLsizei>(starField.firstBright * fraction);
+    GLsizei bright = static_cast<GLsizei>((starField.count - starField.firstBright) * fraction);
+
+    // All stars, then glow for the bright ones unless bloom provides it
+    pglUniform1f(starField.glowLocation, 0.0f);
+    glDrawArrays(GL_POINTS, 0, dim);
+    glDrawArrays(GL_POINTS, starField.firstBright, bright);
+    if (glowPassesActive()) {
+        pglUniform1f(starField.glowLocation, 1.0f);
+        glDrawArrays(GL_POINTS, starField.firstBright, bright);
     }
 
-    // Update car movement
-    for (size_t i = 0; i < cars.size(); i++) {
-        // Move cars with their individual speeds
-        cars[i].z += cars[i].speed * deltaTime;
+    glDisableClientState(GL_TEXTURE_COORD_ARRAY);
+    glDisableClientState(GL_VERTEX_ARRAY);
+    pglBindBuffer(GL_ARRAY_BUFFER, 0);
 
-        // Reset position when car goes too far
-        if (cars[i].z > 50.0f) {
-            cars[i].z = -50.0f;
-            cars[i].speed = 15.0f + static_cast<float>(rand()) / RAND_MAX * 10.0f;
+    glDisable(GL_POINT_SPRITE);
+    glDisable(GL_VERTEX_PROGRAM_POINT_SIZE);
+}
 
-            // 20% chance to switch color when respawning
-            if (rand() % 5 == 0) {
-                cars[i].isBlue = !cars[i].isBlue;
+// Fallback without shaders, sizes each point itself
+static void drawStarPoints(const FrameContext& frame, const void*, int) {
+    float time = frame.time;
+    size_t count = static_cast<size_t>(stars.size() * currentQuality().starFraction);
+
+    for (size_t i = 0; i < count; i++) {
+        const Star& star = stars[i];
+
+        // Twinkling effect
+        float twinkleSpeed = 3.0f + (i % 5) * 1.0f;
+        float twinkle = 0.5f + 0.5f * sinf(time * twinkleSpeed + i * 0.1f);
+        float brightness = star.brightness * twinkle;
+
+        // Variable star size
+        glPointSize(star.size * (0.8f + 0.4f * twinkle));
+
+        // Star color
+        if (star.colorType < 7) { // White/blue
+            glColor3f(0.8f + 0.2f * twinkle, 0.8f + 0.2f * twinkle, 1.0f);
+        } else if (star.colorType < 9) { // Yellow/orange
+            glColor3f(1.0f, 0.7f + 0.3f * twinkle, 0.4f * twinkle);
+        } else { // Red
+            glColor3f(1.0f, 0.3f * twinkle, 0.2f * twinkle);
+        }
+
+        glBegin(GL_POINTS);
+        glVertex3f(star.x, star.y, star.z);
+        glEnd();
+
+        // Add glow for bright stars
+        if (star.brightness > 0.8f && glowPassesActive()) {
+            float glowSize = star.size * 3.0f * twinkle;
+
+            if (star.colorType < 7) {
+                glColor4f(0.6f, 0.6f, 1.0f, 0.2f * brightness);
+            } else if (star.colorType < 9) {
+                glColor4f(1.0f, 0.7f, 0.3f, 0.2f * brightness);
+            } else {
+                glColor4f(1.0f, 0.3f, 0.2f, 0.2f * brightness);
             }
+
+            glPointSize(glowSize);
+            glBegin(GL_POINTS);
+            glVertex3f(star.x, star.y, star.z);
+            glEnd();
         }
     }
+}
 
-    // Update building pulse effect for windows
-    buildingPulse = 0.7f + 0.3f * sinf(currentTime * 0.5f);
+void drawSky(const FrameContext& frame) {
+    ProfileScope profile(ZONE_SKY);
+    bool shaded = starField.program != 0;
+    RenderState state = { PASS_SKY, BLEND_ADDITIVE, false, PRIM_POINTS, 0.0f, 0.0f,
+                          shaded ? MATERIAL_STAR_SHADER : MATERIAL_FIXED };
+    queueDraw(state, ZONE_SKY, shaded ? drawStarField : drawStarPoints);
+}
 
-    // Request a redisplay
-    glutPostRedisplay();
+// Pyramid and torus: neon wireframe, wider glow lines, then translucent lit
+// faces. GL_COLOR_MATERIAL makes the faces take the glow color.
+enum ShapePart {
+    SHAPE_EDGES,
+    SHAPE_GLOW,
+    SHAPE_FACES
+};
 
-    // Set the next timer callback
-    glutTimerFunc(16, timer, 0);
+static void queueShape(ProfileZone zone, RenderCallback draw, float edgeWidth, float glowWidth) {
+    RenderState faces = { PASS_LIT, BLEND_ADDITIVE, true, PRIM_FACES, 0.0f, 0.0f, MATERIAL_FIXED };
+    queueDraw(neonState(PRIM_LINES, edgeWidth), zone, draw, NULL, SHAPE_EDGES);
+    if (glowPassesActive()) queueDraw(neonState(PRIM_LINES, glowWidth), zone, draw, NULL, SHAPE_GLOW);
+    queueDraw(faces, zone, draw, NULL, SHAPE_FACES);
 }
 
-void keyboard(unsigned char key, int x, int y) {
-    float speed = 1.0f;
+static void drawPyramidPart(const FrameContext& frame, const void*, int part) {
+    float time = frame.time;
+    glPushMatrix();
 
-    switch (key) {
-        case 27: // ESC key
-            exit(0);
-            break;
-        case 'w': // Move forward
-            cameraX += lookX * speed;
-            cameraZ += lookZ * speed;
-            break;
-        case 's': // Move backward
-            cameraX -= lookX * speed;
-            cameraZ -= lookZ * speed;
-            break;
-        case 'd': // Strafe left
-            cameraX -= lookZ * speed;
-            cameraZ += lookX * speed;
-            break;
-        case 'a': // Strafe right
-            cameraX += lookZ * speed;
-            cameraZ -= lookX * speed;
-            break;
-        case 'q': // Move up
-            cameraY += speed;
-            break;
-        case 'e': // Move down
-            cameraY -= speed;
-            break;
-        case 'p': // Toggle music playback
-            audioPlayer.toggleMusic();
-            break;
-        case '+': // Increase volume
-            audioPlayer.adjustVolume(0.1f);
-            break;
-        case '-': // Decrease volume
-            audioPlayer.adjustVolume(-0.1f);
-            break;
+    // Position the pyramid in the sky
+    float hoverY = 20.0f + sinf(time * 0.5f) * 3.0f; // Hovering effect
+    glTranslatef(-30.0f, hoverY, -40.0f);
+
+    // Rotate the pyramid
+    glRotatef(time * 20.0f, 0.0f, 1.0f, 0.2f);
+
+    // Scale the pyramid
+    float scale = 3.0f + sinf(time * 0.7f) * 0.5f; // Pulsating scale
+    glScalef(scale, scale, scale);
+
+    // Use the retrowave colors - alternate between pink and cyan
+    // Choose color based on time for pulsing effect
+    bool usePink = (sinf(time * 0.5f) > 0);
+    float alpha = part == SHAPE_EDGES ? 0.95f : 0.3f;
+    if (usePink) {
+        RetroColor::Pink(frame, alpha); // Hot pink (classic retrowave color)
+    } else {
+        RetroColor::Cyan(frame, alpha); // Cyan (classic retrowave color)
     }
-    glutPostRedisplay();
-}
 
-void specialKeys(int key, int x, int y) {
-    float rotationSpeed = 0.05f;
+    Mesh& mesh = getMesh(MESH_PYRAMID);
+    bindMesh(mesh);
+    if (part == SHAPE_EDGES) {
+        // Base, then edges from base to apex
+        drawMeshPart(mesh, 0);
+        drawMeshPart(mesh, 1);
+    } else if (part == SHAPE_GLOW) {
+        // Redraw two edges with glow
+        drawMeshPart(mesh, 2);
+    } else {
+        GLfloat specular[] = {1.0f, 1.0f, 1.0f, 1.0f};
+        GLfloat shininess[] = {50.0f};
+        glMaterialfv(GL_FRONT, GL_SPECULAR, specular);
+        glMaterialfv(GL_FRONT, GL_SHININESS, shininess);
 
-    switch (key) {
-        case GLUT_KEY_UP:
-            lookY += rotationSpeed;
-            break;
-        case GLUT_KEY_DOWN:
-            lookY -= rotationSpeed;
-            break;
-        case GLUT_KEY_LEFT:
-            {
-                float tempX = lookX;
-                lookX = lookX * cosf(rotationSpeed) - lookZ * sinf(rotationSpeed);
-                lookZ = tempX * sinf(rotationSpeed) + lookZ * cosf(rotationSpeed);
-            }
-            break;
-        case GLUT_KEY_RIGHT:
-            {
-                float tempX = lookX;
-                lookX = lookX * cosf(-rotationSpeed) - lookZ * sinf(-rotationSpeed);
-                lookZ = tempX * sinf(-rotationSpeed) + lookZ * cosf(-rotationSpeed);
-            }
-            break;
+        // Draw semi-transparent faces for the pyramid
+        drawMeshPart(mesh, 3);
     }
+    unbindMesh(mesh);
 
-    // Normalize look vector
-    float length = sqrt(lookX * lookX + lookY * lookY + lookZ * lookZ);
-    lookX /= length;
-    lookY /= length;
-    lookZ /= length;
+    glPopMatrix();
+}
 
-    glutPostRedisplay();
+void drawPyramid(const FrameContext& frame) {
+    ProfileScope profile(ZONE_PYRAMID);
+    queueShape(ZONE_PYRAMID, drawPyramidPart, 2.5f, 4.0f);
 }
 
-void drawBuilding(const Building& building) {
-    float x = building.x;
-    float z = building.z;
-    float width = building.width;
-    float height = building.height;
-    float depth = building.depth;
-    float halfWidth = width / 2.0f;
-    float halfDepth = depth / 2.0f;
+static void drawTorusPart(const FrameContext& frame, const void*, int part) {
+    float time = frame.time;
+    glPushMatrix();
 
-    float time = glutGet(GLUT_ELAPSED_TIME) / 1000.0f;
-    float buildingOffset = sinf(time * 0.5f + x * 0.1f) * 0.2f;
+    // Position the torus
+    float orbitX = sinf(time * 0.4f) * 20.0f;
+    float orbitZ = cosf(time * 0.4f) * 20.0f;
+    glTranslatef(orbitX, 15.0f, -30.0f + orbitZ);
 
-    // Draw building with neon outlines
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-    glLineWidth(3.0f);  // Thicker lines for better visibility
+    // Rotate the torus continuously
+    glRotatef(time * 50.0f, 1.0f, 0.5f, 0.0f);
 
-    // Building outline color - hot pink (classic retrowave color)
-    RetroColor::Pink(time, 0.95f);
+    // Alternate between retrowave colors
+    int colorChoice = static_cast<int>(time * 0.2f) % 3;
+    float alpha = part == SHAPE_EDGES ? 0.95f : 0.3f;
+    switch (colorChoice) {
+        case 0: // Hot magenta/pink
+            RetroColor::Pink(frame, alpha);
+            break;
+        case 1: // Cyan/blue
+            RetroColor::Cyan(frame, alpha);
+            break;
+        case 2: // Vibrant yellow/gold
+            RetroColor::Gold(frame, alpha);
+            break;
+    }
 
-    // Front face - vertical edges
-    glBegin(GL_LINES);
-    // Left vertical edge
-    glVertex3f(x - halfWidth, 0.0f, z + halfDepth);
-    glVertex3f(x - halfWidth, height + buildingOffset, z + halfDepth);
+    int sides = qualitySegments(scene.torusSides, 3);
+    int rings = qualitySegments(scene.torusRings, 3);
+    if (part == SHAPE_EDGES) {
+        // Draw wireframe torus with retrowave colors
+        wireTorus(1.0f, 4.0f, sides, rings);
+    } else if (part == SHAPE_GLOW) {
+        // Redraw some rings for glow effect
+        wireTorus(1.1f, 4.1f, std::max(3, sides / 2), std::max(3, rings / 2));
+    } else {
+        GLfloat specular[] = {1.0f, 1.0f, 1.0f, 1.0f};
+        GLfloat shininess[] = {40.0f};
+        glMaterialfv(GL_FRONT, GL_SPECULAR, specular);
+        glMaterialfv(GL_FRONT, GL_SHININESS, shininess);
 
-    // Right vertical edge
-    glVertex3f(x + halfWidth, 0.0f, z + halfDepth);
-    glVertex3f(x + halfWidth, height + buildingOffset, z + halfDepth);
+        // Draw solid torus with transparency for glow effect
+        solidTorus(0.8f, 4.2f, sides, rings); // Different proportions for effect
+    }
 
-    // Horizontal edges - front face
-    glVertex3f(x - halfWidth, 0.0f, z + halfDepth);
-    glVertex3f(x + halfWidth, 0.0f, z + halfDepth);
+    glPopMatrix();
+}
 
-    glVertex3f(x - halfWidth, height + buildingOffset, z + halfDepth);
-    glVertex3f(x + halfWidth, height + buildingOffset, z + halfDepth);
+void drawTorus(const FrameContext& frame) {
+    ProfileScope profile(ZONE_TORUS);
+    queueShape(ZONE_TORUS, drawTorusPart, 2.5f, 4.0f);
+}
 
-    // Back face - vertical edges
-    glVertex3f(x - halfWidth, 0.0f, z - halfDepth);
-    glVertex3f(x - halfWidth, height + buildingOffset, z - halfDepth);
+void wireTorus(float innerRadius, float outerRadius, int sides, int rings) {
+    drawMesh(getMesh(MESH_WIRE_TORUS, sides, rings, innerRadius, outerRadius));
+}
 
-    glVertex3f(x + halfWidth, 0.0f, z - halfDepth);
-    glVertex3f(x + halfWidth, height + buildingOffset, z - halfDepth);
+void solidTorus(float innerRadius, float outerRadius, int sides, int rings) {
+    drawMesh(getMesh(MESH_SOLID_TORUS, sides, rings, innerRadius, outerRadius));
+}
 
-    // Horizontal edges - back face
-    glVertex3f(x - halfWidth, 0.0f, z - halfDepth);
-    glVertex3f(x + halfWidth, 0.0f, z - halfDepth);
+void calculateFPS(const FrameContext& frame) {
+    frameCount++;
+    currentTime = frame.time;
+    float timeInterval = currentTime - previousTime;
 
-    glVertex3f(x - halfWidth, height + buildingOffset, z - halfDepth);
-    glVertex3f(x + halfWidth, height + buildingOffset, z - halfDepth);
+    if (timeInterval >= 1.0f) {
+        fps = frameCount / timeInterval;
+        previousTime = currentTime;
+        frameCount = 0;
 
-    // Connect front to back - top edges
-    glVertex3f(x - halfWidth, height + buildingOffset, z + halfDepth);
-    glVertex3f(x - halfWidth, height + buildingOffset, z - halfDepth);
+        // Update window title with FPS
+        char title[128];
+        snprintf(title, sizeof(title), "Retro Wave city - 221003166 - 221001810 - FPS: %.1f - Stars: %d - Quality: %s",
+                 fps, scene.stars, currentQuality().name);
+        glutSetWindowTitle(title);
 
-    glVertex3f(x + halfWidth, height + buildingOffset, z + halfDepth);
-    glVertex3f(x + halfWidth, height + buildingOffset, z - halfDepth);
-    glEnd();
+        if (overdraw.enabled) {
+            printOverdrawStats(stdout);
+        }
+    }
+}
 
-    // Add outline glow for buildings
-    glLineWidth(5.0f);
-    RetroColor::Pink(time, 0.25f);  // Pink glow
+void logQualityLevel(const char* reason) {
+    const QualityLevel& level = currentQuality();
+    // The bench keeps stdout for its report
+    std::ostream& log = benchMode ? std::cerr : std::cout;
+    log << "Quality " << level.name << " (resolution " << static_cast<int>(level.resolutionScale * 100.0f + 0.5f)
+        << "%, tessellation " << static_cast<int>(level.tessellation * 100.0f + 0.5f)
+        << "%, glow " << (level.glow ? "on" : "off")
+        << ", stars " << static_cast<int>(level.starFraction * 100.0f + 0.5f) << "%): " << reason << std::endl;
+}
 
-    // Redraw front edges with glow
-    glBegin(GL_LINES);
-    // Left vertical edge
-    glVertex3f(x - halfWidth, 0.0f, z + halfDepth);
-    glVertex3f(x - halfWidth, height + buildingOffset, z + halfDepth);
+static void setQualityLevel(int level, const char* reason) {
+    QualityGovernor& governor = quality;
+    governor.level = level;
+    governor.averageMs = 0.0f;
+    governor.averageWorkMs = 0.0f;
+    governor.slowFrames = 0;
+    governor.fastFrames = 0;
+    governor.settleFrames = QUALITY_SETTLE_FRAMES;
+    governor.changes++;
+    governor.changed = true;
+    logQualityLevel(reason);
+}
 
-    // Right vertical edge
-    glVertex3f(x + halfWidth, 0.0f, z + halfDepth);
-    glVertex3f(x + halfWidth, height + buildingOffset, z + halfDepth);
+// Steps the quality level to hold the frame-time budget. One level down
+// after a short run of frames over budget, one up only after a much longer
+// run well under it; the gap between the two thresholds and the frames
+// left to settle after every change keep it from oscillating. A step up
+// that is undone soon after doubles the run needed for the next one. With
+// vsync the swap waits for the display, so headroom is judged on the frame
+// without it (the bench's swap is a glFinish and counts).
+void updateQualityGovernor() {
+    QualityGovernor& governor = quality;
+    governor.changed = false;
+    if (!governor.automatic || overdraw.enabled) return;
+
+    governor.sinceRaise++;
+    if (governor.sinceRaise > 20 * QUALITY_RAISE_FRAMES) governor.raiseAfter = QUALITY_RAISE_FRAMES;
+    if (governor.settleFrames > 0) {
+        governor.settleFrames--;
+        return;
+    }
 
-    // Top horizontal edge
-    glVertex3f(x - halfWidth, height + buildingOffset, z + halfDepth);
-    glVertex3f(x + halfWidth, height + buildingOffset, z + halfDepth);
-    glEnd();
-    glLineWidth(3.0f);
+    const ProfileFrame& frame = profilerLastFrame();
+    float frameMs = frame.duration / 1.0e6f;
+    float workMs = benchMode ? frameMs : frameMs - frame.zoneMs[ZONE_SWAP];
+    if (governor.averageMs == 0.0f) {
+        governor.averageMs = frameMs;
+        governor.averageWorkMs = workMs;
+    }
+    governor.averageMs += (frameMs - governor.averageMs) * 0.1f;
+    governor.averageWorkMs += (workMs - governor.averageWorkMs) * 0.1f;
 
-    // Draw windows - improved symmetrical version
-    // Calculate perfect grid for windows
-    int numFloors = static_cast<int>(height / 2.5f);
-    int windowsPerFloor = static_cast<int>(width / 1.2f);
+    governor.slowFrames = governor.averageMs > governor.budgetMs * 1.1f ? governor.slowFrames + 1 : 0;
+    governor.fastFrames = governor.averageWorkMs < governor.budgetMs * 0.7f ? governor.fastFrames + 1 : 0;
 
-    // Ensure minimum number of windows
-    numFloors = std::max(numFloors, 3);
-    windowsPerFloor = std::max(windowsPerFloor, 2);
+    char reason[96];
+    if (governor.slowFrames >= 10 && governor.level > 0) {
+        if (governor.sinceRaise < 4 * QUALITY_RAISE_FRAMES) {
+            governor.raiseAfter = std::min(governor.raiseAfter * 2, 16 * QUALITY_RAISE_FRAMES);
+        }
+        snprintf(reason, sizeof(reason), "%.1f ms frames, over the %.1f ms budget", governor.averageMs, governor.budgetMs);
+        setQualityLevel(governor.level - 1, reason);
+    } else if (governor.fastFrames >= governor.raiseAfter && governor.level + 1 < QUALITY_LEVEL_COUNT) {
+        snprintf(reason, sizeof(reason), "%.1f ms frames, well under the %.1f ms budget", governor.averageWorkMs,
+                 governor.budgetMs);
+        governor.sinceRaise = 0;
+        setQualityLevel(governor.level + 1, reason);
+    }
+}
 
-    // Window properties
-    float windowWidth = width / (windowsPerFloor + 1);
-    float windowHeight = windowWidth * 1.5f; // Rectangular windows
-    float floorHeight = (height - 2.0f) / numFloors;
+// Off, the top level is restored and held
+void toggleQualityGovernor() {
+    quality.automatic = !quality.automatic;
+    if (quality.automatic) {
+        logQualityLevel("adaptive, holding the frame-time budget");
+    } else {
+        setQualityLevel(QUALITY_LEVEL_COUNT - 1, "fixed");
+    }
+}
 
-    float windowPulse = 0.7f + 0.3f * sinf(time * 1.5f);
-    float globalWindowIntensity = 0.6f + 0.4f * sinf(time * 0.3f); // Stronger building pulse
+// "auto" or a level name or number (0 = minimal)
+bool parseQualityMode(const char* mode) {
+    if (strcmp(mode, "auto") == 0) {
+        quality.automatic = true;
+        return true;
+    }
+    for (int level = 0; level < QUALITY_LEVEL_COUNT; level++) {
+        if (strcmp(mode, qualityLevels[level].name) == 0 ||
+            (isdigit(static_cast<unsigned char>(mode[0])) && atoi(mode) == level)) {
+            quality.automatic = false;
+            quality.level = level;
+            return true;
+        }
+    }
+    std::cerr << "Unknown quality " << mode << ", expected auto or minimal..ultra" << std::endl;
+    return false;
+}
 
-    // Set window colors - use only classic retrowave colors
-    const int numColors = 3;
-    float colors[numColors][3] = {
-        {0.0f, 0.9f, 1.0f},  // Brighter Cyan/Teal
-        {1.0f, 0.8f, 0.0f},  // Golden/Orange
-        {1.0f, 0.3f, 0.7f}   // Hot Pink/Magenta
-    };
+void profilerBeginFrame() {
+    ProfileFrame& frame = profiler.frames[profiler.current];
+    frame.start = profilerNow();
+    frame.duration = 0;
+    frame.eventCount = 0;
+    for (int z = 0; z < ZONE_COUNT; z++) frame.zoneMs[z] = 0.0f;
+    profiler.frameAllocations = heapAllocations.load();
+    profiler.frameBytes = heapBytes.load();
+}
 
-    // Determine color palette for this building based on its position
-    int buildingColorScheme = static_cast<int>(fabs(x * 1000)) % numColors;
-
-    // Draw windows on front face only, in perfect grid
-    for (int floor = 0; floor < numFloors; floor++) {
-        float floorY = 2.0f + floor * floorHeight;
-
-        for (int w = 0; w < windowsPerFloor; w++) {
-            // Calculate window position
-            float windowX = x - halfWidth + (width / (windowsPerFloor + 1)) * (w + 1);
-            float windowY = floorY + floorHeight * 0.5f;
-
-            // Skip some windows randomly but consistently for this building (based on position)
-            int hash = static_cast<int>((windowX * 100 + windowY * 50 + x * z * 10) * 10) % 10;
-            if (hash < 3 && floor > 0) continue; // 30% chance of missing window except on first floor
-
-            // Draw window outline (black)
-            glColor4f(0.0f, 0.0f, 0.0f, 0.9f);
-            glBegin(GL_QUADS);
-            glVertex3f(windowX - windowWidth/2, windowY - windowHeight/2, z + halfDepth + 0.01f);
-            glVertex3f(windowX + windowWidth/2, windowY - windowHeight/2, z + halfDepth + 0.01f);
-            glVertex3f(windowX + windowWidth/2, windowY + windowHeight/2, z + halfDepth + 0.01f);
-            glVertex3f(windowX - windowWidth/2, windowY + windowHeight/2, z + halfDepth + 0.01f);
-            glEnd();
+void profilerEndFrame() {
+    ProfileFrame& frame = profiler.frames[profiler.current];
+    frame.duration = profilerNow() - frame.start;
+    frame.allocations = heapAllocations.load() - profiler.frameAllocations;
+    frame.allocatedBytes = heapBytes.load() - profiler.frameBytes;
+    profiler.current = (profiler.current + 1) % PROFILER_HISTORY;
+    profiler.frameCount++;
+}
 
-            // Determine window color - vary by floor for a pattern
-            int colorIndex = (buildingColorScheme + floor) % numColors;
+const ProfileFrame& profilerLastFrame() {
+    return profiler.frames[(profiler.current + PROFILER_HISTORY - 1) % PROFILER_HISTORY];
+}
 
-            // Create lighting pattern across the building (brightest in middle)
-            float centerFactor = 1.0f - 2.0f * fabs((w + 0.5f) / windowsPerFloor - 0.5f); // 0-1-0 across building
-            float heightFactor = 1.0f - (float)floor / numFloors * 0.3f; // brighter at bottom
+static void drawOverlayText(float x, float y, const char* text) {
+    glRasterPos2f(x, y);
+    for (const char* c = text; *c != '\0'; c++) {
+        glutBitmapCharacter(GLUT_BITMAP_HELVETICA_10, *c);
+    }
+}
 
-            // Window light intensity
-            float blink = 1.0f;
-            if (hash == 8) { // 10% chance of blinking window
-                blink = (sin(time * (5.0f + hash)) > 0) ? 1.0f : 0.3f;
-            }
+// Stacked per-zone frame-time bars for the recorded history, newest on the right
+void drawProfilerOverlay() {
+    const float barWidth = 2.0f;
+    const float graphHeight = 150.0f;
+    const float msScale = graphHeight / 33.3f; // Top of the graph is 30 FPS
+    const float left = 10.0f, bottom = 10.0f;
 
-            float intensity = windowPulse * globalWindowIntensity * centerFactor * heightFactor * blink;
+    glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
 
-            // Set window color and draw
-            glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-            glColor4f(
-                colors[colorIndex][0] * intensity,
-                colors[colorIndex][1] * intensity,
-                colors[colorIndex][2] * intensity,
-                0.95f
-            );
-
-            // Margin inside window
-            float margin = windowWidth * 0.15f;
-
-            // Draw window inner
-            glBegin(GL_QUADS);
-            glVertex3f(windowX - windowWidth/2 + margin, windowY - windowHeight/2 + margin, z + halfDepth + 0.02f);
-            glVertex3f(windowX + windowWidth/2 - margin, windowY - windowHeight/2 + margin, z + halfDepth + 0.02f);
-            glVertex3f(windowX + windowWidth/2 - margin, windowY + windowHeight/2 - margin, z + halfDepth + 0.02f);
-            glVertex3f(windowX - windowWidth/2 + margin, windowY + windowHeight/2 - margin, z + halfDepth + 0.02f);
-            glEnd();
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    gluOrtho2D(0, windowWidth, 0, windowHeight);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
 
-            // Add window glow
-            glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-            float glowIntensity = intensity * 0.6f;
-
-            // Stronger glow
-            glColor4f(
-                colors[colorIndex][0],
-                colors[colorIndex][1],
-                colors[colorIndex][2],
-                glowIntensity
-            );
-
-            // Draw simple glow around window
-            float glowSize = windowWidth * 2.0f;  // Larger glow
-            glBegin(GL_QUADS);
-            glVertex3f(windowX - glowSize/2, windowY - glowSize/2, z + halfDepth + 0.015f);
-            glVertex3f(windowX + glowSize/2, windowY - glowSize/2, z + halfDepth + 0.015f);
-            glVertex3f(windowX + glowSize/2, windowY + glowSize/2, z + halfDepth + 0.015f);
-            glVertex3f(windowX - glowSize/2, windowY + glowSize/2, z + halfDepth + 0.015f);
-            glEnd();
+    int frames = static_cast<int>(std::min<long long>(profiler.frameCount, PROFILER_HISTORY));
+    glBegin(GL_QUADS);
+    for (int i = 0; i < frames; i++) {
+        const ProfileFrame& frame = profiler.frames[(profiler.current + PROFILER_HISTORY - frames + i) % PROFILER_HISTORY];
+        float x = left + i * barWidth;
+        float y = bottom;
+        for (int z = 0; z < ZONE_COUNT; z++) {
+            float h = frame.zoneMs[z] * msScale;
+            glColor3fv(profileZoneColors[z]);
+            glVertex2f(x, y);
+            glVertex2f(x + barWidth, y);
+            glVertex2f(x + barWidth, y + h);
+            glVertex2f(x, y + h);
+            y += h;
         }
     }
+    glEnd();
 
-    glLineWidth(1.0f);
-    glDisable(GL_BLEND);
-}
-
-void drawGrid(float size, int divisions) {
-    float step = size / divisions;
-    float halfSize = size / 2.0f;
-    float startY = 0.0f;
-    float time = glutGet(GLUT_ELAPSED_TIME) / 1000.0f;
+    // 60 FPS budget line
+    glColor3f(1.0f, 1.0f, 1.0f);
+    glBegin(GL_LINES);
+    glVertex2f(left, bottom + 16.6f * msScale);
+    glVertex2f(left + PROFILER_HISTORY * barWidth, bottom + 16.6f * msScale);
+    glEnd();
 
-    // Enable blending for grid glow
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+    // Legend with the average of each zone over the history
+    char label[64];
+    for (int z = 0; z < ZONE_COUNT; z++) {
+        float average = 0.0f;
+        for (int i = 0; i < frames; i++) average += profiler.frames[i].zoneMs[z];
+        if (frames > 0) average /= frames;
 
-    // Animation offset with smooth movement
-    float offsetZ = fmodf(gridOffset * step, step);
-    float speedFactor = 1.0f + 0.5f * sinf(time * 0.3f);
-    offsetZ *= speedFactor;
+        snprintf(label, sizeof(label), "%s %.2f ms", profileZoneNames[z], average);
+        glColor3fv(profileZoneColors[z]);
+        drawOverlayText(left + PROFILER_HISTORY * barWidth + 10.0f, bottom + graphHeight - z * 12.0f, label);
+    }
 
-    // Draw grid lines along Z axis (pink/magenta)
-    for (int i = 0; i <= divisions; i++) {
-        float x = -halfSize + i * step;
-        float brightness = 1.0f - fabsf(x) / halfSize; // Fade out at edges
+    // Culling counters for the last frame
+    glColor3f(1.0f, 1.0f, 1.0f);
+    for (int c = 0; c < CULL_CATEGORY_COUNT; c++) {
+        snprintf(label, sizeof(label), "%s: %d drawn, %d culled",
+                 cullCategoryNames[c], cullStats.drawn[c], cullStats.culled[c]);
+        drawOverlayText(left, bottom + graphHeight + 20.0f + c * 12.0f, label);
+    }
 
-        // Skip some lines for a cleaner look
-        if (i % 2 != 0 && abs(i - divisions/2) > 5) continue;
+    // Render queue for the last frame
+    const RenderQueueStats& queue = renderQueue.stats;
+    snprintf(label, sizeof(label), "queue: %d commands, %d state changes, %d saved",
+             queue.commands, queue.stateChanges, queue.stateChangesSaved);
+    drawOverlayText(left, bottom + graphHeight + 20.0f + CULL_CATEGORY_COUNT * 12.0f, label);
 
-        // Adjust color for neon effect - more vibrant magenta
-        float pulse = 0.7f + 0.3f * sinf(time * 2.0f + i * 0.1f);
-        float alpha = 0.4f + 0.6f * brightness * pulse;
-        RetroColor::Pink(time, alpha);
+    // Heap traffic of the last frame, which should stay at zero
+    const ProfileFrame& last = profilerLastFrame();
+    if (last.allocations > 0) glColor3f(1.0f, 0.3f, 0.3f);
+    snprintf(label, sizeof(label), "heap: %lld allocations, %lld bytes; frame arena %zu KB",
+             last.allocations, last.allocatedBytes, frameArena.peak / 1024);
+    drawOverlayText(left, bottom + graphHeight + 32.0f + CULL_CATEGORY_COUNT * 12.0f, label);
 
-        // Draw thicker line
-        glLineWidth(2.5f);
-        glBegin(GL_LINES);
-        glVertex3f(x, startY, -halfSize + offsetZ);
-        glVertex3f(x, startY, halfSize + offsetZ);
-        glEnd();
-    }
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopAttrib();
+}
 
-    // Draw grid lines along X axis (cyan/blue)
-    for (int i = 0; i <= divisions; i++) {
-        float z = -halfSize + i * step + offsetZ;
-        if (z > halfSize) continue;
+// Heatmap of the last frame's fragments per pixel with a per-zone breakdown
+void drawOverdrawView() {
+    if (overdraw.heatmap.size() != static_cast<size_t>(windowWidth) * windowHeight * 3) return;
 
-        float brightness = 1.0f - fabsf(z) / halfSize; // Fade out at distance
+    glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_DEPTH_TEST);
+    glDisable(GL_BLEND);
 
-        // Skip some lines for a cleaner look
-        if (i % 2 != 0 && i > 5) continue;
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    gluOrtho2D(0, windowWidth, 0, windowHeight);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
 
-        float pulse = 0.7f + 0.3f * sinf(time * 2.0f + i * 0.1f + 1.5f);
-        float alpha = 0.4f + 0.6f * brightness * pulse;
-        RetroColor::Cyan(time, alpha);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glRasterPos2i(0, 0);
+    glDrawPixels(windowWidth, windowHeight, GL_RGB, GL_UNSIGNED_BYTE, &overdraw.heatmap[0]);
+
+    // Legend along the top, then fragments per zone. GLUT fonts need
+    // glutInit, which the headless bench never calls, so it gets swatches only.
+    const int legend[] = { 1, 2, 4, 8, 16, 32 };
+    const int legendCount = sizeof(legend) / sizeof(legend[0]);
+    const float top = windowHeight - 20.0f;
+    char label[64];
+    for (int i = 0; i < legendCount; i++) {
+        unsigned char rgb[3];
+        heatmapColor(legend[i], rgb);
+        glColor3ub(rgb[0], rgb[1], rgb[2]);
+        glRectf(10.0f + i * 50.0f, top, 50.0f + i * 50.0f, top + 10.0f);
+        if (!benchMode) {
+            snprintf(label, sizeof(label), "%d%s", legend[i], i + 1 == legendCount ? "+" : "");
+            glColor3f(1.0f, 1.0f, 1.0f);
+            drawOverlayText(10.0f + i * 50.0f, top - 14.0f, label);
+        }
+    }
 
-        // Draw thicker line
-        glLineWidth(2.5f);
-        glBegin(GL_LINES);
-        glVertex3f(-halfSize, startY, z);
-        glVertex3f(halfSize, startY, z);
-        glEnd();
+    if (!benchMode) {
+        const OverdrawStats& stats = overdraw.stats;
+        double pixels = static_cast<double>(windowWidth) * windowHeight;
+        snprintf(label, sizeof(label), "%.2f fragments/pixel, max %d", stats.total / pixels, stats.maxDepth);
+        glColor3f(1.0f, 1.0f, 1.0f);
+        drawOverlayText(10.0f, top - 32.0f, label);
+        int row = 0;
+        for (int z = 0; z < ZONE_COUNT; z++) {
+            if (stats.fragments[z] == 0) continue;
+            snprintf(label, sizeof(label), "%s %.2f/px (%.0f%%)", profileZoneNames[z],
+                     stats.fragments[z] / pixels, 100.0 * stats.fragments[z] / std::max(1LL, stats.total));
+            glColor3fv(profileZoneColors[z]);
+            drawOverlayText(10.0f, top - 48.0f - row * 12.0f, label);
+            row++;
+        }
     }
 
-    glDisable(GL_BLEND);
-    glLineWidth(1.0f);
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopAttrib();
 }
 
-void drawSpinners() {
-    float time = glutGet(GLUT_ELAPSED_TIME) / 1000.0f;
+// Tab: the car's speed, boost and collision counters, top right
+void drawRaceStats() {
+    const PlayerCar& car = simRender.player;
+    float speed = sqrtf(car.velocityX * car.velocityX + car.velocityZ * car.velocityZ);
+    double ticks = static_cast<double>(std::max(1LL, car.ticks));
+    char lines[5][64];
+    snprintf(lines[0], sizeof(lines[0]), "speed %.0f%s", speed, car.drifting ? "  DRIFT" : "");
+    snprintf(lines[1], sizeof(lines[1]), "boost %.0f%%", car.boost * 100.0f);
+    snprintf(lines[2], sizeof(lines[2]), "contacts %lld", car.contacts);
+    snprintf(lines[3], sizeof(lines[3]), "swept %.1f  tested %.1f per tick", car.swept / ticks, car.tested / ticks);
+    snprintf(lines[4], sizeof(lines[4]), "physics %.1f us per tick", car.physicsNanoseconds / ticks / 1000.0);
+
+    glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_DEPTH_TEST);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    gluOrtho2D(0, windowWidth, 0, windowHeight);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
 
-    // Draw each spinner
-    for (size_t i = 0; i < spinners.size(); i++) {
-        drawSpinner(spinners[i], time);
+    glColor3f(1.0f, 0.4f, 0.9f);
+    for (int i = 0; i < 5; i++) {
+        drawOverlayText(windowWidth - 220.0f, windowHeight - 20.0f - i * 14.0f, lines[i]);
     }
+
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopAttrib();
 }
 
-void drawSpinner(const Spinner& spinner, float time) {
-    glPushMatrix();
-    glTranslatef(spinner.x, spinner.y, spinner.z);
-    glRotatef(spinner.rotation, 0.0f, 0.0f, 1.0f);
+// Quality level and frame-time budget, bottom right, clear of the frame-time
+// graph in the bottom left
+void drawQualityLabel() {
+    char label[96];
+    snprintf(label, sizeof(label), "quality %s%s  %.1f ms / %.1f ms", currentQuality().name,
+             quality.automatic ? " (auto)" : "", profilerLastFrame().duration / 1.0e6, quality.budgetMs);
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+    glPushAttrib(GL_ENABLE_BIT | GL_CURRENT_BIT);
+    glDisable(GL_LIGHTING);
+    glDisable(GL_DEPTH_TEST);
+    glMatrixMode(GL_PROJECTION);
+    glPushMatrix();
+    glLoadIdentity();
+    gluOrtho2D(0, windowWidth, 0, windowHeight);
+    glMatrixMode(GL_MODELVIEW);
+    glPushMatrix();
+    glLoadIdentity();
 
-    float pulse = 0.7f + 0.3f * sinf(time * 2.0f);
-    int segments = 24;
-    float radius = spinner.radius;
+    glColor3f(0.0f, 0.8f, 1.0f);
+    int width = glutBitmapLength(GLUT_BITMAP_HELVETICA_10, reinterpret_cast<const unsigned char*>(label));
+    drawOverlayText(windowWidth - 10.0f - width, 10.0f, label);
 
-    if (spinner.type == 0) {  // Circular spinner
-        // Draw a circular spinner
-        glLineWidth(2.0f);
-        glBegin(GL_LINE_LOOP);
-        for (int i = 0; i < segments; i++) {
-            float angle = static_cast<float>(i) / segments * 2.0f * M_PI;
+    glPopMatrix();
+    glMatrixMode(GL_PROJECTION);
+    glPopMatrix();
+    glMatrixMode(GL_MODELVIEW);
+    glPopAttrib();
+}
 
-            if (spinner.isPink) {
-                RetroColor::Pink(time, 0.8f);
-            } else {
-                RetroColor::Cyan(time, 0.8f);
-            }
+// Writes the recorded history in Chrome trace_event format (chrome://tracing, Perfetto)
+bool writeChromeTrace(const char* path) {
+    FILE* file = fopen(path, "w");
+    if (file == NULL) {
+        std::cerr << "Failed to write trace: " << path << std::endl;
+        return false;
+    }
 
-            float x = radius * cosf(angle);
-            float y = radius * sinf(angle);
-            glVertex3f(x, y, 0.0f);
+    fprintf(file, "{\"traceEvents\":[\n");
+    bool first = true;
+    int frames = static_cast<int>(std::min<long long>(profiler.frameCount, PROFILER_HISTORY));
+    for (int i = 0; i < frames; i++) {
+        const ProfileFrame& frame = profiler.frames[(profiler.current + PROFILER_HISTORY - frames + i) % PROFILER_HISTORY];
+        fprintf(file, "%s{\"name\":\"frame\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f,"
+                "\"args\":{\"allocations\":%lld,\"allocated_bytes\":%lld}}",
+                first ? "" : ",\n", frame.start / 1000.0, frame.duration / 1000.0, frame.allocations, frame.allocatedBytes);
+        first = false;
+        for (int e = 0; e < frame.eventCount; e++) {
+            const ProfileEvent& event = frame.events[e];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":1,\"ts\":%.3f,\"dur\":%.3f}",
+                    profileZoneNames[event.zone], event.start / 1000.0, event.duration / 1000.0);
         }
-        glEnd();
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    return true;
+}
 
-        // Draw spokes
-        glBegin(GL_LINES);
-        for (int i = 0; i < segments/4; i++) {
-            float angle = static_cast<float>(i) / (segments/4) * 2.0f * M_PI;
+#ifndef _WIN32
+// Surfaceless EGL display with a pbuffer, e.g. Mesa llvmpipe on a build machine
+static bool createHeadlessContext(int width, int height) {
+    PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+        reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    EGLDisplay display = getPlatformDisplay
+        ? getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL)
+        : eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major, minor;
+    if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+        std::cerr << "Failed to initialize EGL display" << std::endl;
+        return false;
+    }
 
-            if (spinner.isPink) {
-                RetroColor::Pink(time, 0.5f);
-            } else {
-                RetroColor::Cyan(time, 0.5f);
-            }
+    const EGLint configAttribs[] = {
+        EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8,
+        EGL_DEPTH_SIZE, 24, EGL_STENCIL_SIZE, 8,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(display, configAttribs, &config, 1, &numConfigs) || numConfigs == 0) {
+        std::cerr << "No EGL pbuffer config available" << std::endl;
+        return false;
+    }
 
-            glVertex3f(0.0f, 0.0f, 0.0f);
-            glVertex3f(radius * cosf(angle), radius * sinf(angle), 0.0f);
-        }
-        glEnd();
+    const EGLint surfaceAttribs[] = { EGL_WIDTH, width, EGL_HEIGHT, height, EGL_NONE };
+    EGLSurface surface = eglCreatePbufferSurface(display, config, surfaceAttribs);
+
+    eglBindAPI(EGL_OPENGL_API);
+    EGLContext context = eglCreateContext(display, config, EGL_NO_CONTEXT, NULL);
+    if (surface == EGL_NO_SURFACE || context == EGL_NO_CONTEXT ||
+        !eglMakeCurrent(display, surface, surface, context)) {
+        std::cerr << "Failed to create EGL pbuffer context" << std::endl;
+        return false;
+    }
+    return true;
+}
+#else
+// A hidden GLUT window stands in for the offscreen surface on Windows
+static bool createHeadlessContext(int width, int height) {
+    int argc = 1;
+    char name[] = "retrowave";
+    char* argv[] = { name, NULL };
+    glutInit(&argc, argv);
+    glutInitDisplayMode(GLUT_DOUBLE | GLUT_RGB | GLUT_DEPTH | GLUT_STENCIL);
+    glutInitWindowSize(width, height);
+    glutCreateWindow("Retrowave City (benchmark)");
+    glutHideWindow();
+    return true;
+}
+#endif
 
-    } else {  // Spiral spinner
-        // Draw a spiral spinner
-        int rings = 5;
-        float ringStep = radius / rings;
+struct FrameStats {
+    double min, mean, p50, p95, p99, max;
+};
 
-        for (int r = 0; r < rings; r++) {
-            float innerRadius = r * ringStep;
-            float outerRadius = (r + 1) * ringStep;
+static FrameStats computeFrameStats(std::vector<double> samples) {
+    FrameStats stats = { 0, 0, 0, 0, 0, 0 };
+    if (samples.empty()) return stats;
+
+    std::sort(samples.begin(), samples.end());
+    double sum = 0.0;
+    for (size_t i = 0; i < samples.size(); i++) sum += samples[i];
+
+    size_t last = samples.size() - 1;
+    stats.min = samples[0];
+    stats.max = samples[last];
+    stats.mean = sum / samples.size();
+    stats.p50 = samples[static_cast<size_t>(last * 0.50 + 0.5)];
+    stats.p95 = samples[static_cast<size_t>(last * 0.95 + 0.5)];
+    stats.p99 = samples[static_cast<size_t>(last * 0.99 + 0.5)];
+    return stats;
+}
 
-            // Make the spiral
-            glBegin(GL_LINE_STRIP);
-            for (int i = 0; i <= segments; i++) {
-                float angle = static_cast<float>(i) / segments * 2.0f * M_PI;
+static void printFrameStats(const FrameStats& s) {
+    printf("{ \"min\": %.3f, \"mean\": %.3f, \"p50\": %.3f, \"p95\": %.3f, \"p99\": %.3f, \"max\": %.3f }",
+           s.min, s.mean, s.p50, s.p95, s.p99, s.max);
+}
 
-                // Alternate colors along the spiral
-                if ((r + i) % 2 == 0) {
-                    RetroColor::Pink(time, 0.8f);
-                } else {
-                    RetroColor::Cyan(time, 0.8f);
-                }
+static void readFramePixels(std::vector<unsigned char>& pixels, int width, int height) {
+    pixels.resize(width * height * 3);
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glReadPixels(0, 0, width, height, GL_RGB, GL_UNSIGNED_BYTE, &pixels[0]);
+}
 
-                float radius = innerRadius + (outerRadius - innerRadius) * i / segments;
-                float x = radius * cosf(angle);
-                float y = radius * sinf(angle);
-                glVertex3f(x, y, 0.0f);
-            }
-            glEnd();
-        }
+static bool writeFramePPM(const char* path, int width, int height) {
+    std::vector<unsigned char> pixels;
+    readFramePixels(pixels, width, height);
 
-        // Draw a circular outline
-        glBegin(GL_LINE_LOOP);
-        for (int i = 0; i < segments; i++) {
-            float angle = static_cast<float>(i) / segments * 2.0f * M_PI;
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        std::cerr << "Failed to write capture: " << path << std::endl;
+        return false;
+    }
+    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    for (int y = height - 1; y >= 0; y--) {
+        fwrite(&pixels[y * width * 3], 1, width * 3, file);
+    }
+    fclose(file);
+    return true;
+}
 
-            if (i % 2 == 0) {
-                RetroColor::Pink(time, 0.8f);
-            } else {
-                RetroColor::Cyan(time, 0.8f);
-            }
+// Heap allocations made by the recorded (steady-state) frames
+struct BenchAllocations {
+    int frames;
+    int allocatingFrames;
+    long long total;
+    long long bytes;
+    long long maxPerFrame;
+    int levelChangeFrames;  // First frames at a new quality level, not counted
+};
 
-            float x = radius * cosf(angle);
-            float y = radius * sinf(angle);
-            glVertex3f(x, y, 0.0f);
+BenchAllocations benchAllocations;
+
+// Renders the warmup frames, then benchFrames recorded ones
+static void runBenchFrames(std::vector<double>& frameTimes, std::vector<double>* zoneTimes) {
+    frameTimes.reserve(benchFrames);
+    for (int z = 0; z < ZONE_COUNT; z++) zoneTimes[z].reserve(benchFrames);
+
+    int totalFrames = benchWarmupFrames + benchFrames;
+    for (int i = 0; i < totalFrames; i++) {
+        FrameContext frame = makeFrameContext(benchClock + BENCH_FRAME_STEP, benchClock);
+        benchClock = frame.time;
+
+        // The first frame at a new quality level builds its meshes and targets
+        bool newLevel = quality.changed;
+        profilerBeginFrame();
+        renderFrame(frame);
+        {
+            ProfileScope profile(ZONE_SWAP);
+            glFinish();
         }
-        glEnd();
+        profilerEndFrame();
+        updateQualityGovernor();
+
+        if (i < benchWarmupFrames) continue;
+        const ProfileFrame& recorded = profilerLastFrame();
+        frameTimes.push_back(recorded.duration / 1.0e6);
+        for (int z = 0; z < ZONE_COUNT; z++) {
+            zoneTimes[z].push_back(recorded.zoneMs[z]);
+        }
+        BenchAllocations& allocations = benchAllocations;
+        if (newLevel) {
+            allocations.levelChangeFrames++;
+            continue;
+        }
+        allocations.frames++;
+        if (recorded.allocations > 0) allocations.allocatingFrames++;
+        allocations.total += recorded.allocations;
+        allocations.bytes += recorded.allocatedBytes;
+        allocations.maxPerFrame = std::max(allocations.maxPerFrame, recorded.allocations);
     }
-
-    glLineWidth(1.0f);
-    glDisable(GL_BLEND);
-    glPopMatrix();
 }
 
-// Updated tunnel function to make it bigger
-void drawTunnel(float radius, int segments, int rings) {
-    float time = glutGet(GLUT_ELAPSED_TIME) / 1000.0f;
-
-    // Position the tunnel in the sky - adjusted position for bigger tunnel
-    glPushMatrix();
-    glTranslatef(0.0f, 40.0f, -90.0f); // Moved higher and farther back
+// Simulation and clock at the start of the recorded frames, so compared
+// runs draw exactly the same frames
+struct BenchStart {
+    SimState previous, current;
+    SimState render;  // The bench's driver steers from the last drawn state
+    BenchDriver driver;
+    float accumulator, clock;
+};
 
-    // Rotate for better visibility
-    glRotatef(15.0f, 1.0f, 0.0f, 0.0f);
+// The simulation thread is stopped around both, as it owns the state
+static BenchStart saveBenchStart() {
+    stopSimulationThread();
+    BenchStart start = { simPrevious, simCurrent, simRender, benchDriver, simAccumulator, benchClock };
+    startSimulationThread(benchClock);
+    return start;
+}
 
-    // Spin the tunnel
-    glRotatef(vortexAngle * 0.2f, 0.0f, 0.0f, 1.0f);
+static void restoreBenchStart(const BenchStart& start) {
+    stopSimulationThread();
+    simPrevious = start.previous;
+    simCurrent = start.current;
+    simRender = start.render;
+    benchDriver = start.driver;
+    simAccumulator = start.accumulator;
+    benchClock = start.clock;
+    startSimulationThread(benchClock);
+}
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+struct ThreadSweepRun {
+    int threads;
+    FrameStats frame, geometry;
+    bool identical; // Last frame matches the single-threaded one
+};
 
-    // INCREASED RADIUS from 30.0f to 50.0f to make the tunnel bigger
-    radius = 50.0f;
+// Renders benchFrames frames on a fixed 60 Hz clock and prints JSON stats
+int runBenchmark() {
+    if (!createHeadlessContext(benchWidth, benchHeight)) {
+        return 1;
+    }
 
-    // Draw tunnel grid lines
-    glLineWidth(2.0f);
+    // The fixed camera keeps the resident chunks, and so the runs, the same.
+    // Driving streams chunks in and out, so it only runs once.
+    chaseCamera = benchDrive;
+    if (benchDrive && (benchThreadSweep || benchCompareBloom)) {
+        std::cerr << "--bench-drive runs the frames once; ignoring --threads sweep and --bloom compare" << std::endl;
+        benchThreadSweep = false;
+        benchCompareBloom = false;
+    }
 
-    // Draw radial lines
-    for (int i = 0; i < segments; i++) {
-        float angle = static_cast<float>(i) / segments * 2.0f * M_PI;
-        float x = radius * cosf(angle);
-        float y = radius * sinf(angle);
+    // Runs are only comparable on the same scene
+    if (!seedGiven) {
+        worldSeed = BENCH_DEFAULT_SEED;
+        seedGiven = true;
+    }
 
-        // Pink for odd radials, blue for even
-        if (i % 2 == 0) {
-            RetroColor::Pink(time, 0.8f);
-        } else {
-            RetroColor::Cyan(time, 0.8f);
+    // ... and at the same quality unless --quality asks otherwise
+    if (!qualityGiven) quality.automatic = false;
+    init();
+    reshape(benchWidth, benchHeight);
+
+    // Charge deferred GPU work to the scope that issued it
+    profiler.syncGPU = true;
+
+    std::vector<double> frameTimes;
+    std::vector<double> zoneTimes[ZONE_COUNT];
+    BenchStart start = saveBenchStart();
+
+    // Same frames on 1, 2, 4... threads, up to the hardware threads (at least 4)
+    std::vector<ThreadSweepRun> sweep;
+    if (benchThreadSweep) {
+        int maxThreads = std::max(4, static_cast<int>(std::thread::hardware_concurrency()));
+        std::vector<int> counts;
+        for (int threads = 1; threads < maxThreads; threads *= 2) counts.push_back(threads);
+        counts.push_back(maxThreads);
+
+        std::vector<unsigned char> serialPixels, pixels;
+        for (size_t i = 0; i < counts.size(); i++) {
+            int threads = counts[i];
+            stopJobSystem();
+            startJobSystem(threads);
+            restoreBenchStart(start);
+            runBenchFrames(frameTimes, zoneTimes);
+            readFramePixels(threads == 1 ? serialPixels : pixels, benchWidth, benchHeight);
+
+            ThreadSweepRun run = { threads, computeFrameStats(frameTimes), computeFrameStats(zoneTimes[ZONE_GEOMETRY]),
+                                   threads == 1 || pixels == serialPixels };
+            sweep.push_back(run);
+            frameTimes.clear();
+            for (int z = 0; z < ZONE_COUNT; z++) zoneTimes[z].clear();
         }
+        stopJobSystem();
+        startJobSystem(jobThreadCount);
+        restoreBenchStart(start);
+    }
 
-        glBegin(GL_LINE_STRIP);
-        for (int r = 0; r < rings; r++) {
-            // Increased depth range for a deeper tunnel
-            float depth = -50.0f + r * 3.0f + tunnelDepth;
-            float scaleFactor = (1.0f - r / (float)rings) * 0.9f + 0.1f;
-
-            // Create a perspective effect
-            float currX = x * scaleFactor;
-            float currY = y * scaleFactor;
+    // Same frames twice from the same start: glow passes, then bloom
+    std::vector<double> glowFrameTimes;
+    if (benchCompareBloom) {
+        bloom.enabled = false;
+        runBenchFrames(glowFrameTimes, zoneTimes);
+        for (int z = 0; z < ZONE_COUNT; z++) zoneTimes[z].clear();
 
-            glVertex3f(currX, currY, depth);
-        }
-        glEnd();
+        restoreBenchStart(start);
+        bloom.enabled = true;
     }
+    long long simBusyStart = simThread.busyNanoseconds.load();
+    long long adoptedStart = streamer.adopted, evictedStart = streamer.evicted;
+    runBenchFrames(frameTimes, zoneTimes);
+    double simBusyMs = (simThread.busyNanoseconds.load() - simBusyStart) / 1.0e6 / (benchWarmupFrames + benchFrames);
 
-    // Draw concentric rings with increased count
-    for (int r = 0; r < rings + 5; r++) { // Added 5 more rings
-        // Increased depth range
-        float depth = -50.0f + r * 3.0f + tunnelDepth;
-        float scaleFactor = (1.0f - r / (float)rings) * 0.9f + 0.1f;
+    if (benchCapturePath != NULL) {
+        writeFramePPM(benchCapturePath, benchWidth, benchHeight);
+    }
+    if (traceOutputPath != NULL) {
+        writeChromeTrace(traceOutputPath);
+    }
 
-        // Alternate between pink and blue rings
-        if (r % 2 == 0) {
-            float pulse = 0.7f + 0.3f * sinf(time * 2.0f + r * 0.3f);
-            RetroColor::Pink(time, 0.7f - (float)r/rings * 0.5f);
+    printf("{\n");
+    printf("  \"renderer\": \"%s\",\n", reinterpret_cast<const char*>(glGetString(GL_RENDERER)));
+    printf("  \"width\": %d,\n  \"height\": %d,\n", benchWidth, benchHeight);
+    printf("  \"frames\": %d,\n  \"warmup_frames\": %d,\n", benchFrames, benchWarmupFrames);
+    printf("  \"seed\": %llu,\n", worldSeed);
+    printf("  \"preset\": \"%s\",\n  \"scene\": {", scenePresetName);
+    for (int i = 0; i < SCENE_SETTING_COUNT; i++) {
+        const SceneSetting& setting = sceneSettings[i];
+        if (setting.intValue) {
+            printf(" \"%s\": %d", setting.name, *setting.intValue);
         } else {
-            float pulse = 0.7f + 0.3f * sinf(time * 2.0f + r * 0.3f + M_PI);
-            RetroColor::Cyan(time, 0.7f - (float)r/rings * 0.5f);
+            printf(" \"%s\": %g", setting.name, *setting.floatValue);
+        }
+        printf("%s", i + 1 < SCENE_SETTING_COUNT ? "," : " },\n");
+    }
+    printf("  \"bloom\": \"%s\",\n", !bloom.enabled ? "off" : bloomActive() ? "on" : "unavailable");
+    const QualityLevel& level = currentQuality();
+    printf("  \"quality\": { \"mode\": \"%s\", \"level\": \"%s\", \"budget_ms\": %.1f, \"changes\": %d, "
+           "\"resolution\": %.2f, \"tessellation\": %.2f, \"glow\": %s, \"stars\": %.2f },\n",
+           quality.automatic ? "auto" : "fixed", level.name, quality.budgetMs, quality.changes,
+           level.resolutionScale, level.tessellation, level.glow ? "true" : "false", level.starFraction);
+    printf("  \"streaming\": { \"camera\": \"%s\", \"chunks_in\": %lld, \"chunks_out\": %lld },\n",
+           benchDrive ? "chase" : "fixed", streamer.adopted - adoptedStart, streamer.evicted - evictedStart);
+    printf("  \"stars\": %d,\n  \"buildings\": %d,\n  \"cars\": %d,\n",
+           scene.stars, residentBuildingCount(), static_cast<int>(simRender.traffic.size()));
+    printf("  \"culling\": {");
+    for (int c = 0; c < CULL_CATEGORY_COUNT; c++) {
+        printf(" \"%s\": { \"drawn\": %d, \"culled\": %d }%s", cullCategoryNames[c],
+               cullStats.drawn[c], cullStats.culled[c], c + 1 < CULL_CATEGORY_COUNT ? "," : " ");
+    }
+    printf("},\n");
+    printf("  \"render_queue\": { \"commands\": %d, \"state_changes\": %d, \"saved\": %d },\n",
+           renderQueue.stats.commands, renderQueue.stats.stateChanges, renderQueue.stats.stateChangesSaved);
+    int jobsRun = 0, jobsStolen = 0;
+    for (int t = 0; t < jobSystem.threadCount; t++) {
+        jobsRun += jobSystem.threads[t]->executed;
+        jobsStolen += jobSystem.threads[t]->stolen;
+    }
+    printf("  \"simulation_thread\": { \"busy_ms_per_frame\": %.3f, \"traffic_kernel\": \"%s\" },\n",
+           simBusyMs, trafficUseAVX2 ? "avx2" : "scalar");
+    const PlayerCar& player = simRender.player;
+    double playerTicks = static_cast<double>(std::max(1LL, player.ticks));
+    printf("  \"player_physics\": { \"ticks\": %lld, \"swept_per_tick\": %.2f, \"tested_per_tick\": %.2f, "
+           "\"contacts\": %lld, \"us_per_tick\": %.3f },\n",
+           player.ticks, player.swept / playerTicks, player.tested / playerTicks, player.contacts,
+           player.physicsNanoseconds / playerTicks / 1000.0);
+    printf("  \"jobs\": { \"threads\": %d, \"jobs\": %d, \"stolen\": %d },\n", jobSystem.threadCount, jobsRun, jobsStolen);
+    const BenchAllocations& allocations = benchAllocations;
+    printf("  \"allocations\": { \"frames\": %d, \"allocating_frames\": %d, \"total\": %lld, \"bytes\": %lld, "
+           "\"max_per_frame\": %lld, \"frame_arena_kb\": %zu },\n",
+           allocations.frames, allocations.allocatingFrames, allocations.total, allocations.bytes,
+           allocations.maxPerFrame, frameArena.peak / 1024);
+    if (benchThreadSweep) {
+        printf("  \"thread_sweep\": [\n");
+        for (size_t i = 0; i < sweep.size(); i++) {
+            const ThreadSweepRun& run = sweep[i];
+            printf("    { \"threads\": %d, \"frame_p50_ms\": %.3f, \"geometry_p50_ms\": %.3f, \"geometry_speedup\": %.2f, \"identical\": %s }%s\n",
+                   run.threads, run.frame.p50, run.geometry.p50,
+                   run.geometry.p50 > 0.0 ? sweep[0].geometry.p50 / run.geometry.p50 : 0.0,
+                   run.identical ? "true" : "false", i + 1 < sweep.size() ? "," : "");
+        }
+        printf("  ],\n");
+    }
+    if (overdraw.enabled) {
+        const OverdrawStats& stats = overdraw.stats;
+        printf("  \"overdraw\": { \"fragments\": %lld, \"per_pixel\": %.3f, \"covered_pixels\": %d, \"max\": %d, \"zones\": {",
+               stats.total, static_cast<double>(stats.total) / (benchWidth * benchHeight), stats.coveredPixels, stats.maxDepth);
+        bool first = true;
+        for (int z = 0; z < ZONE_COUNT; z++) {
+            if (stats.fragments[z] == 0) continue;
+            printf("%s \"%s\": %lld", first ? "" : ",", profileZoneNames[z], stats.fragments[z]);
+            first = false;
         }
+        printf(" } },\n");
+    }
+    if (benchCompareBloom) {
+        printf("  \"bloom_comparison\": {\n    \"glow_passes\": ");
+        printFrameStats(computeFrameStats(glowFrameTimes));
+        printf(",\n    \"bloom\": ");
+        printFrameStats(computeFrameStats(frameTimes));
+        printf("\n  },\n");
+    }
+    printf("  \"frame_ms\": ");
+    printFrameStats(computeFrameStats(frameTimes));
+    printf(",\n  \"phases_ms\": {\n");
+    for (int z = 0; z < ZONE_COUNT; z++) {
+        printf("    \"%s\": ", profileZoneNames[z]);
+        printFrameStats(computeFrameStats(zoneTimes[z]));
+        printf("%s\n", z + 1 < ZONE_COUNT ? "," : "");
+    }
+    printf("  }\n}\n");
 
-        glBegin(GL_LINE_LOOP);
-        for (int i = 0; i < segments; i++) {
-            float angle = static_cast<float>(i) / segments * 2.0f * M_PI;
-            float currX = radius * scaleFactor * cosf(angle);
-            float currY = radius * scaleFactor * sinf(angle);
-            glVertex3f(currX, currY, depth);
+    stopSimulationThread();
+    stopChunkStreaming();
+    stopJobSystem();
+
+    // Once the scene is up a frame must not touch the heap
+    if (allocations.total > 0) {
+        std::cerr << allocations.allocatingFrames << " of " << allocations.frames
+                  << " steady-state frames allocated (" << allocations.total << " allocations)" << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+// The car loop laid out as it was before Traffic, one struct per car with a
+// PCG32 generator for respawns; kept as the baseline for --traffic-bench. It
+// does the kernels' per-car work (IDM on the car's gap, the drift towards its
+// lane, respawns), so the comparison is down to layout and vectorization.
+struct LegacyCar {
+    float x, z;
+    bool isBlue;
+    float speed, desired;
+    float gap, closing;
+    unsigned char lane;
+    float startZ, endZ;
+    Random respawn;
+};
+
+static void updateLegacyCars(std::vector<LegacyCar>& cars, float deltaTime) {
+    const float lateral = LANE_CHANGE_SPEED * deltaTime;
+    for (size_t i = 0; i < cars.size(); i++) {
+        LegacyCar& car = cars[i];
+        float accel = idmAcceleration(car.speed, car.desired, car.gap, car.closing);
+        car.speed = maxOf(car.speed + accel * deltaTime, 0.0f);
+        car.z += car.speed * deltaTime;
+        float drift = laneCenter(car.lane) - car.x;
+        car.x += minOf(maxOf(drift, -lateral), lateral);
+        if (car.z > car.endZ) {
+            car.z = car.startZ;
+            car.desired = car.respawn.range(15.0f, 25.0f);
+            if (car.respawn.below(5) == 0) {
+                car.isBlue = !car.isBlue;
+            }
         }
-        glEnd();
     }
-
-    glLineWidth(1.0f);
-    glDisable(GL_BLEND);
-    glPopMatrix();
 }
 
-void drawCar(const Car& car) {
-    float x = car.x;
-    float z = car.z;
-    float carLength = 4.0f;
-    float carWidth = 2.0f;
-    float carHeight = 1.2f;
+// Runs update ticks for about a quarter second, returns cars per second
+template <typename Update>
+static double timeTrafficKernel(size_t cars, Update update) {
+    const int TICKS_PER_BATCH = 16;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    double seconds = 0.0;
+    long long ticks = 0;
+    while (seconds < 0.25) {
+        for (int t = 0; t < TICKS_PER_BATCH; t++) update();
+        ticks += TICKS_PER_BATCH;
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+    return static_cast<double>(cars) * ticks / seconds;
+}
 
-    // Add bobbing animation
-    float time = glutGet(GLUT_ELAPSED_TIME) / 1000.0f;
-    float verticalOffset = sinf(time * 4.0f + x) * 0.1f;
+// --traffic-bench: cars updated per second by the old loop and each kernel,
+// and the cost of a full traffic step against its 1 ms budget
+int runTrafficBenchmark() {
+    if (!seedGiven) worldSeed = BENCH_DEFAULT_SEED;
+    const float deltaTime = SIM_STEP;
+    const int CARS_PER_STRETCH = 12; // Three per lane, a busy but moving avenue
+    const double STEP_BUDGET_MS = 1.0;
+    size_t count = static_cast<size_t>(trafficBenchCars);
+
+    // Stretches of avenue laid out like streamed chunks
+    Traffic traffic;
+    Random layout(RNG_TRAFFIC, 0);
+    for (size_t i = 0; i < count; i++) {
+        long long stretch = static_cast<long long>(i / CARS_PER_STRETCH);
+        float z0 = -CHUNK_SIZE * static_cast<float>(stretch);
+        float x = layout.range(-8.0f, 8.0f);
+        float z = z0 + layout.nextFloat() * CHUNK_SIZE;
+        bool isBlue = layout.below(2) == 0;
+        float speed = layout.range(15.0f, 25.0f);
+        traffic.add(x, z, isBlue, speed, z0, z0 + CHUNK_SIZE, stretch, Random(RNG_RESPAWN, i).nextU32());
+    }
 
-    // Car color with pulse
-    float pulseIntensity = 0.2f * sinf(time * 3.0f) + 0.8f;
+    // Settle the random start into lanes before timing
+    bool useAVX2 = trafficUseAVX2;
+    TrafficIndex index;
+    for (int t = 0; t < 240; t++) updateTraffic(traffic, index, deltaTime);
+
+    // The legacy loop starts from the settled cars and their gaps
+    std::vector<LegacyCar> legacy(count);
+    for (size_t i = 0; i < count; i++) {
+        LegacyCar& car = legacy[i];
+        car.x = traffic.x[i];
+        car.z = traffic.z[i];
+        car.isBlue = traffic.isBlue[i] != 0;
+        car.speed = traffic.speed[i];
+        car.desired = traffic.desired[i];
+        car.gap = index.gap[i];
+        car.closing = index.closing[i];
+        car.lane = traffic.lane[i];
+        car.startZ = traffic.startZ[i];
+        car.endZ = traffic.endZ[i];
+        car.respawn = Random(RNG_RESPAWN, i);
+    }
 
-    glPushMatrix();
-    glTranslatef(x, 0.5f + verticalOffset, z);
+    // Both kernels from the same start must agree bit for bit
+    bool hasAVX2 = false;
+    bool matches = true;
+#ifdef RETRO_AVX2_KERNELS
+    hasAVX2 = cpuHasAVX2();
+    if (hasAVX2) {
+        Traffic scalar = traffic, vector = traffic;
+        TrafficIndex scalarIndex, vectorIndex;
+        for (int t = 0; t < 600; t++) {
+            trafficUseAVX2 = false;
+            updateTraffic(scalar, scalarIndex, deltaTime);
+            trafficUseAVX2 = true;
+            updateTraffic(vector, vectorIndex, deltaTime);
+        }
+        matches = scalar.x == vector.x && scalar.z == vector.z && scalar.speed == vector.speed &&
+                  scalar.desired == vector.desired && scalar.lane == vector.lane &&
+                  scalar.rng == vector.rng && scalar.isBlue == vector.isBlue;
+    }
+#endif
+
+    // Kernels alone, on the gaps of the last step
+    double legacyRate = timeTrafficKernel(count, [&]() { updateLegacyCars(legacy, deltaTime); });
+    double scalarRate = timeTrafficKernel(count, [&]() { updateTrafficScalar(traffic, index, 0, traffic.size(), deltaTime); });
+    double avx2Rate = 0.0;
+#ifdef RETRO_AVX2_KERNELS
+    if (hasAVX2) avx2Rate = timeTrafficKernel(count, [&]() { updateTrafficAVX2(traffic, index, deltaTime); });
+#endif
+
+    // Whole steps with the selected kernel
+    trafficUseAVX2 = useAVX2;
+    long long laneChanges = 0, steps = 0;
+    double stepRate = timeTrafficKernel(1, [&]() {
+        updateTraffic(traffic, index, deltaTime);
+        laneChanges += index.laneChanges;
+        steps++;
+    });
+    double stepMs = 1000.0 / stepRate;
+
+    printf("{\n  \"cars\": %d,\n  \"traffic_kernel\": \"%s\",\n", static_cast<int>(count), useAVX2 ? "avx2" : "scalar");
+    printf("  \"cars_per_second\": { \"legacy_aos\": %.0f, \"scalar\": %.0f", legacyRate, scalarRate);
+    if (hasAVX2) printf(", \"avx2\": %.0f", avx2Rate);
+    printf(" },\n  \"speedup_vs_legacy\": { \"scalar\": %.2f", scalarRate / legacyRate);
+    if (hasAVX2) printf(", \"avx2\": %.2f", avx2Rate / legacyRate);
+    printf(" },\n  \"step_ms\": %.3f,\n  \"step_budget_ms\": %.1f,\n  \"within_budget\": %s,\n",
+           stepMs, STEP_BUDGET_MS, stepMs <= STEP_BUDGET_MS ? "true" : "false");
+    // Per simulated second, at 120 steps a second
+    printf("  \"lane_changes_per_second\": %.1f,\n", static_cast<double>(laneChanges) / steps / deltaTime);
+    printf("  \"avx2_matches_scalar\": %s\n}\n", !hasAVX2 ? "null" : matches ? "true" : "false");
+    return matches ? 0 : 1;
+}
 
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+// Music analysis. A WAV track is decoded to mono floats, cut into
+// half-overlapping Hann windows and run through an FFT on its own thread,
+// paced to the playback clock. Every hop yields log band energies and a
+// spectral-flux onset flag for the render thread.
+const int FFT_SIZE = 1024;
+const int FFT_HOP = 512;                // About 94 hops a second at 48 kHz
+const int MUSIC_BANDS = 8;              // Octaves from the kick drum up to the hi-hats
+const float MUSIC_BAND_EDGES[MUSIC_BANDS + 1] = {
+    40.0f, 80.0f, 160.0f, 320.0f, 640.0f, 1280.0f, 2560.0f, 5120.0f, 16000.0f
+};
+const float MUSIC_FLOOR_DB = -60.0f;    // Band level 0; a full-scale sine is 1
+const int ONSET_HISTORY = 43;           // Hops in the adaptive threshold, about half a second
+const float ONSET_SENSITIVITY = 1.5f;   // Flux over this times the recent mean is an onset
+const float ONSET_MIN_FLUX = 0.05f;     // Keeps steady tones and silence from firing
+const float ONSET_REFRACTORY = 0.1f;    // Seconds before the next onset may fire
+
+// One analyzed hop
+struct AudioFrame {
+    float time;                 // Seconds of track up to the end of the window
+    float bands[MUSIC_BANDS];   // Levels, 0..1
+    float flux;                 // Summed rise of the band levels since the last hop
+    bool onset;
+};
 
-    // Draw car outline (neon style)
-    glLineWidth(2.5f);  // Thicker lines
+static unsigned readLittleEndian(const unsigned char* bytes, int count) {
+    unsigned value = 0;
+    for (int i = count - 1; i >= 0; i--) value = (value << 8) | bytes[i];
+    return value;
+}
 
-    // Car outline color
-    if (car.isBlue) {
-        RetroColor::Cyan(time, 0.95f);
-    } else {
-        RetroColor::Gold(time, 0.95f);
+// Streaming RIFF/WAVE reader for 8, 16, 24 and 32-bit PCM and 32-bit float,
+// plain or WAVE_FORMAT_EXTENSIBLE, read as mono or stereo
+class WavReader {
+private:
+    FILE* file;
+    long dataStart;
+    unsigned dataBytes;
+    unsigned position;          // Bytes of sample data read
+    int format;                 // 1 = PCM, 3 = IEEE float
+    int bits;
+    std::vector<unsigned char> raw;
+
+    int frameBytes() const { return channels * bits / 8; }
+
+    float sampleAt(const unsigned char* bytes) const {
+        if (format == 3) {
+            float value;
+            memcpy(&value, bytes, sizeof(value)); // Little-endian hosts
+            return value;
+        }
+        if (bits == 8) return (bytes[0] - 128) / 128.0f;
+        unsigned value = readLittleEndian(bytes, bits / 8) << (32 - bits);
+        return static_cast<int>(value) / 2147483648.0f;
     }
 
-    // Bottom outline
-    glBegin(GL_LINE_LOOP);
-    glVertex3f(-carWidth/2, 0.0f, -carLength/2);
-    glVertex3f(carWidth/2, 0.0f, -carLength/2);
-    glVertex3f(carWidth/2, 0.0f, carLength/2);
-    glVertex3f(-carWidth/2, 0.0f, carLength/2);
-    glEnd();
+public:
+    int channels;
+    int sampleRate;
 
-    // Top outline
-    glBegin(GL_LINE_LOOP);
-    glVertex3f(-carWidth/2, carHeight, -carLength/2);
-    glVertex3f(carWidth/2, carHeight, -carLength/2);
-    glVertex3f(carWidth/2, carHeight, carLength/2 - 1.0f);
-    glVertex3f(-carWidth/2, carHeight, carLength/2 - 1.0f);
-    glEnd();
+    WavReader() : file(NULL), dataStart(0), dataBytes(0), position(0), format(0), bits(0), channels(0), sampleRate(0) {}
 
-    // Connect bottom to top
-    glBegin(GL_LINES);
-    // Front-left
-    glVertex3f(-carWidth/2, 0.0f, carLength/2);
-    glVertex3f(-carWidth/2, carHeight, carLength/2 - 1.0f);
+    ~WavReader() {
+        close();
+    }
 
-    // Front-right
-    glVertex3f(carWidth/2, 0.0f, carLength/2);
-    glVertex3f(carWidth/2, carHeight, carLength/2 - 1.0f);
+    bool open(const char* path) {
+        close();
+        file = fopen(path, "rb");
+        if (!file) return false;
 
-    // Back-left
-    glVertex3f(-carWidth/2, 0.0f, -carLength/2);
-    glVertex3f(-carWidth/2, carHeight, -carLength/2);
+        unsigned char header[12];
+        if (fread(header, 1, sizeof(header), file) != sizeof(header) ||
+            memcmp(header, "RIFF", 4) != 0 || memcmp(header + 8, "WAVE", 4) != 0) {
+            close();
+            return false;
+        }
 
-    // Back-right
-    glVertex3f(carWidth/2, 0.0f, -carLength/2);
-    glVertex3f(carWidth/2, carHeight, -carLength/2);
-    glEnd();
+        // Chunks until the samples; the format has to come first
+        bool haveFormat = false;
+        unsigned char chunk[8];
+        while (fread(chunk, 1, sizeof(chunk), file) == sizeof(chunk)) {
+            unsigned size = readLittleEndian(chunk + 4, 4);
+            if (memcmp(chunk, "fmt ", 4) == 0 && size >= 16) {
+                unsigned char fmt[40] = { 0 };
+                size_t count = std::min<size_t>(size, sizeof(fmt));
+                if (fread(fmt, 1, count, file) != count) break;
+                format = static_cast<int>(readLittleEndian(fmt, 2));
+                channels = static_cast<int>(readLittleEndian(fmt + 2, 2));
+                sampleRate = static_cast<int>(readLittleEndian(fmt + 4, 4));
+                bits = static_cast<int>(readLittleEndian(fmt + 14, 2));
+                // The extensible sub-format GUID starts with the plain format tag
+                if (format == 0xFFFE && count >= 26) format = static_cast<int>(readLittleEndian(fmt + 24, 2));
+                haveFormat = true;
+                fseek(file, static_cast<long>(size - count + (size & 1)), SEEK_CUR);
+            } else if (memcmp(chunk, "data", 4) == 0) {
+                dataStart = ftell(file);
+                dataBytes = size;
+                break;
+            } else {
+                fseek(file, static_cast<long>(size + (size & 1)), SEEK_CUR);
+            }
+        }
 
-    // Add car glow
-    glLineWidth(4.0f);
-    if (car.isBlue) {
-        RetroColor::Cyan(time, 0.3f);
-    } else {
-        RetroColor::Gold(time, 0.3f);
+        bool supported = haveFormat && dataStart > 0 && channels > 0 && sampleRate > 0 &&
+                         ((format == 1 && bits >= 8 && bits <= 32 && bits % 8 == 0) || (format == 3 && bits == 32));
+        if (!supported) {
+            close();
+            return false;
+        }
+        dataBytes -= dataBytes % frameBytes();
+        position = 0;
+        return true;
     }
 
-    // Bottom outline glow
-    glBegin(GL_LINE_LOOP);
-    glVertex3f(-carWidth/2, 0.0f, -carLength/2);
-    glVertex3f(carWidth/2, 0.0f, -carLength/2);
-    glVertex3f(carWidth/2, 0.0f, carLength/2);
-    glVertex3f(-carWidth/2, 0.0f, carLength/2);
-    glEnd();
-    glLineWidth(2.5f);
+    void close() {
+        if (file) fclose(file);
+        file = NULL;
+        dataStart = 0;
+    }
 
-    // Draw headlights and taillights
-    if (car.isBlue) {
-        // Blue car with blue headlights
-        glColor3f(0.0f, 0.9f, 1.0f);
-    } else {
-        // Orange car with yellow/orange headlights
-        glColor3f(1.0f, 0.8f, 0.3f);
+    // Up to count frames of outChannels (1 mixes down, 2 keeps or duplicates
+    // the first two); with loop the track starts over at its end
+    int read(float* out, int count, int outChannels, bool loop) {
+        int size = frameBytes();
+        int done = 0;
+        while (done < count) {
+            if (position >= dataBytes) {
+                if (!loop || dataBytes == 0) break;
+                fseek(file, dataStart, SEEK_SET);
+                position = 0;
+            }
+            unsigned want = std::min(static_cast<unsigned>(count - done) * size, dataBytes - position);
+            if (raw.size() < want) raw.resize(want);
+            size_t got = fread(&raw[0], 1, want, file);
+            int frames = static_cast<int>(got) / size;
+            if (got < want) dataBytes = position + frames * size; // Truncated file
+
+            const unsigned char* bytes = &raw[0];
+            float* samples = out + done * outChannels;
+            for (int i = 0; i < frames; i++, bytes += size) {
+                if (outChannels == 1) {
+                    float sum = 0.0f;
+                    for (int c = 0; c < channels; c++) sum += sampleAt(bytes + c * bits / 8);
+                    samples[i] = sum / channels;
+                } else {
+                    samples[i * 2] = sampleAt(bytes);
+                    samples[i * 2 + 1] = channels > 1 ? sampleAt(bytes + bits / 8) : samples[i * 2];
+                }
+            }
+            position += frames * size;
+            done += frames;
+        }
+        return done;
     }
+};
 
-    // Headlights
-    glPointSize(5.0f);  // Bigger, brighter lights
-    glBegin(GL_POINTS);
-    glVertex3f(-carWidth/3, carHeight/3, carLength/2 + 0.1f);
-    glVertex3f(carWidth/3, carHeight/3, carLength/2 + 0.1f);
-    glEnd();
+// Radix-2 decimation-in-time FFT over split real and imaginary arrays. The
+// twiddles are stored stage after stage (the stage of half-width h at offset
+// h - 1), so every butterfly group reads them contiguously.
+struct MusicFFT {
+    AlignedVector<float> re, im;
+    AlignedVector<float> twiddleRe, twiddleIm;
+    std::vector<float> window;  // Hann
+    std::vector<int> bitReverse;
+
+    void init() {
+        re.assign(FFT_SIZE, 0.0f);
+        im.assign(FFT_SIZE, 0.0f);
+        twiddleRe.resize(FFT_SIZE - 1);
+        twiddleIm.resize(FFT_SIZE - 1);
+        for (int half = 1; half < FFT_SIZE; half *= 2) {
+            for (int k = 0; k < half; k++) {
+                double angle = -M_PI * k / half;
+                twiddleRe[half - 1 + k] = static_cast<float>(cos(angle));
+                twiddleIm[half - 1 + k] = static_cast<float>(sin(angle));
+            }
+        }
 
-    // Add headlight glow
-    if (car.isBlue) {
-        glColor4f(0.0f, 0.9f, 1.0f, 0.5f);
-    } else {
-        glColor4f(1.0f, 0.8f, 0.3f, 0.5f);
+        window.resize(FFT_SIZE);
+        bitReverse.resize(FFT_SIZE);
+        int stages = 0;
+        while ((1 << stages) < FFT_SIZE) stages++;
+        for (int i = 0; i < FFT_SIZE; i++) {
+            window[i] = static_cast<float>(0.5 - 0.5 * cos(2.0 * M_PI * i / FFT_SIZE));
+            int reversed = 0;
+            for (int b = 0; b < stages; b++) {
+                if (i & (1 << b)) reversed |= 1 << (stages - 1 - b);
+            }
+            bitReverse[i] = reversed;
+        }
     }
-    glPointSize(10.0f);  // Big glow
-    glBegin(GL_POINTS);
-    glVertex3f(-carWidth/3, carHeight/3, carLength/2 + 0.1f);
-    glVertex3f(carWidth/3, carHeight/3, carLength/2 + 0.1f);
-    glEnd();
+};
 
-    // Taillights
-    if (car.isBlue) {
-        glColor3f(0.0f, 0.5f, 1.0f);
-    } else {
-        glColor3f(1.0f, 0.2f, 0.2f);
+// Butterflies for the stages of half-width first up to (not including) last
+static void fftStagesScalar(MusicFFT& fft, int first, int last) {
+    float* re = &fft.re[0];
+    float* im = &fft.im[0];
+    for (int half = first; half < last; half *= 2) {
+        const float* wr = &fft.twiddleRe[half - 1];
+        const float* wi = &fft.twiddleIm[half - 1];
+        for (int start = 0; start < FFT_SIZE; start += 2 * half) {
+            for (int k = 0; k < half; k++) {
+                int a = start + k;
+                int b = a + half;
+                float tr = re[b] * wr[k] - im[b] * wi[k];
+                float ti = re[b] * wi[k] + im[b] * wr[k];
+                re[b] = re[a] - tr;
+                im[b] = im[a] - ti;
+                re[a] = re[a] + tr;
+                im[a] = im[a] + ti;
+            }
+        }
     }
+}
 
-    glPointSize(4.0f);
-    glBegin(GL_POINTS);
-    glVertex3f(-carWidth/3, carHeight/3, -carLength/2 - 0.1f);
-    glVertex3f(carWidth/3, carHeight/3, -carLength/2 - 0.1f);
-    glEnd();
-
-    // Draw ground light trails - ENHANCED
-    float trailIntensity = 0.8f + 0.2f * sinf(time * 5.0f);
-
-    // Draw longer, more vibrant trails
-    if (car.isBlue) {
-        // Blue car with cyan trail
-        glBegin(GL_QUADS);
-        glColor4f(0.0f, 0.8f * trailIntensity, 1.0f * trailIntensity, 0.8f);
-        glVertex3f(-carWidth/4, 0.05f, -carLength/2);
-        glVertex3f(carWidth/4, 0.05f, -carLength/2);
-        glColor4f(0.0f, 0.8f * trailIntensity * 0.3f, 1.0f * trailIntensity * 0.3f, 0.0f); // Fade to transparent
-        glVertex3f(carWidth/4, 0.05f, -carLength/2 - 20.0f); // Longer trail
-        glVertex3f(-carWidth/4, 0.05f, -carLength/2 - 20.0f);
-        glEnd();
-    } else {
-        // Orange car with orange/red trail
-        glBegin(GL_QUADS);
-        glColor4f(1.0f * trailIntensity, 0.5f * trailIntensity, 0.0f, 0.8f);
-        glVertex3f(-carWidth/4, 0.05f, -carLength/2);
-        glVertex3f(carWidth/4, 0.05f, -carLength/2);
-        glColor4f(1.0f * trailIntensity * 0.3f, 0.5f * trailIntensity * 0.3f, 0.0f, 0.0f); // Fade to transparent
-        glVertex3f(carWidth/4, 0.05f, -carLength/2 - 20.0f); // Longer trail
-        glVertex3f(-carWidth/4, 0.05f, -carLength/2 - 20.0f);
-        glEnd();
+#ifdef RETRO_AVX2_KERNELS
+// Eight butterflies at a time once a stage is at least eight wide; the
+// operations match the scalar path one for one, so both give the same bits
+RETRO_TARGET_AVX2
+static void fftStagesAVX2(MusicFFT& fft) {
+    fftStagesScalar(fft, 1, 8);
+    float* re = &fft.re[0];
+    float* im = &fft.im[0];
+    for (int half = 8; half < FFT_SIZE; half *= 2) {
+        const float* wr = &fft.twiddleRe[half - 1];
+        const float* wi = &fft.twiddleIm[half - 1];
+        for (int start = 0; start < FFT_SIZE; start += 2 * half) {
+            for (int k = 0; k < half; k += 8) {
+                int a = start + k;
+                int b = a + half;
+                __m256 twiddleR = _mm256_loadu_ps(wr + k);
+                __m256 twiddleI = _mm256_loadu_ps(wi + k);
+                __m256 ar = _mm256_load_ps(re + a), ai = _mm256_load_ps(im + a);
+                __m256 br = _mm256_load_ps(re + b), bi = _mm256_load_ps(im + b);
+                __m256 tr = _mm256_sub_ps(_mm256_mul_ps(br, twiddleR), _mm256_mul_ps(bi, twiddleI));
+                __m256 ti = _mm256_add_ps(_mm256_mul_ps(br, twiddleI), _mm256_mul_ps(bi, twiddleR));
+                _mm256_store_ps(re + b, _mm256_sub_ps(ar, tr));
+                _mm256_store_ps(im + b, _mm256_sub_ps(ai, ti));
+                _mm256_store_ps(re + a, _mm256_add_ps(ar, tr));
+                _mm256_store_ps(im + a, _mm256_add_ps(ai, ti));
+            }
+        }
     }
-
-    glLineWidth(1.0f);
-    glDisable(GL_BLEND);
-    glPopMatrix();
 }
+#endif
+
+// Turns hops of samples into AudioFrames. Used by the analysis thread and
+// by --analyze, so both see the same numbers.
+struct MusicAnalyzer {
+    MusicFFT fft;
+    bool useAVX2;
+    int sampleRate;
+    int bandFirst[MUSIC_BANDS], bandLast[MUSIC_BANDS]; // FFT bins, last exclusive
+    float samples[FFT_SIZE];                           // Sliding window, oldest first
+    float previous[MUSIC_BANDS];
+    float history[ONSET_HISTORY];                      // Recent flux, for the threshold
+    long long hops;
+    float lastOnset;
+
+    void init(int rate, bool avx2) {
+        fft.init();
+        useAVX2 = avx2;
+        sampleRate = rate;
+        for (int band = 0; band < MUSIC_BANDS; band++) {
+            int first = static_cast<int>(MUSIC_BAND_EDGES[band] * FFT_SIZE / rate + 0.5f);
+            int last = static_cast<int>(MUSIC_BAND_EDGES[band + 1] * FFT_SIZE / rate + 0.5f);
+            bandFirst[band] = std::min(std::max(first, 1), FFT_SIZE / 2);
+            bandLast[band] = std::min(std::max(last, bandFirst[band] + 1), FFT_SIZE / 2 + 1);
+        }
+        memset(samples, 0, sizeof(samples));
+        memset(previous, 0, sizeof(previous));
+        memset(history, 0, sizeof(history));
+        hops = 0;
+        lastOnset = -ONSET_REFRACTORY;
+    }
 
-void drawSky() {
-    float time = glutGet(GLUT_ELAPSED_TIME) / 1000.0f;
-
-    // Draw stars
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-
-    for (size_t i = 0; i < stars.size(); i++) {
-        const Star& star = stars[i];
-
-        // Twinkling effect
-        float twinkleSpeed = 3.0f + (i % 5) * 1.0f;
-        float twinkle = 0.5f + 0.5f * sinf(time * twinkleSpeed + i * 0.1f);
-        float brightness = star.brightness * twinkle;
-
-        // Variable star size
-        glPointSize(star.size * (0.8f + 0.4f * twinkle));
+    // FFT_HOP new samples in, one frame out
+    void analyze(const float* hop, AudioFrame& out) {
+        memmove(samples, samples + FFT_HOP, (FFT_SIZE - FFT_HOP) * sizeof(float));
+        memcpy(samples + FFT_SIZE - FFT_HOP, hop, FFT_HOP * sizeof(float));
 
-        // Star color
-        if (star.colorType < 7) { // White/blue
-            glColor3f(0.8f + 0.2f * twinkle, 0.8f + 0.2f * twinkle, 1.0f);
-        } else if (star.colorType < 9) { // Yellow/orange
-            glColor3f(1.0f, 0.7f + 0.3f * twinkle, 0.4f * twinkle);
-        } else { // Red
-            glColor3f(1.0f, 0.3f * twinkle, 0.2f * twinkle);
+        float* re = &fft.re[0];
+        float* im = &fft.im[0];
+        for (int i = 0; i < FFT_SIZE; i++) {
+            re[fft.bitReverse[i]] = samples[i] * fft.window[i];
+            im[i] = 0.0f;
+        }
+#ifdef RETRO_AVX2_KERNELS
+        if (useAVX2) fftStagesAVX2(fft);
+        else fftStagesScalar(fft, 1, FFT_SIZE);
+#else
+        fftStagesScalar(fft, 1, FFT_SIZE);
+#endif
+
+        // Mean power per band against a full-scale sine, in decibels
+        const float fullScale = 4.0f / FFT_SIZE; // Hann-windowed sine peak is N / 4
+        hops++;
+        out.time = static_cast<float>(static_cast<double>(hops) * FFT_HOP / sampleRate);
+        out.flux = 0.0f;
+        for (int band = 0; band < MUSIC_BANDS; band++) {
+            float power = 0.0f;
+            for (int k = bandFirst[band]; k < bandLast[band]; k++) {
+                power += re[k] * re[k] + im[k] * im[k];
+            }
+            power *= fullScale * fullScale / (bandLast[band] - bandFirst[band]);
+            float level = (10.0f * log10f(power + 1e-12f) - MUSIC_FLOOR_DB) / -MUSIC_FLOOR_DB;
+            level = std::min(std::max(level, 0.0f), 1.0f);
+            if (hops == 1) previous[band] = level;
+            out.flux += std::max(level - previous[band], 0.0f);
+            out.bands[band] = previous[band] = level;
         }
 
-        glBegin(GL_POINTS);
-        glVertex3f(star.x, star.y, star.z);
-        glEnd();
-
-        // Add glow for bright stars
-        if (star.brightness > 0.8f) {
-            float glowSize = star.size * 3.0f * twinkle;
+        // Onset when the flux clears the recent mean
+        int count = static_cast<int>(std::min<long long>(hops - 1, ONSET_HISTORY));
+        float mean = 0.0f;
+        for (int i = 0; i < count; i++) mean += history[i];
+        if (count > 0) mean /= count;
+        out.onset = count > 0 && out.flux > std::max(mean * ONSET_SENSITIVITY, ONSET_MIN_FLUX) &&
+                    out.time - lastOnset >= ONSET_REFRACTORY;
+        if (out.onset) lastOnset = out.time;
+        history[(hops - 1) % ONSET_HISTORY] = out.flux;
+    }
+};
 
-            if (star.colorType < 7) {
-                glColor4f(0.6f, 0.6f, 1.0f, 0.2f * brightness);
-            } else if (star.colorType < 9) {
-                glColor4f(1.0f, 0.7f, 0.3f, 0.2f * brightness);
-            } else {
-                glColor4f(1.0f, 0.3f, 0.2f, 0.2f * brightness);
-            }
+// The analysis thread owns reader and analyzer; frames reach the render
+// thread through the ring, which drops them if it stalls. It reads its own
+// copy of the track the audio engine plays, following its clock.
+struct MusicThread {
+    SpscQueue<AudioFrame, 256> frames;   // Analysis -> render thread
+    WavReader reader;
+    MusicAnalyzer analyzer;
+    std::atomic<bool> running;
+    std::atomic<long long> busyNanoseconds;
+    std::thread thread;
+    // Render thread
+    AudioFrame latest;
+    float heard;                         // Frame time when latest arrived
+    MusicLevels levels;
+};
 
-            glPointSize(glowSize);
-            glBegin(GL_POINTS);
-            glVertex3f(star.x, star.y, star.z);
-            glEnd();
+MusicThread musicThread;
+
+static void musicThreadMain() {
+    heapUntracked = true; // Runs at the track's pace, not the frame's
+    MusicThread& music = musicThread;
+    float hop[FFT_HOP];
+    const double hopSeconds = static_cast<double>(FFT_HOP) / music.reader.sampleRate;
+    double analyzed = 0.0;  // Seconds of track analyzed
+    while (music.running.load()) {
+        // Paced to the audio engine, which stops the clock while paused
+        double clock = audioMusicSeconds();
+        long long start = profilerNow();
+        bool worked = false;
+        while (analyzed + hopSeconds <= clock) {
+            int count = music.reader.read(hop, FFT_HOP, 1, true);
+            std::fill(hop + count, hop + FFT_HOP, 0.0f);
+            AudioFrame frame;
+            music.analyzer.analyze(hop, frame);
+            music.frames.push(frame);
+            analyzed += hopSeconds;
+            worked = true;
         }
+        if (worked) music.busyNanoseconds += profilerNow() - start;
+        std::this_thread::sleep_for(std::chrono::milliseconds(2)); // Well under a hop
     }
-
-    glDisable(GL_BLEND);
 }
 
-// New function to draw a pyramid shape
-void drawPyramid(float time) {
-    glPushMatrix();
-
-    // Position the pyramid in the sky
-    float hoverY = 20.0f + sinf(time * 0.5f) * 3.0f; // Hovering effect
-    glTranslatef(-30.0f, hoverY, -40.0f);
-
-    // Rotate the pyramid
-    glRotatef(time * 20.0f, 0.0f, 1.0f, 0.2f);
-
-    // Scale the pyramid
-    float scale = 3.0f + sinf(time * 0.7f) * 0.5f; // Pulsating scale
-    glScalef(scale, scale, scale);
+static bool musicUseAVX2() {
+#ifdef RETRO_AVX2_KERNELS
+    return cpuHasAVX2();
+#else
+    return false;
+#endif
+}
 
-    // Set material properties using retrowave color palette
-    glEnable(GL_LIGHTING);
+// False if the file is missing or not a WAV we can read
+bool startMusicAnalysis(const char* path) {
+    MusicThread& music = musicThread;
+    if (music.running.load() || !music.reader.open(path)) return false;
+    music.analyzer.init(music.reader.sampleRate, musicUseAVX2());
+    music.levels = MusicLevels();
+    music.heard = -1.0f;
+    music.running = true;
+    music.thread = std::thread(musicThreadMain);
+    return true;
+}
 
-    // Use the retrowave colors - alternate between pink and cyan
-    float pulse = 0.7f + 0.3f * sinf(time * 2.0f);
+void stopMusicAnalysis() {
+    if (!musicThread.running.load()) return;
+    musicThread.running = false;
+    musicThread.thread.join();
+    musicThread.reader.close();
+}
 
-    // Choose color based on time for pulsing effect
-    bool usePink = (sinf(time * 0.5f) > 0);
-    GLfloat pyramidColor[4];
+// Quick to rise, slow to fall
+static void followLevel(float& level, float target, float deltaTime) {
+    float rate = target > level ? 30.0f : 4.0f;
+    level += (target - level) * (1.0f - expf(-rate * deltaTime));
+}
 
-    if (usePink) {
-        // Hot pink (classic retrowave color)
-        RetroColor::getPinkMaterial(time, 1.0f, pyramidColor);
-    } else {
-        // Cyan (classic retrowave color)
-        RetroColor::getCyanMaterial(time, 1.0f, pyramidColor);
+// Render thread: drains the analyzed frames, smooths them into levels and
+// sends those to the simulation ahead of this frame's steps
+void updateMusicLevels(const FrameContext& frame) {
+    MusicThread& music = musicThread;
+    if (!music.running.load()) return;
+
+    AudioFrame audio;
+    bool onset = false;
+    while (music.frames.pop(audio)) {
+        music.latest = audio;
+        music.heard = frame.time;
+        onset = onset || audio.onset;
     }
 
-    GLfloat specular[] = {1.0f, 1.0f, 1.0f, 1.0f};
-    GLfloat shininess[] = {50.0f};
-
-    glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, pyramidColor);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, specular);
-    glMaterialfv(GL_FRONT, GL_SHININESS, shininess);
-
-    // Disable lighting temporarily for neon wireframe effect
-    glDisable(GL_LIGHTING);
+    // Silence once the frames stop coming (paused)
+    float deltaTime = std::min(std::max(frame.deltaTime, 0.0f), MAX_FRAME_DELTA);
+    bool stale = music.heard < 0.0f || frame.time - music.heard > 0.25f;
+    const float* bands = music.latest.bands;
+    float bass = stale ? 0.0f : std::max(bands[0], bands[1]);
+    float mid = stale ? 0.0f : (bands[2] + bands[3] + bands[4]) / 3.0f;
+    float high = stale ? 0.0f : (bands[5] + bands[6] + bands[7]) / 3.0f;
+
+    MusicLevels& levels = music.levels;
+    followLevel(levels.bass, bass, deltaTime);
+    followLevel(levels.mid, mid, deltaTime);
+    followLevel(levels.high, high, deltaTime);
+    levels.beat = onset ? 1.0f : levels.beat * expf(-6.0f * deltaTime);
+    levels.active = showMusicVisualization;
+
+    SimCommand command = makeSimCommand(SIM_MUSIC);
+    command.music = levels;
+    sendSimCommand(command);
+}
 
-    // Draw pyramid wireframe - base is a square
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+// Whole track through a fresh analyzer; returns the nanoseconds it took
+static long long analyzeTrack(const std::vector<float>& samples, int sampleRate, bool avx2,
+                              std::vector<AudioFrame>& frames) {
+    MusicAnalyzer analyzer;
+    analyzer.init(sampleRate, avx2);
+    frames.resize(samples.size() / FFT_HOP);
+    long long start = profilerNow();
+    for (size_t i = 0; i < frames.size(); i++) {
+        analyzer.analyze(&samples[i * FFT_HOP], frames[i]);
+    }
+    return profilerNow() - start;
+}
 
-    // Draw wireframe with thicker lines for neon effect
-    glLineWidth(2.5f);
+static bool sameAudioFrames(const std::vector<AudioFrame>& a, const std::vector<AudioFrame>& b) {
+    if (a.size() != b.size()) return false;
+    for (size_t i = 0; i < a.size(); i++) {
+        if (memcmp(a[i].bands, b[i].bands, sizeof(a[i].bands)) != 0 ||
+            memcmp(&a[i].flux, &b[i].flux, sizeof(a[i].flux)) != 0 || a[i].onset != b[i].onset) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    if (usePink) {
-        RetroColor::Pink(time, 0.95f);
-    } else {
-        RetroColor::Cyan(time, 0.95f);
+// --analyze file.wav: the live analysis over a whole file as fast as it
+// goes. Prints the onsets, mean band levels and the cost against real time
+// as JSON; exits non-zero if the AVX2 and scalar FFTs disagree.
+int runMusicAnalysis(const char* path) {
+    WavReader reader;
+    if (!reader.open(path)) {
+        std::cerr << "Failed to open WAV file: " << path << std::endl;
+        return 1;
+    }
+    std::vector<float> samples;
+    float block[4096];
+    int count;
+    while ((count = reader.read(block, 4096, 1, false)) > 0) {
+        samples.insert(samples.end(), block, block + count);
+    }
+    int sampleRate = reader.sampleRate;
+    double seconds = static_cast<double>(samples.size()) / sampleRate;
+
+    // Both FFTs over the track must agree bit for bit
+    bool useAVX2 = musicUseAVX2();
+    std::vector<AudioFrame> frames, scalar;
+    bool matches = true;
+    if (useAVX2) {
+        analyzeTrack(samples, sampleRate, false, scalar);
     }
 
-    // Draw base
-    glBegin(GL_LINE_LOOP);
-    glVertex3f(-1.0f, -1.0f, -1.0f);
-    glVertex3f(1.0f, -1.0f, -1.0f);
-    glVertex3f(1.0f, -1.0f, 1.0f);
-    glVertex3f(-1.0f, -1.0f, 1.0f);
-    glEnd();
+    // Repeat short tracks so the timing is not all noise
+    long long nanoseconds = 0;
+    int passes = 0;
+    do {
+        nanoseconds += analyzeTrack(samples, sampleRate, useAVX2, frames);
+        passes++;
+    } while (nanoseconds < 200000000LL && !frames.empty());
+    if (useAVX2) matches = sameAudioFrames(frames, scalar);
+
+    double analysisMs = nanoseconds / 1e6 / passes;
+    double hopNanoseconds = frames.empty() ? 0.0 : static_cast<double>(nanoseconds) / passes / frames.size();
+    double means[MUSIC_BANDS] = { 0.0 };
+    std::vector<float> onsets;
+    for (size_t i = 0; i < frames.size(); i++) {
+        for (int band = 0; band < MUSIC_BANDS; band++) means[band] += frames[i].bands[band];
+        if (frames[i].onset) onsets.push_back(frames[i].time);
+    }
 
-    // Draw edges from base to apex
-    glBegin(GL_LINES);
-    glVertex3f(-1.0f, -1.0f, -1.0f);
-    glVertex3f(0.0f, 2.0f, 0.0f);
+    printf("{\n  \"sample_rate\": %d,\n  \"channels\": %d,\n  \"seconds\": %.3f,\n", sampleRate, reader.channels, seconds);
+    printf("  \"fft_size\": %d,\n  \"hop\": %d,\n  \"frames\": %d,\n  \"fft_kernel\": \"%s\",\n",
+           FFT_SIZE, FFT_HOP, static_cast<int>(frames.size()), useAVX2 ? "avx2" : "scalar");
+    printf("  \"band_hz\": [");
+    for (int band = 0; band <= MUSIC_BANDS; band++) printf("%s%.0f", band ? ", " : "", MUSIC_BAND_EDGES[band]);
+    printf("],\n  \"band_mean\": [");
+    for (int band = 0; band < MUSIC_BANDS; band++) {
+        printf("%s%.3f", band ? ", " : "", frames.empty() ? 0.0 : means[band] / frames.size());
+    }
+    printf("],\n  \"onsets\": %d,\n  \"onset_times\": [", static_cast<int>(onsets.size()));
+    for (size_t i = 0; i < onsets.size(); i++) printf("%s%.3f", i ? ", " : "", onsets[i]);
+    printf("],\n  \"analysis_ms\": %.3f,\n", analysisMs);
+    printf("  \"realtime_factor\": %.1f,\n", analysisMs > 0.0 ? seconds * 1000.0 / analysisMs : 0.0);
+    // Share of one core the live analysis needs at 48 kHz
+    printf("  \"core_percent_48k\": %.4f,\n", hopNanoseconds * 48000.0 / FFT_HOP / 1e9 * 100.0);
+    printf("  \"avx2_matches_scalar\": %s\n}\n", !useAVX2 ? "null" : matches ? "true" : "false");
+    return matches ? 0 : 1;
+}
 
-    glVertex3f(1.0f, -1.0f, -1.0f);
-    glVertex3f(0.0f, 2.0f, 0.0f);
+// Audio engine. A decode thread streams the music into a lock-free ring of
+// stereo frames; an output thread mixes it with the one-shot effects block
+// by block and hands the blocks to the sink. Nothing on the output thread
+// allocates or locks: effects arrive through a queue and play from buffers
+// made at startup, and volumes are atomics it ramps towards.
+const int AUDIO_BLOCK = 512;            // Frames mixed at a time, about 11 ms at 48 kHz
+const int AUDIO_RING_FRAMES = 16384;    // Decoded music ahead of the mixer (a power of two)
+const int AUDIO_DECODE_BLOCK = 2048;
+const int AUDIO_VOICES = 16;            // Effects playing at once; the oldest is cut off
+const int AUDIO_DEVICE_BUFFERS = 4;     // Blocks queued on the sound card
+const int AUDIO_DEFAULT_RATE = 48000;   // Without a track
+
+// Lock-free single-producer/single-consumer ring of interleaved stereo frames
+class AudioRing {
+private:
+    static const unsigned MASK = AUDIO_RING_FRAMES - 1;
+    float samples[AUDIO_RING_FRAMES * 2];
+    std::atomic<unsigned> head; // Next frame to read (consumer)
+    std::atomic<unsigned> tail; // Next frame to write (producer)
 
-    glVertex3f(1.0f, -1.0f, 1.0f);
-    glVertex3f(0.0f, 2.0f, 0.0f);
+public:
+    AudioRing() : head(0), tail(0) {}
 
-    glVertex3f(-1.0f, -1.0f, 1.0f);
-    glVertex3f(0.0f, 2.0f, 0.0f);
-    glEnd();
+    // Only while neither side runs
+    void clear() {
+        head = 0;
+        tail = 0;
+    }
 
-    // Add glow effect
-    glLineWidth(4.0f);
+    unsigned space() const {
+        return AUDIO_RING_FRAMES - (tail.load(std::memory_order_relaxed) - head.load(std::memory_order_acquire));
+    }
 
-    if (usePink) {
-        RetroColor::Pink(time, 0.3f); // Pink glow
-    } else {
-        RetroColor::Cyan(time, 0.3f); // Cyan glow
+    // Writes what fits
+    unsigned write(const float* in, unsigned frames) {
+        unsigned t = tail.load(std::memory_order_relaxed);
+        frames = std::min(frames, AUDIO_RING_FRAMES - (t - head.load(std::memory_order_acquire)));
+        unsigned first = std::min(frames, AUDIO_RING_FRAMES - (t & MASK));
+        memcpy(samples + (t & MASK) * 2, in, first * 2 * sizeof(float));
+        memcpy(samples, in + first * 2, (frames - first) * 2 * sizeof(float));
+        tail.store(t + frames, std::memory_order_release);
+        return frames;
     }
 
-    // Redraw lines with glow
-    glBegin(GL_LINES);
-    glVertex3f(-1.0f, -1.0f, -1.0f);
-    glVertex3f(0.0f, 2.0f, 0.0f);
+    // Reads what is there
+    unsigned read(float* out, unsigned frames) {
+        unsigned h = head.load(std::memory_order_relaxed);
+        frames = std::min(frames, tail.load(std::memory_order_acquire) - h);
+        unsigned first = std::min(frames, AUDIO_RING_FRAMES - (h & MASK));
+        memcpy(out, samples + (h & MASK) * 2, first * 2 * sizeof(float));
+        memcpy(out + first * 2, samples, (frames - first) * 2 * sizeof(float));
+        head.store(h + frames, std::memory_order_release);
+        return frames;
+    }
+};
 
-    glVertex3f(1.0f, -1.0f, -1.0f);
-    glVertex3f(0.0f, 2.0f, 0.0f);
-    glEnd();
+struct AudioEvent {
+    SoundEffect sound;
+    float gain;
+};
 
-    // Reset line width
-    glLineWidth(1.0f);
+struct AudioVoice {
+    int sound;      // -1 when free
+    int position;
+    float gain;
+};
 
-    // Re-enable lighting for solid model
-    glEnable(GL_LIGHTING);
+struct AudioEngine {
+    int sampleRate;
+    bool hasMusic;
+    bool testTrack;                         // Music synthesized in place of a file
+    AudioSinkType sink;
+    WavReader music;                        // Decode thread
+    long long testFrames;                   // Decode thread: test track position
+    AudioRing ring;                         // Decode -> output thread
+    SpscQueue<AudioEvent, 64> events;       // Render -> output thread
+    std::vector<float> sounds[SOUND_COUNT]; // Mono, made before the threads start
+    AudioVoice voices[AUDIO_VOICES];        // Output thread
+    float decoded[AUDIO_DECODE_BLOCK * 2];  // Decode thread
+    float block[AUDIO_BLOCK * 2];           // Output thread
+    short pcm[AUDIO_BLOCK * 2];             // Output thread, for the file sink
+    std::atomic<float> musicVolume;
+    std::atomic<float> effectsVolume;
+    float appliedVolume;                    // Output thread: music volume of the last block
+    std::atomic<bool> running;
+    std::atomic<bool> paused;               // Music only; effects keep playing
+    std::atomic<long long> musicFrames;     // Music frames mixed, the playback clock
+    std::atomic<long long> blocks;
+    std::atomic<long long> underruns;       // Blocks the decoder could not fill
+    std::atomic<long long> mixNanoseconds;
+    std::atomic<long long> mixAllocations;  // Heap allocations made while mixing; must stay 0
+    std::thread decodeThread, outputThread;
+    std::chrono::steady_clock::time_point started; // Paced sinks
+    long long written;                      // Frames handed to the sink
+    FILE* file;
+#ifdef _WIN32
+    HWAVEOUT device;
+    HANDLE deviceEvent;
+    WAVEHDR headers[AUDIO_DEVICE_BUFFERS];
+    short deviceSamples[AUDIO_DEVICE_BUFFERS][AUDIO_BLOCK * 2];
+    int nextHeader;
+#endif
+};
 
-    // Draw semi-transparent faces for the pyramid
-    pyramidColor[3] = 0.3f; // Make it semi-transparent
-    glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, pyramidColor);
-
-    // Draw pyramid faces (triangles)
-    glBegin(GL_TRIANGLES);
-    // Front face
-    glNormal3f(0.0f, 0.5f, 0.5f);  // Approximate normal
-    glVertex3f(0.0f, 2.0f, 0.0f);
-    glVertex3f(-1.0f, -1.0f, 1.0f);
-    glVertex3f(1.0f, -1.0f, 1.0f);
-
-    // Right face
-    glNormal3f(0.5f, 0.5f, 0.0f);  // Approximate normal
-    glVertex3f(0.0f, 2.0f, 0.0f);
-    glVertex3f(1.0f, -1.0f, 1.0f);
-    glVertex3f(1.0f, -1.0f, -1.0f);
-
-    // Back face
-    glNormal3f(0.0f, 0.5f, -0.5f);  // Approximate normal
-    glVertex3f(0.0f, 2.0f, 0.0f);
-    glVertex3f(1.0f, -1.0f, -1.0f);
-    glVertex3f(-1.0f, -1.0f, -1.0f);
-
-    // Left face
-    glNormal3f(-0.5f, 0.5f, 0.0f);  // Approximate normal
-    glVertex3f(0.0f, 2.0f, 0.0f);
-    glVertex3f(-1.0f, -1.0f, -1.0f);
-    glVertex3f(-1.0f, -1.0f, 1.0f);
-    glEnd();
+AudioEngine audioEngine;
+
+// Effects are made from scratch so there is nothing to ship: a rising saw
+// for the boost and a noise burst over a thump for crashes
+static void synthesizeSounds(AudioEngine& audio) {
+    float rate = static_cast<float>(audio.sampleRate);
+
+    std::vector<float>& boost = audio.sounds[SOUND_BOOST];
+    boost.resize(static_cast<size_t>(rate * 0.5f));
+    float phase = 0.0f;
+    for (size_t i = 0; i < boost.size(); i++) {
+        float t = i / rate;
+        phase += (120.0f + 720.0f * t) / rate;
+        phase -= floorf(phase);
+        float envelope = std::min(t / 0.02f, 1.0f) * (1.0f - t / 0.5f);
+        boost[i] = 0.3f * envelope * (2.0f * phase - 1.0f);
+    }
 
-    glDisable(GL_BLEND);
-    glPopMatrix();
+    std::vector<float>& crash = audio.sounds[SOUND_CRASH];
+    crash.resize(static_cast<size_t>(rate * 0.35f));
+    unsigned noise = 0x9E3779B9u;
+    float lowpass = 0.0f;
+    for (size_t i = 0; i < crash.size(); i++) {
+        float t = i / rate;
+        noise = noise * 1664525u + 1013904223u;
+        lowpass += 0.25f * ((noise >> 8) / 8388608.0f - 1.0f - lowpass);
+        crash[i] = expf(-t * 12.0f) * (0.6f * lowpass + 0.5f * sinf(TWO_PI * 55.0f * t));
+    }
 }
 
-// Updated torus function to use consistent retro wave colors
-void drawTorus(float time) {
-    glPushMatrix();
-
-    // Position the torus
-    float orbitX = sinf(time * 0.4f) * 20.0f;
-    float orbitZ = cosf(time * 0.4f) * 20.0f;
-    glTranslatef(orbitX, 15.0f, -30.0f + orbitZ);
+// A stand-in track for running the engine without a file: a kick on every
+// beat at 120 bpm under a bass line that walks a minor chord each bar
+static int synthesizeTestTrack(AudioEngine& audio) {
+    static const float BASS_NOTES[4] = { 55.0f, 65.41f, 82.41f, 73.42f };
+    float rate = static_cast<float>(audio.sampleRate);
+    long long beatFrames = audio.sampleRate / 2;
+    for (int i = 0; i < AUDIO_DECODE_BLOCK; i++) {
+        long long frame = audio.testFrames + i;
+        float t = static_cast<float>(frame % beatFrames) / rate;
+        float kick = expf(-t * 18.0f) * sinf(TWO_PI * (50.0f + 90.0f * expf(-t * 30.0f)) * t);
+        float note = BASS_NOTES[(frame / (beatFrames * 4)) % 4];
+        float bass = 0.25f * sinf(TWO_PI * note * static_cast<float>(frame % audio.sampleRate) / rate);
+        audio.decoded[i * 2] = 0.5f * kick + bass;
+        audio.decoded[i * 2 + 1] = 0.5f * kick + bass;
+    }
+    audio.testFrames += AUDIO_DECODE_BLOCK;
+    return AUDIO_DECODE_BLOCK;
+}
 
-    // Rotate the torus continuously
-    glRotatef(time * 50.0f, 1.0f, 0.5f, 0.0f);
+// Decode thread: one block of the track into the ring, looping at its end
+static void decodeMusicBlock(AudioEngine& audio) {
+    int frames = audio.testTrack ? synthesizeTestTrack(audio) : audio.music.read(audio.decoded, AUDIO_DECODE_BLOCK, 2, true);
+    if (frames == 0) {
+        // An empty track plays as silence
+        frames = AUDIO_DECODE_BLOCK;
+        std::fill(audio.decoded, audio.decoded + frames * 2, 0.0f);
+    }
+    audio.ring.write(audio.decoded, static_cast<unsigned>(frames));
+}
 
-    // Set material properties using retrowave colors
-    glEnable(GL_LIGHTING);
+static void audioDecodeThreadMain() {
+    heapUntracked = true; // Decoding is paced by the device, not the frame
+    AudioEngine& audio = audioEngine;
+    while (audio.running.load()) {
+        if (audio.ring.space() >= AUDIO_DECODE_BLOCK) {
+            decodeMusicBlock(audio);
+        } else {
+            std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        }
+    }
+}
 
-    // Calculate color pulse
-    float pulse = 0.7f + 0.3f * sinf(time * 1.5f);
+// Output thread: one block of music and effects
+static void mixAudioBlock(AudioEngine& audio, float* out, int frames) {
+    long long start = profilerNow();
+    long long allocations = threadHeapAllocations;
+
+    AudioEvent event;
+    while (audio.events.pop(event)) {
+        // A free voice, or the one furthest along
+        int chosen = 0;
+        for (int v = 0; v < AUDIO_VOICES; v++) {
+            if (audio.voices[v].sound < 0) {
+                chosen = v;
+                break;
+            }
+            if (audio.voices[v].position > audio.voices[chosen].position) chosen = v;
+        }
+        AudioVoice voice = { event.sound, 0, event.gain };
+        audio.voices[chosen] = voice;
+    }
 
-    // Alternate between retrowave colors
-    int colorChoice = static_cast<int>(time * 0.2f) % 3;
-    GLfloat torusColor[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    int got = 0;
+    if (audio.hasMusic && !audio.paused.load(std::memory_order_relaxed)) {
+        got = static_cast<int>(audio.ring.read(out, static_cast<unsigned>(frames)));
+        if (got < frames) audio.underruns++;
+        audio.musicFrames += got;
+    }
+    std::fill(out + got * 2, out + frames * 2, 0.0f);
+
+    // Ramp to the new volume across the block so changes do not click
+    float volume = audio.musicVolume.load(std::memory_order_relaxed);
+    float step = (volume - audio.appliedVolume) / frames;
+    for (int i = 0; i < got; i++) {
+        float gain = audio.appliedVolume + step * (i + 1);
+        out[i * 2] *= gain;
+        out[i * 2 + 1] *= gain;
+    }
+    audio.appliedVolume = volume;
+
+    float effects = audio.effectsVolume.load(std::memory_order_relaxed);
+    for (int v = 0; v < AUDIO_VOICES; v++) {
+        AudioVoice& voice = audio.voices[v];
+        if (voice.sound < 0) continue;
+        const std::vector<float>& sound = audio.sounds[voice.sound];
+        int count = std::min(frames, static_cast<int>(sound.size()) - voice.position);
+        const float* samples = &sound[voice.position];
+        float gain = voice.gain * effects;
+        for (int i = 0; i < count; i++) {
+            out[i * 2] += samples[i] * gain;
+            out[i * 2 + 1] += samples[i] * gain;
+        }
+        voice.position += count;
+        if (voice.position >= static_cast<int>(sound.size())) voice.sound = -1;
+    }
 
-    switch (colorChoice) {
-        case 0: // Hot magenta/pink
-            RetroColor::getPinkMaterial(time, 1.0f, torusColor);
-            break;
-        case 1: // Cyan/blue
-            RetroColor::getCyanMaterial(time, 1.0f, torusColor);
-            break;
-        case 2: // Vibrant yellow/gold
-            RetroColor::getGoldMaterial(time, 1.0f, torusColor);
-            break;
+    for (int i = 0; i < frames * 2; i++) {
+        out[i] = std::min(std::max(out[i], -1.0f), 1.0f);
     }
+    audio.blocks++;
+    audio.mixNanoseconds += profilerNow() - start;
+    audio.mixAllocations += threadHeapAllocations - allocations;
+}
 
-    GLfloat specular[] = {1.0f, 1.0f, 1.0f, 1.0f};
-    GLfloat shininess[] = {40.0f};
+static void toPcm16(const float* in, short* out, int samples) {
+    for (int i = 0; i < samples; i++) {
+        out[i] = static_cast<short>(lrintf(in[i] * 32767.0f));
+    }
+}
 
-    glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, torusColor);
-    glMaterialfv(GL_FRONT, GL_SPECULAR, specular);
-    glMaterialfv(GL_FRONT, GL_SHININESS, shininess);
+static void writeWavHeader(FILE* file, int sampleRate, long long frames) {
+    unsigned dataBytes = static_cast<unsigned>(frames * 4);
+    unsigned header[11] = {
+        0x46464952u, 36 + dataBytes, 0x45564157u,     // "RIFF", size, "WAVE"
+        0x20746D66u, 16, 0x00020001u,                 // "fmt ", PCM, 2 channels
+        static_cast<unsigned>(sampleRate), static_cast<unsigned>(sampleRate) * 4,
+        0x00100004u,                                  // 4-byte frames, 16 bits
+        0x61746164u, dataBytes                        // "data", size
+    };
+    fseek(file, 0, SEEK_SET);
+    fwrite(header, sizeof(header), 1, file); // Little-endian hosts
+}
 
-    // Temporarily disable lighting for wireframe effect
-    glDisable(GL_LIGHTING);
+#ifdef _WIN32
+static bool openAudioDevice(AudioEngine& audio) {
+    WAVEFORMATEX format;
+    memset(&format, 0, sizeof(format));
+    format.wFormatTag = WAVE_FORMAT_PCM;
+    format.nChannels = 2;
+    format.nSamplesPerSec = audio.sampleRate;
+    format.wBitsPerSample = 16;
+    format.nBlockAlign = 4;
+    format.nAvgBytesPerSec = audio.sampleRate * 4;
+    audio.deviceEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (waveOutOpen(&audio.device, WAVE_MAPPER, &format, reinterpret_cast<DWORD_PTR>(audio.deviceEvent), 0,
+                    CALLBACK_EVENT) != MMSYSERR_NOERROR) {
+        CloseHandle(audio.deviceEvent);
+        return false;
+    }
+    for (int i = 0; i < AUDIO_DEVICE_BUFFERS; i++) {
+        WAVEHDR& header = audio.headers[i];
+        memset(&header, 0, sizeof(header));
+        header.lpData = reinterpret_cast<LPSTR>(audio.deviceSamples[i]);
+        header.dwBufferLength = sizeof(audio.deviceSamples[i]);
+        waveOutPrepareHeader(audio.device, &header, sizeof(header));
+        header.dwFlags |= WHDR_DONE; // Free to fill
+    }
+    audio.nextHeader = 0;
+    return true;
+}
 
-    // Draw wireframe with thicker lines for neon effect
-    glEnable(GL_BLEND);
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE);
-    glLineWidth(2.5f);
+static void closeAudioDevice(AudioEngine& audio) {
+    waveOutReset(audio.device);
+    for (int i = 0; i < AUDIO_DEVICE_BUFFERS; i++) {
+        waveOutUnprepareHeader(audio.device, &audio.headers[i], sizeof(WAVEHDR));
+    }
+    waveOutClose(audio.device);
+    CloseHandle(audio.deviceEvent);
+}
+#endif
+
+static bool openAudioSink(AudioEngine& audio) {
+    audio.written = 0;
+    audio.started = std::chrono::steady_clock::now();
+    switch (audio.sink) {
+        case AUDIO_SINK_DEVICE:
+#ifdef _WIN32
+            return openAudioDevice(audio);
+#else
+            audio.sink = AUDIO_SINK_NULL; // No sound card support here
+            return true;
+#endif
+        case AUDIO_SINK_NULL:
+            return true;
+        case AUDIO_SINK_FILE:
+            audio.file = fopen(audioSinkPath, "wb");
+            if (!audio.file) return false;
+            writeWavHeader(audio.file, audio.sampleRate, 0);
+            return true;
+    }
+    return false;
+}
 
-    // Use same color for wireframe as selected material
-    switch (colorChoice) {
-        case 0:
-            RetroColor::Pink(time, 0.95f);
+static void closeAudioSink(AudioEngine& audio) {
+    switch (audio.sink) {
+        case AUDIO_SINK_DEVICE:
+#ifdef _WIN32
+            closeAudioDevice(audio);
+#endif
             break;
-        case 1:
-            RetroColor::Cyan(time, 0.95f);
+        case AUDIO_SINK_NULL:
             break;
-                case 2:
-            RetroColor::Gold(time, 0.95f);
+        case AUDIO_SINK_FILE:
+            writeWavHeader(audio.file, audio.sampleRate, audio.written);
+            fclose(audio.file);
+            audio.file = NULL;
             break;
     }
+}
 
-    // Draw wireframe torus using glutWireTorus with retrowave colors
-    glutWireTorus(1.0f, 4.0f, 16, 48);
-
-    // Add glow effect
-    glLineWidth(4.0f);
+// Blocks until the sink wants another block: a sound card once one of its
+// buffers has played, the other sinks when a card would have
+static void waitForAudioSink(AudioEngine& audio) {
+#ifdef _WIN32
+    if (audio.sink == AUDIO_SINK_DEVICE) {
+        while (!(audio.headers[audio.nextHeader].dwFlags & WHDR_DONE) && audio.running.load()) {
+            WaitForSingleObject(audio.deviceEvent, 20);
+        }
+        return;
+    }
+#endif
+    long long ahead = audio.written - AUDIO_DEVICE_BUFFERS * AUDIO_BLOCK;
+    if (ahead > 0) {
+        std::this_thread::sleep_until(audio.started + std::chrono::microseconds(ahead * 1000000LL / audio.sampleRate));
+    }
+}
 
-    switch (colorChoice) {
-        case 0:
-            RetroColor::Pink(time, 0.3f);
+static void writeAudioSink(AudioEngine& audio, const float* samples, int frames) {
+    switch (audio.sink) {
+        case AUDIO_SINK_DEVICE: {
+#ifdef _WIN32
+            WAVEHDR& header = audio.headers[audio.nextHeader];
+            toPcm16(samples, audio.deviceSamples[audio.nextHeader], frames * 2);
+            header.dwFlags &= ~WHDR_DONE;
+            waveOutWrite(audio.device, &header, sizeof(header));
+            audio.nextHeader = (audio.nextHeader + 1) % AUDIO_DEVICE_BUFFERS;
+#endif
             break;
-        case 1:
-            RetroColor::Cyan(time, 0.3f);
+        }
+        case AUDIO_SINK_NULL:
             break;
-        case 2:
-            RetroColor::Gold(time, 0.3f);
+        case AUDIO_SINK_FILE:
+            toPcm16(samples, audio.pcm, frames * 2);
+            fwrite(audio.pcm, sizeof(short) * 2, frames, audio.file);
             break;
     }
+    audio.written += frames;
+}
 
-    // Redraw some rings for glow effect
-    glutWireTorus(1.1f, 4.1f, 8, 24);
+// Stays tracked: the mixer must not allocate, and anything it does shows up
+// in the frame's count as well as in mixAllocations
+static void audioOutputThreadMain() {
+    AudioEngine& audio = audioEngine;
+    while (audio.running.load()) {
+        waitForAudioSink(audio);
+        if (!audio.running.load()) break;
+        mixAudioBlock(audio, audio.block, AUDIO_BLOCK);
+        writeAudioSink(audio, audio.block, AUDIO_BLOCK);
+    }
+}
 
-    // Reset line width
-    glLineWidth(1.0f);
+// Starts the engine with the track at path (a WAV) looping; without one only
+// effects play, or the synthesized test track if testTrack is set. False if
+// no music plays. A sink that fails to open falls back to the null
+// sink, so the music clock always runs.
+bool startAudio(const char* path, bool testTrack) {
+    AudioEngine& audio = audioEngine;
+    if (audio.running.load()) return false;
+
+    audio.hasMusic = path && audio.music.open(path);
+    audio.testTrack = !audio.hasMusic && testTrack;
+    audio.hasMusic = audio.hasMusic || audio.testTrack;
+    audio.testFrames = 0;
+    audio.sampleRate = audio.hasMusic && !audio.testTrack ? audio.music.sampleRate : AUDIO_DEFAULT_RATE;
+    synthesizeSounds(audio);
+    for (int v = 0; v < AUDIO_VOICES; v++) audio.voices[v].sound = -1;
+    audio.musicVolume = 0.5f;
+    audio.effectsVolume = 0.8f;
+    audio.appliedVolume = 0.5f;
+    audio.paused = false;
+    audio.musicFrames = 0;
+    audio.blocks = 0;
+    audio.underruns = 0;
+    audio.mixNanoseconds = 0;
+    audio.mixAllocations = 0;
+
+    // Fill the ring before the first block is mixed
+    audio.ring.clear();
+    while (audio.hasMusic && audio.ring.space() >= AUDIO_DECODE_BLOCK) decodeMusicBlock(audio);
+
+    audio.sink = audioSinkType;
+    if (!openAudioSink(audio)) {
+        std::cerr << "Failed to open the audio output, continuing silent" << std::endl;
+        audio.sink = AUDIO_SINK_NULL;
+        openAudioSink(audio);
+    }
+    audio.running = true;
+    if (audio.hasMusic) audio.decodeThread = std::thread(audioDecodeThreadMain);
+    audio.outputThread = std::thread(audioOutputThreadMain);
+    return audio.hasMusic;
+}
 
-    // Re-enable lighting for solid model
-    glEnable(GL_LIGHTING);
+void stopAudio() {
+    AudioEngine& audio = audioEngine;
+    if (!audio.running.load()) return;
+    audio.running = false;
+    if (audio.decodeThread.joinable()) audio.decodeThread.join();
+    audio.outputThread.join();
+    closeAudioSink(audio);
+    audio.music.close();
+}
 
-    // Draw solid torus with transparency for glow effect
-    torusColor[3] = 0.2f; // Make it semi-transparent
-    glMaterialfv(GL_FRONT, GL_AMBIENT_AND_DIFFUSE, torusColor);
+void toggleMusicPause() {
+    audioEngine.paused = !audioEngine.paused.load();
+}
 
-    glutSolidTorus(0.8f, 4.2f, 16, 48); // Different proportions for effect
+void adjustMusicVolume(float change) {
+    float volume = std::min(std::max(audioEngine.musicVolume.load() + change, 0.0f), 1.0f);
+    audioEngine.musicVolume = volume;
+    std::cout << "Volume: " << static_cast<int>(volume * 100.0f + 0.5f) << "%" << std::endl;
+}
 
-    glDisable(GL_BLEND);
-    glPopMatrix();
+// Render thread; dropped while the engine is off or the queue is full
+void playSound(SoundEffect sound, float gain) {
+    if (!audioEngine.running.load()) return;
+    AudioEvent event = { sound, gain };
+    audioEngine.events.push(event);
 }
 
-void calculateFPS() {
-    frameCount++;
-    currentTime = glutGet(GLUT_ELAPSED_TIME) / 1000.0f;
-    float timeInterval = currentTime - previousTime;
+// Render thread: effects for what the newest snapshot changed, a whoosh as
+// the boost kicks in and a crash on a fresh contact
+void updateSoundEffects(const PlayerCar& car, float time) {
+    static bool boosting = false;
+    static long long contacts = 0;
+    static float lastCrash = -1.0f;
+
+    bool boostingNow = car.input.boost && car.input.throttle > 0.0f && car.boost > 0.0f;
+    if (boostingNow && !boosting) playSound(SOUND_BOOST, 1.0f);
+    boosting = boostingNow;
+
+    // Scraping along a wall touches every step; one crash until it lets go
+    if (car.contacts > contacts && time - lastCrash > 0.3f) playSound(SOUND_CRASH, 1.0f);
+    if (car.contacts > contacts) lastCrash = time;
+    contacts = car.contacts;
+}
 
-    if (timeInterval >= 1.0f) {
-        fps = frameCount / timeInterval;
-        previousTime = currentTime;
-        frameCount = 0;
+// Seconds of music played, which stops while paused
+double audioMusicSeconds() {
+    AudioEngine& audio = audioEngine;
+    return audio.sampleRate > 0 ? static_cast<double>(audio.musicFrames.load()) / audio.sampleRate : 0.0;
+}
 
-        // Update window title with FPS
-        char title[64];
-        snprintf(title, sizeof(title), "Retro Wave city - 221003166 - 221001810 - FPS: %.1f", fps);
-        glutSetWindowTitle(title);
+// --audio-bench [seconds]: the engine as the game runs it (null sink unless
+// --audio-sink says otherwise) with an effect fired every 100 ms, then the
+// mixer alone as fast as it goes with every voice busy. Without the music
+// file the test track stands in, so the decode thread and ring still run.
+// Reports underruns, the mixer's share of a core and its throughput; fails
+// on any underrun or if the mixer allocated.
+int runAudioBenchmark() {
+    if (!audioSinkGiven) audioSinkType = AUDIO_SINK_NULL;
+    AudioEngine& audio = audioEngine;
+    startAudio(musicPath, true);
+    bool testTrack = audio.testTrack;
+    const char* sinkNames[] = { "device", "null", "file" };
+    const char* sinkName = sinkNames[audio.sink];
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int shot = 0; ; shot++) {
+        double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (elapsed >= audioBenchSeconds) break;
+        playSound(shot % 2 == 0 ? SOUND_BOOST : SOUND_CRASH, 0.5f);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    long long blocks = audio.blocks.load();
+    long long underruns = audio.underruns.load();
+    double mixMs = audio.mixNanoseconds.load() / 1e6;
+    stopAudio();
+
+    // Mixer throughput, decoding on the same thread outside the timing
+    if (!testTrack) audio.music.open(musicPath);
+    audio.ring.clear();
+    audio.testFrames = 0;
+    audio.mixNanoseconds = 0;
+    const int THROUGHPUT_BLOCKS = 20000;
+    for (int b = 0; b < THROUGHPUT_BLOCKS; b++) {
+        while (audio.hasMusic && audio.ring.space() >= AUDIO_DECODE_BLOCK) decodeMusicBlock(audio);
+        AudioEvent event = { b % 2 == 0 ? SOUND_BOOST : SOUND_CRASH, 0.5f };
+        audio.events.push(event);
+        mixAudioBlock(audio, audio.block, AUDIO_BLOCK);
+    }
+    audio.music.close();
+    double framesPerSecond = static_cast<double>(THROUGHPUT_BLOCKS) * AUDIO_BLOCK / (audio.mixNanoseconds.load() / 1e9);
+
+    long long mixAllocations = audio.mixAllocations.load();
+    printf("{\n  \"sink\": \"%s\",\n  \"sample_rate\": %d,\n  \"music\": \"%s\",\n", sinkName, audio.sampleRate,
+           testTrack ? "test_track" : musicPath);
+    printf("  \"seconds\": %.2f,\n  \"blocks\": %lld,\n  \"block_frames\": %d,\n  \"underruns\": %lld,\n",
+           seconds, blocks, AUDIO_BLOCK, underruns);
+    printf("  \"mix_us_per_block\": %.2f,\n", blocks > 0 ? mixMs * 1000.0 / blocks : 0.0);
+    printf("  \"core_percent\": %.3f,\n", mixMs / (seconds * 1000.0) * 100.0);
+    printf("  \"mix_allocations\": %lld,\n", mixAllocations);
+    printf("  \"throughput\": { \"voices\": %d, \"frames_per_second\": %.0f, \"realtime_factor\": %.0f }\n}\n",
+           AUDIO_VOICES, framesPerSecond, framesPerSecond / audio.sampleRate);
+    if (mixAllocations > 0) {
+        std::cerr << "The mixer allocated (" << mixAllocations << " allocations)" << std::endl;
+        return 1;
     }
+    return underruns == 0 ? 0 : 1;
 }